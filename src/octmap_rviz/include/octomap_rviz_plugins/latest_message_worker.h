@@ -0,0 +1,58 @@
+/*
+ * LatestMessageWorker: decodes octomap messages for the octomap rviz
+ * plugins on a thread of their own
+ * License: BSD
+ */
+
+#ifndef RVIZ_LATEST_MESSAGE_WORKER_H
+#define RVIZ_LATEST_MESSAGE_WORKER_H
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <octomap_msgs/Octomap.h>
+
+namespace octomap_rviz_plugin
+{
+
+/**
+ * Runs a callback for octomap messages on its own thread, so that a large
+ * map neither backs up the subscriber queue nor stalls rviz. Only the latest
+ * message that is not processed yet is kept: a backlog is coalesced into its
+ * newest map.
+ */
+class LatestMessageWorker
+{
+public:
+  typedef boost::function<void (const octomap_msgs::OctomapConstPtr&)> Callback;
+
+  LatestMessageWorker(const Callback& callback);
+
+  /// stops the thread after the message in progress
+  ~LatestMessageWorker();
+
+  /// process msg next, replacing the pending message
+  void push(const octomap_msgs::OctomapConstPtr& msg);
+
+  /// drop the pending message and wait for the one in progress
+  void cancel();
+
+private:
+  void run();
+
+  Callback callback_;
+
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  octomap_msgs::OctomapConstPtr pending_;
+  bool busy_;
+  bool stopped_;
+
+  boost::thread thread_;
+};
+
+} // namespace octomap_rviz_plugin
+
+#endif
@@ -49,6 +49,15 @@
 #include <rviz/display.h>
 #include "rviz/ogre_helpers/point_cloud.h"
 
+#include <OGRE/OgreAxisAlignedBox.h>
+
+#include "octomap_rviz_plugins/latest_message_worker.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+
 #endif
 
 namespace rviz {
@@ -56,6 +65,7 @@ class RosTopicProperty;
 class IntProperty;
 class EnumProperty;
 class FloatProperty;
+class BoolProperty;
 }
 
 namespace octomap_rviz_plugin
@@ -82,6 +92,7 @@ private Q_SLOTS:
   void updateAlpha();
   void updateMaxHeight();
   void updateMinHeight();
+  void updateLODLevels();
 
 protected:
   // overrides from Display
@@ -93,6 +104,12 @@ protected:
 
   virtual void incomingMessageCallback(const octomap_msgs::OctomapConstPtr& msg) = 0;
 
+  /// rebuild the points of the last map, culling it again only if tree depth, render mode or LOD levels changed. False if there is no map yet.
+  virtual bool redraw() = 0;
+
+  /// forget the last map
+  virtual void clearMap() = 0;
+
   void setColor( double z_pos, double min_z, double max_z, double color_factor, rviz::PointCloud::Point& point);
 
   void clear();
@@ -102,18 +119,45 @@ protected:
   typedef std::vector<rviz::PointCloud::Point> VPoint;
   typedef std::vector<VPoint> VVPoint;
 
-  boost::shared_ptr<message_filters::Subscriber<octomap_msgs::Octomap> > sub_;
+  // points of a chunk of the map, handed from the map thread to update()
+  struct ChunkPoints
+  {
+    Ogre::AxisAlignedBox bounds; // in the frame of the map
+    std::vector<VVPoint> levels; // per level of detail (0: the rendered depth) and depth, empty for a removed chunk
+  };
+
+  // a chunk of the map in the render thread
+  struct ChunkClouds
+  {
+    Ogre::AxisAlignedBox bounds;
+    std::vector<VVPoint> points; // per level of detail and depth, until the clouds of the level are created
+    std::vector<std::vector<rviz::PointCloud*> > clouds; // per level of detail and depth (NULL without points)
+    int level; // shown level of detail, -1 if outside of the view
+  };
 
-  boost::mutex mutex_;
+  /// replace the clouds of chunk id by points, or remove them if it has no levels
+  void updateChunkClouds(uint64_t id, ChunkPoints& points);
 
-  // point buffer
-  VVPoint new_points_;
-  VVPoint point_buf_;
-  bool new_points_received_;
+  void deleteChunkClouds(ChunkClouds& chunk);
 
-  // Ogre-rviz point clouds
-  std::vector<rviz::PointCloud*> cloud_;
+  /// show the clouds of level (creating them on first use) instead of the current ones, none for -1
+  void showChunkLevel(uint64_t id, ChunkClouds& chunk, int level);
+
+  /// choose the level of detail of each chunk by its distance to the camera, hide chunks outside of the view
+  void updateChunkLevels();
+
+  boost::shared_ptr<message_filters::Subscriber<octomap_msgs::Octomap> > sub_;
+
+  boost::mutex mutex_; // only held to hand over the points, update() does not wait for it
+
+  // points of the chunks changed since the last update(), by chunk id
+  std::map<uint64_t, ChunkPoints> new_points_;
   std::vector<double> box_size_;
+  bool clouds_cleared_; // the chunk clouds were dropped, the next points have to contain all chunks
+
+  // Ogre-rviz point clouds by chunk id, only used by the render thread
+  std::map<uint64_t, ChunkClouds> chunk_clouds_;
+  std::vector<double> cloud_box_size_;
   std_msgs::Header header_;
 
   // Plugin properties
@@ -125,20 +169,89 @@ protected:
   rviz::FloatProperty* alpha_property_;
   rviz::FloatProperty* max_height_property_;
   rviz::FloatProperty* min_height_property_;
+  rviz::IntProperty* lod_levels_property_;
+  rviz::FloatProperty* lod_distance_property_;
+  rviz::BoolProperty* frustum_culling_property_;
 
   u_int32_t queue_size_;
   uint32_t messages_received_;
   double color_factor_;
+
+  // decodes the latest message off the subscriber and render threads
+  LatestMessageWorker worker_;
 };
 
 template <typename OcTreeType>
 class TemplatedOccupancyGridDisplay: public OccupancyGridDisplay {
+public:
+  TemplatedOccupancyGridDisplay();
+  virtual ~TemplatedOccupancyGridDisplay();
+
 protected:
+  /// a node of the map that is not occluded by neighbors on all six sides
+  struct VisibleVoxel
+  {
+    octomap::OcTreeKey key;
+    octomap::point3d center;
+    unsigned int depth;
+  };
+
+  /// a spatial chunk of the map: the subtree of a node at chunk depth, or a leaf above it
+  struct Chunk
+  {
+    typename OcTreeType::NodeType* node; // in octree_
+    octomap::OcTreeKey key;
+    unsigned int depth;
+    uint64_t hash; // of the subtree, unchanged chunks of a new map keep their voxels and points
+    std::vector<std::vector<VisibleVoxel> > levels; // visible voxels per level of detail
+  };
+
+  typedef std::map<uint64_t, Chunk> ChunkMap;
+
   void incomingMessageCallback(const octomap_msgs::OctomapConstPtr& msg);
+  bool redraw();
+  void clearMap();
+
+  /**
+   * Split octree_ into chunks and cull the voxels (up to the tree depth
+   * property, in the render mode, for each level of detail) of the chunks
+   * whose subtree changed since the last call, and of their neighbors. The
+   * points of these chunks (of all chunks with refill) are handed to update().
+   */
+  void updateChunks(bool refill);
+
+  /// add the chunks below node (at depth with key) to chunks
+  void collectChunks(typename OcTreeType::NodeType* node, const octomap::OcTreeKey& key, unsigned int depth,
+                     unsigned int chunk_depth, ChunkMap& chunks) const;
+
+  /// mark the chunks next to the chunk at key (of depth) as dirty, or all if they can't be found directly
+  void markNeighbors(const octomap::OcTreeKey& key, unsigned int depth, unsigned int chunk_depth,
+                     const ChunkMap& chunks, std::set<uint64_t>& dirty, bool& all) const;
+
+  /// collect the visible voxels of chunk in render_mode, for num_levels levels of detail below tree_depth
+  void cullChunk(Chunk& chunk, unsigned int tree_depth, int render_mode, unsigned int num_levels) const;
+
+  /// the visible voxels of chunk up to tree_depth
+  void cullChunkLevel(const Chunk& chunk, unsigned int tree_depth, int render_mode, std::vector<VisibleVoxel>& visible) const;
+
+  /// the points of the visible voxels of chunk in the height range
+  void fillChunk(const Chunk& chunk, double min_z, double max_z, ChunkPoints& points);
+
   void setVoxelColor(rviz::PointCloud::Point& newPoint, typename OcTreeType::NodeType& node, double minZ, double maxZ);
   ///Returns false, if the type_id (of the message) does not correspond to the template paramter
   ///of this class, true if correct or unknown (i.e., no specialized method for that template).
   bool checkType(std::string type_id);
+
+  boost::mutex map_mutex_; // last map and its chunks, written by the message callback and the property slots
+
+  // last map and its chunks, culled for culled_depth_, culled_render_mode_ and culled_levels_, colored for points_min_z_ and points_max_z_:
+  OcTreeType* octree_;
+  ChunkMap chunks_;
+  unsigned int culled_depth_;
+  int culled_render_mode_;
+  unsigned int culled_levels_;
+  double points_min_z_;
+  double points_max_z_;
 };
 
 } // namespace octomap_rviz_plugin
@@ -47,6 +47,8 @@
 
 #include <message_filters/subscriber.h>
 
+#include "octomap_rviz_plugins/latest_message_worker.h"
+
 #endif
 
 namespace octomap_rviz_plugin
@@ -74,10 +76,19 @@ protected:
 
   unsigned int octree_depth_;
   rviz::IntProperty* tree_depth_property_;
+
+  // grid of the last map, reused for the next one if rviz does not hold it anymore
+  nav_msgs::OccupancyGrid::Ptr occupancy_map_;
+
+  // decodes the latest message off the subscriber and render threads
+  LatestMessageWorker worker_;
 };
 
 template <typename OcTreeType>
 class TemplatedOccupancyMapDisplay: public OccupancyMapDisplay {
+public:
+  virtual ~TemplatedOccupancyMapDisplay();
+
 protected:
     void handleOctomapBinaryMessage(const octomap_msgs::OctomapConstPtr& msg);
 };
@@ -0,0 +1,73 @@
+/*
+ * LatestMessageWorker: decodes octomap messages for the octomap rviz
+ * plugins on a thread of their own
+ * License: BSD
+ */
+
+#include "octomap_rviz_plugins/latest_message_worker.h"
+
+namespace octomap_rviz_plugin
+{
+
+LatestMessageWorker::LatestMessageWorker(const Callback& callback) :
+    callback_(callback),
+    busy_(false),
+    stopped_(false)
+{
+  thread_ = boost::thread(&LatestMessageWorker::run, this);
+}
+
+LatestMessageWorker::~LatestMessageWorker()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    pending_.reset();
+  }
+  condition_.notify_all();
+  thread_.join();
+}
+
+void LatestMessageWorker::push(const octomap_msgs::OctomapConstPtr& msg)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    // an older message that was not started yet is dropped
+    pending_ = msg;
+  }
+  condition_.notify_all();
+}
+
+void LatestMessageWorker::cancel()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  pending_.reset();
+  while (busy_)
+    condition_.wait(lock);
+}
+
+void LatestMessageWorker::run()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while (true)
+  {
+    while (!pending_ && !stopped_)
+      condition_.wait(lock);
+
+    if (stopped_)
+      return;
+
+    octomap_msgs::OctomapConstPtr msg;
+    msg.swap(pending_);
+    busy_ = true;
+
+    lock.unlock();
+    callback_(msg);
+    lock.lock();
+
+    busy_ = false;
+    condition_.notify_all();
+  }
+}
+
+} // namespace octomap_rviz_plugin
@@ -38,6 +38,7 @@
 
 #include <OGRE/OgreSceneNode.h>
 #include <OGRE/OgreSceneManager.h>
+#include <OGRE/OgreCamera.h>
 
 #include "rviz/visualization_manager.h"
 #include "rviz/frame_manager.h"
@@ -45,6 +46,9 @@
 #include "rviz/properties/ros_topic_property.h"
 #include "rviz/properties/enum_property.h"
 #include "rviz/properties/float_property.h"
+#include "rviz/properties/bool_property.h"
+#include "rviz/view_manager.h"
+#include "rviz/view_controller.h"
 
 #include <octomap/octomap.h>
 #include <octomap/ColorOcTree.h>
@@ -52,6 +56,7 @@
 #include <octomap_msgs/conversions.h>
 
 
+#include <cstring>
 #include <sstream>
 
 
@@ -77,10 +82,11 @@ enum OctreeVoxelColorMode
 
 OccupancyGridDisplay::OccupancyGridDisplay() :
     rviz::Display(),
-    new_points_received_(false),
+    clouds_cleared_(false),
     messages_received_(0),
     queue_size_(5),
-    color_factor_(0.8)
+    color_factor_(0.8),
+    worker_(boost::bind(&OccupancyGridDisplay::incomingMessageCallback, this, _1))
 {
 
   octomap_topic_property_ = new RosTopicProperty( "Octomap Topic",
@@ -140,37 +146,42 @@ OccupancyGridDisplay::OccupancyGridDisplay() :
                                            "Defines the minimum height to display",
                                            this,
                                            SLOT (updateMinHeight() ));
+
+  lod_levels_property_ = new IntProperty("LOD Levels",
+                                         4,
+                                         "Number of levels of detail, each one octree depth coarser than the previous one (1: off)",
+                                         this,
+                                         SLOT (updateLODLevels() ));
+  lod_levels_property_->setMin(1);
+  lod_levels_property_->setMax(6);
+
+  lod_distance_property_ = new FloatProperty("LOD Distance",
+                                             20.0,
+                                             "Distance from the camera beyond which chunks of the map are drawn one level coarser, "
+                                             "and again at each doubling of it (0: always full detail)",
+                                             this);
+  lod_distance_property_->setMin(0.0);
+
+  frustum_culling_property_ = new BoolProperty("Frustum Culling",
+                                               true,
+                                               "Hide the chunks of the map outside of the camera view",
+                                               this);
 }
 
 void OccupancyGridDisplay::onInitialize()
 {
   boost::mutex::scoped_lock lock(mutex_);
 
+  // the point clouds are created per chunk of the map in update()
   box_size_.resize(max_octree_depth_);
-  cloud_.resize(max_octree_depth_);
-  point_buf_.resize(max_octree_depth_);
-  new_points_.resize(max_octree_depth_);
-
-  for (std::size_t i = 0; i < max_octree_depth_; ++i)
-  {
-    std::stringstream sname;
-    sname << "PointCloud Nr." << i;
-    cloud_[i] = new rviz::PointCloud();
-    cloud_[i]->setName(sname.str());
-    cloud_[i]->setRenderMode(rviz::PointCloud::RM_BOXES);
-    scene_node_->attachObject(cloud_[i]);
-  }
 }
 
 OccupancyGridDisplay::~OccupancyGridDisplay()
 {
-  std::size_t i;
-
   unsubscribe();
 
-  for (std::vector<rviz::PointCloud*>::iterator it = cloud_.begin(); it != cloud_.end(); ++it) {
-    delete *(it);
-  }
+  for (std::map<uint64_t, ChunkClouds>::iterator it = chunk_clouds_.begin(); it != chunk_clouds_.end(); ++it)
+    deleteChunkClouds(it->second);
 
   if (scene_node_)
     scene_node_->detachAllObjects();
@@ -216,7 +227,7 @@ void OccupancyGridDisplay::subscribe()
       sub_.reset(new message_filters::Subscriber<octomap_msgs::Octomap>());
 
       sub_->subscribe(threaded_nh_, topicStr, queue_size_);
-      sub_->registerCallback(boost::bind(&OccupancyGridDisplay::incomingMessageCallback, this, _1));
+      sub_->registerCallback(boost::bind(&LatestMessageWorker::push, &worker_, _1));
 
     }
   }
@@ -229,8 +240,6 @@ void OccupancyGridDisplay::subscribe()
 
 void OccupancyGridDisplay::unsubscribe()
 {
-  clear();
-
   try
   {
     // reset filters
@@ -241,6 +250,9 @@ void OccupancyGridDisplay::unsubscribe()
     setStatus(StatusProperty::Error, "Topic", (std::string("Error unsubscribing: ") + e.what()).c_str());
   }
 
+  // no more points of the old subscription after clear():
+  worker_.cancel();
+  clear();
 }
 
 // method taken from octomap_server package
@@ -291,34 +303,47 @@ void OccupancyGridDisplay::setColor(double z_pos, double min_z, double max_z, do
   }
 }
 
+// the display properties are applied to the last map, without waiting for the next one:
 void OccupancyGridDisplay::updateTreeDepth()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::updateOctreeRenderMode()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::updateOctreeColorMode()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::updateAlpha()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::updateMaxHeight()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::updateMinHeight()
 {
-  updateTopic();
+  if (!redraw())
+    updateTopic();
+}
+
+void OccupancyGridDisplay::updateLODLevels()
+{
+  if (!redraw())
+    updateTopic();
 }
 
 void OccupancyGridDisplay::clear()
@@ -326,38 +351,173 @@ void OccupancyGridDisplay::clear()
 
   boost::mutex::scoped_lock lock(mutex_);
 
-  // reset rviz pointcloud boxes
-  for (size_t i = 0; i < cloud_.size(); ++i)
+  // remove rviz pointcloud boxes, the next map is sent completely
+  for (std::map<uint64_t, ChunkClouds>::iterator it = chunk_clouds_.begin(); it != chunk_clouds_.end(); ++it)
+    deleteChunkClouds(it->second);
+  chunk_clouds_.clear();
+
+  new_points_.clear();
+  clouds_cleared_ = true;
+}
+
+void OccupancyGridDisplay::deleteChunkClouds(ChunkClouds& chunk)
+{
+  for (size_t level = 0; level < chunk.clouds.size(); ++level)
   {
-    cloud_[i]->clear();
+    for (size_t i = 0; i < chunk.clouds[level].size(); ++i)
+    {
+      if (chunk.clouds[level][i])
+      {
+        scene_node_->detachObject(chunk.clouds[level][i]);
+        delete chunk.clouds[level][i];
+      }
+    }
   }
+  chunk.clouds.clear();
 }
 
-void OccupancyGridDisplay::update(float wall_dt, float ros_dt)
+void OccupancyGridDisplay::updateChunkClouds(uint64_t id, ChunkPoints& points)
 {
-  if (new_points_received_)
+  std::map<uint64_t, ChunkClouds>::iterator chunk = chunk_clouds_.find(id);
+  if (chunk != chunk_clouds_.end())
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    deleteChunkClouds(chunk->second);
+    if (points.levels.empty())
+    {
+      chunk_clouds_.erase(chunk);
+      return;
+    }
+  }
+  else if (points.levels.empty())
+    return;
+  else
+    chunk = chunk_clouds_.insert(std::make_pair(id, ChunkClouds())).first;
+
+  // the clouds of a level are created when it is shown first
+  ChunkClouds& clouds = chunk->second;
+  clouds.bounds = points.bounds;
+  clouds.points.swap(points.levels);
+  clouds.clouds.resize(clouds.points.size());
+  clouds.level = -1;
+}
+
+void OccupancyGridDisplay::showChunkLevel(uint64_t id, ChunkClouds& chunk, int level)
+{
+  if (level == chunk.level)
+    return;
+
+  if (chunk.level >= 0)
+  {
+    for (size_t i = 0; i < chunk.clouds[chunk.level].size(); ++i)
+    {
+      if (chunk.clouds[chunk.level][i])
+        chunk.clouds[chunk.level][i]->setVisible(false);
+    }
+  }
+
+  chunk.level = level;
+  if (level < 0)
+    return;
+
+  std::vector<rviz::PointCloud*>& clouds = chunk.clouds[level];
+  if (clouds.empty())
+  {
+    // no Ogre objects for empty depths
+    VVPoint& points = chunk.points[level];
+    clouds.resize(max_octree_depth_, NULL);
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+      if (points[i].empty())
+        continue;
+
+      std::stringstream sname;
+      sname << "PointCloud Nr." << id << "." << level << "." << i;
+      clouds[i] = new rviz::PointCloud();
+      clouds[i]->setName(sname.str());
+      clouds[i]->setRenderMode(rviz::PointCloud::RM_BOXES);
+      scene_node_->attachObject(clouds[i]);
+
+      double size = cloud_box_size_[i];
+      clouds[i]->setDimensions(size, size, size);
+
+      clouds[i]->addPoints(&points[i].front(), points[i].size());
+      clouds[i]->setAlpha(alpha_property_->getFloat());
+    }
+    // the points are in the clouds now
+    VVPoint().swap(points);
+  }
+
+  for (size_t i = 0; i < clouds.size(); ++i)
+  {
+    if (clouds[i])
+      clouds[i]->setVisible(true);
+  }
+}
+
+void OccupancyGridDisplay::updateChunkLevels()
+{
+  Ogre::Camera* camera = NULL;
+  if (context_->getViewManager()->getCurrent())
+    camera = context_->getViewManager()->getCurrent()->getCamera();
 
-    for (size_t i = 0; i < max_octree_depth_; ++i)
+  const bool frustumCulling = frustum_culling_property_->getBool() && camera;
+  const double lodDistance = camera ? lod_distance_property_->getFloat() : 0.0;
+  const Ogre::Matrix4& transform = scene_node_->_getFullTransform();
+
+  for (std::map<uint64_t, ChunkClouds>::iterator it = chunk_clouds_.begin(); it != chunk_clouds_.end(); ++it)
+  {
+    ChunkClouds& chunk = it->second;
+    Ogre::AxisAlignedBox bounds = chunk.bounds;
+    bounds.transformAffine(transform);
+
+    if (frustumCulling && !camera->isVisible(bounds))
     {
-      double size = box_size_[i];
+      showChunkLevel(it->first, chunk, -1);
+      continue;
+    }
 
-      cloud_[i]->clear();
-      cloud_[i]->setDimensions(size, size, size);
+    // coarser by one level each time the distance doubles
+    int level = 0;
+    if (lodDistance > 0.0)
+    {
+      double distance = (bounds.getCenter() - camera->getDerivedPosition()).length();
+      for (double levelDistance = lodDistance; distance > levelDistance && level + 1 < int(chunk.clouds.size());
+           levelDistance *= 2.0)
+        ++level;
+    }
+    showChunkLevel(it->first, chunk, level);
+  }
+}
 
-      cloud_[i]->addPoints(&new_points_[i].front(), new_points_[i].size());
-      new_points_[i].clear();
-      cloud_[i]->setAlpha(alpha_property_->getFloat());
+void OccupancyGridDisplay::update(float wall_dt, float ros_dt)
+{
+  std::map<uint64_t, ChunkPoints> points;
+  {
+    // if the points are being handed over right now, they are taken in the next frame
+    boost::mutex::scoped_try_lock lock(mutex_);
+    if (lock.owns_lock())
+    {
+      points.swap(new_points_);
+      if (!points.empty())
+        cloud_box_size_ = box_size_;
     }
-    new_points_received_ = false;
   }
+
+  // only the chunks that changed:
+  for (std::map<uint64_t, ChunkPoints>::iterator it = points.begin(); it != points.end(); ++it)
+    updateChunkClouds(it->first, it->second);
+
   updateFromTF();
+
+  // with the current pose of the map, the cached clouds of each chunk are only switched:
+  updateChunkLevels();
 }
 
 void OccupancyGridDisplay::reset()
 {
+  worker_.cancel();
   clear();
+  clearMap();
   messages_received_ = 0;
   setStatus(StatusProperty::Ok, "Messages", QString("0 binary octomap messages received"));
 }
@@ -370,6 +530,26 @@ void OccupancyGridDisplay::updateTopic()
   context_->queueRender();
 }
 
+template <typename OcTreeType>
+TemplatedOccupancyGridDisplay<OcTreeType>::TemplatedOccupancyGridDisplay() :
+    OccupancyGridDisplay(),
+    octree_(NULL),
+    culled_depth_(0),
+    culled_render_mode_(0),
+    culled_levels_(0),
+    points_min_z_(0.0),
+    points_max_z_(0.0)
+{
+}
+
+template <typename OcTreeType>
+TemplatedOccupancyGridDisplay<OcTreeType>::~TemplatedOccupancyGridDisplay()
+{
+  // no more messages for the map:
+  unsubscribe();
+  delete octree_;
+}
+
 template <typename OcTreeType>
 bool TemplatedOccupancyGridDisplay<OcTreeType>::checkType(std::string type_id)
 {
@@ -467,6 +647,449 @@ bool OccupancyGridDisplay::updateFromTF()
 }
 
 
+static inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+static uint64_t hashNode(const octomap::OcTreeNode& node)
+{
+  float value = node.getValue();
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static uint64_t hashNode(const octomap::ColorOcTreeNode& node)
+{
+  const octomap::ColorOcTreeNode::Color& color = node.getColor();
+  return hashCombine(hashNode(static_cast<const octomap::OcTreeNode&>(node)), (color.r << 16) | (color.g << 8) | color.b);
+}
+
+// hash of the values and the structure of the subtree below node
+template <typename OcTreeType>
+static uint64_t hashSubtree(const OcTreeType& octree, const typename OcTreeType::NodeType* node)
+{
+  uint64_t hash = hashNode(*node);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (octree.nodeChildExists(node, i))
+      hash = hashCombine(hash, hashCombine(i + 1, hashSubtree(octree, octree.getNodeChild(node, i))));
+  }
+  return hash;
+}
+
+// key of the i-th child of the node at key (of depth)
+static octomap::OcTreeKey childKey(const octomap::OcTreeKey& key, unsigned int depth, unsigned int max_depth, unsigned int i)
+{
+  octomap::OcTreeKey child;
+  octomap::computeChildKey(i, (1 << (max_depth - 1)) >> (depth + 1), key, child);
+  return child;
+}
+
+// id of the chunk of depth containing key: its index at that depth, packed into 3x16 bits, and the depth
+static uint64_t chunkId(const octomap::OcTreeKey& key, unsigned int depth, unsigned int max_depth)
+{
+  const unsigned int bits = max_depth - depth;
+  return uint64_t(key[0] >> bits) | (uint64_t(key[1] >> bits) << 16) | (uint64_t(key[2] >> bits) << 32)
+      | (uint64_t(depth) << 48);
+}
+
+// nodes of a chunk in render mode, hashed by depth for the neighbor lookups
+struct ChunkNodes
+{
+  int min[3];
+  int max[3];
+  std::vector<octomap::KeySet> keys; // per depth
+  std::vector<unsigned int> depths;  // with keys, deepest first
+};
+
+// true if the node at key (up to tree_depth) is in render mode
+template <typename OcTreeType>
+static bool isSolid(const OcTreeType& octree, const octomap::OcTreeKey& key, unsigned int tree_depth, int render_mode,
+                    const ChunkNodes& nodes)
+{
+  if (key[0] >= nodes.min[0] && key[0] <= nodes.max[0] && key[1] >= nodes.min[1] && key[1] <= nodes.max[1]
+      && key[2] >= nodes.min[2] && key[2] <= nodes.max[2])
+  {
+    for (std::size_t i = 0; i < nodes.depths.size(); ++i)
+    {
+      unsigned int depth = nodes.depths[i];
+      if (nodes.keys[depth].find(octree.adjustKeyAtDepth(key, depth)) != nodes.keys[depth].end())
+        return true;
+    }
+    return false;
+  }
+
+  // in another chunk:
+  typename OcTreeType::NodeType* node = octree.search(key, tree_depth);
+  // the left part evaluates to 1 for free voxels and 2 for occupied voxels
+  return node && ((((int)octree.isNodeOccupied(node)) + 1) & render_mode);
+}
+
+// true if the node at nKey (of depth) has neighbors in render mode on all sides -> no need to be displayed
+template <typename OcTreeType>
+static bool isOccluded(const OcTreeType& octree, const octomap::OcTreeKey& nKey, unsigned int depth, unsigned int treeDepth,
+                       int render_mode, const ChunkNodes& nodes)
+{
+  const unsigned int maxDepth = octree.getTreeDepth();
+  int stepSize = 1 << (maxDepth - treeDepth); // for pruning of occluded voxels
+
+  // determine indices of potentially neighboring voxels for depths < maximum tree depth
+  // +/-1 at maximum depth, +2^(depth_difference-1) and -2^(depth_difference-1)-1 on other depths
+  int diffBase = (depth < maxDepth) ? 1 << (maxDepth - depth - 1) : 1;
+  int diff[2] = {-((depth == maxDepth) ? diffBase : diffBase + 1), diffBase};
+
+  // cells with adjacent faces can occlude a voxel, iterate over the cases x,y,z (idxCase) and +/- (diff)
+  octomap::OcTreeKey key;
+  for (unsigned int idxCase = 0; idxCase < 3; ++idxCase)
+  {
+    int idx_0 = idxCase % 3;
+    int idx_1 = (idxCase + 1) % 3;
+    int idx_2 = (idxCase + 2) % 3;
+
+    for (int i = 0; i < 2; ++i)
+    {
+      key[idx_0] = nKey[idx_0] + diff[i];
+      // if rendering is restricted to treeDepth < maximum tree depth inner nodes with distance stepSize can already occlude a voxel
+      for (int k1 = nKey[idx_1] + diff[0] + 1; k1 < nKey[idx_1] + diff[1]; k1 += stepSize)
+      {
+        key[idx_1] = k1;
+        for (int k2 = nKey[idx_2] + diff[0] + 1; k2 < nKey[idx_2] + diff[1]; k2 += stepSize)
+        {
+          key[idx_2] = k2;
+          if (!isSolid(octree, key, treeDepth, render_mode, nodes))
+            return false; // we do not have a neighbor
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::collectChunks(typename OcTreeType::NodeType* node, const octomap::OcTreeKey& key,
+                                                              unsigned int depth, unsigned int chunk_depth, ChunkMap& chunks) const
+{
+  if (depth < chunk_depth && octree_->nodeHasChildren(node))
+  {
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (octree_->nodeChildExists(node, i))
+        collectChunks(octree_->getNodeChild(node, i), childKey(key, depth, octree_->getTreeDepth(), i), depth + 1, chunk_depth, chunks);
+    }
+    return;
+  }
+
+  Chunk& chunk = chunks[chunkId(key, depth, octree_->getTreeDepth())];
+  chunk.node = node;
+  chunk.key = key;
+  chunk.depth = depth;
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::markNeighbors(const octomap::OcTreeKey& key, unsigned int depth,
+                                                              unsigned int chunk_depth, const ChunkMap& chunks,
+                                                              std::set<uint64_t>& dirty, bool& all) const
+{
+  // a leaf above chunk depth has many neighbors, that is rare enough to re-cull everything
+  if (depth < chunk_depth)
+  {
+    all = true;
+    return;
+  }
+
+  const unsigned int maxDepth = octree_->getTreeDepth();
+  const int size = 1 << (maxDepth - depth);
+  for (unsigned int axis = 0; axis < 3; ++axis)
+  {
+    for (int side = -1; side <= 1; side += 2)
+    {
+      int neighbor = key[axis] + side * size;
+      if (neighbor < 0 || neighbor > std::numeric_limits<octomap::key_type>::max())
+        continue;
+
+      octomap::OcTreeKey nKey = key;
+      nKey[axis] = neighbor;
+      // the neighbor chunk, or the larger leaf containing it:
+      for (int d = depth; d >= 0; --d)
+      {
+        uint64_t id = chunkId(nKey, d, maxDepth);
+        if (chunks.find(id) != chunks.end())
+        {
+          dirty.insert(id);
+          break;
+        }
+      }
+    }
+  }
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::cullChunk(Chunk& chunk, unsigned int tree_depth, int render_mode,
+                                                          unsigned int num_levels) const
+{
+  // each level of detail is one depth coarser than the previous one, down to the chunk node itself
+  // (but not to the root, the point clouds start at depth 1)
+  chunk.levels.resize(1);
+  for (unsigned int level = 1; level < num_levels && chunk.depth + level < tree_depth; ++level)
+    chunk.levels.resize(level + 1);
+
+  for (unsigned int level = 0; level < chunk.levels.size(); ++level)
+    cullChunkLevel(chunk, tree_depth - level, render_mode, chunk.levels[level]);
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::cullChunkLevel(const Chunk& chunk, unsigned int tree_depth, int render_mode,
+                                                               std::vector<VisibleVoxel>& visible) const
+{
+  const unsigned int maxDepth = octree_->getTreeDepth();
+  const int size = 1 << (maxDepth - chunk.depth);
+  ChunkNodes nodes;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    nodes.min[i] = (chunk.key[i] >> (maxDepth - chunk.depth)) * size;
+    nodes.max[i] = nodes.min[i] + size - 1;
+  }
+  nodes.keys.resize(tree_depth + 1);
+
+  // nodes of the chunk down to tree_depth, as by the leaf iterator with a max. depth:
+  std::vector<VisibleVoxel> voxels;
+  std::vector<std::pair<typename OcTreeType::NodeType*, VisibleVoxel> > stack;
+  VisibleVoxel top;
+  top.key = chunk.key;
+  top.depth = chunk.depth;
+  stack.push_back(std::make_pair(chunk.node, top));
+  while (!stack.empty())
+  {
+    typename OcTreeType::NodeType* node = stack.back().first;
+    VisibleVoxel voxel = stack.back().second;
+    stack.pop_back();
+
+    if (voxel.depth < tree_depth && octree_->nodeHasChildren(node))
+    {
+      VisibleVoxel child;
+      child.depth = voxel.depth + 1;
+      for (unsigned int i = 0; i < 8; ++i)
+      {
+        if (octree_->nodeChildExists(node, i))
+        {
+          child.key = childKey(voxel.key, voxel.depth, maxDepth, i);
+          stack.push_back(std::make_pair(octree_->getNodeChild(node, i), child));
+        }
+      }
+      continue;
+    }
+
+    // the left part evaluates to 1 for free voxels and 2 for occupied voxels
+    if (!(((int)octree_->isNodeOccupied(node) + 1) & render_mode))
+      continue;
+
+    voxel.center = octree_->keyToCoord(voxel.key, voxel.depth);
+    voxels.push_back(voxel);
+    nodes.keys[voxel.depth].insert(voxel.key);
+  }
+
+  // most nodes are at the deepest levels:
+  for (int depth = tree_depth; depth >= 0; --depth)
+  {
+    if (!nodes.keys[depth].empty())
+      nodes.depths.push_back(depth);
+  }
+
+  visible.clear();
+  for (std::size_t i = 0; i < voxels.size(); ++i)
+  {
+    if (!isOccluded(*octree_, voxels[i].key, voxels[i].depth, tree_depth, render_mode, nodes))
+      visible.push_back(voxels[i]);
+  }
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::fillChunk(const Chunk& chunk, double min_z, double max_z, ChunkPoints& points)
+{
+  const unsigned int maxDepth = octree_->getTreeDepth();
+  double maxHeight = std::min<double>(max_height_property_->getFloat(), max_z);
+  double minHeight = std::max<double>(min_height_property_->getFloat(), min_z);
+
+  octomap::point3d center = octree_->keyToCoord(chunk.key, chunk.depth);
+  double halfSize = 0.5 * octree_->getNodeSize(chunk.depth);
+  points.bounds.setExtents(center.x() - halfSize, center.y() - halfSize, center.z() - halfSize,
+                           center.x() + halfSize, center.y() + halfSize, center.z() + halfSize);
+
+  points.levels.resize(chunk.levels.size());
+  for (std::size_t level = 0; level < chunk.levels.size(); ++level)
+  {
+    const std::vector<VisibleVoxel>& voxels = chunk.levels[level];
+    VVPoint& levelPoints = points.levels[level];
+    levelPoints.resize(max_octree_depth_);
+
+    for (std::size_t i = 0; i < voxels.size(); ++i)
+    {
+      const VisibleVoxel& voxel = voxels[i];
+      if (voxel.center.z() > maxHeight || voxel.center.z() < minHeight)
+        continue;
+
+      // the node of the voxel in the current map, below the chunk node:
+      typename OcTreeType::NodeType* node = chunk.node;
+      for (unsigned int depth = chunk.depth; node && depth < voxel.depth; ++depth)
+      {
+        unsigned int pos = octomap::computeChildIdx(voxel.key, maxDepth - 1 - depth);
+        node = octree_->nodeChildExists(node, pos) ? octree_->getNodeChild(node, pos) : NULL;
+      }
+      if (!node)
+        continue;
+
+      PointCloud::Point newPoint;
+
+      newPoint.position.x = voxel.center.x();
+      newPoint.position.y = voxel.center.y();
+      newPoint.position.z = voxel.center.z();
+
+      setVoxelColor(newPoint, *node, min_z, max_z);
+      // push to point vectors (the root, at a max. depth of 0, goes with depth 1)
+      levelPoints[std::max(voxel.depth, 1u) - 1].push_back(newPoint);
+    }
+  }
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::updateChunks(bool refill)
+{
+  const unsigned int maxDepth = octree_->getTreeDepth();
+  unsigned int treeDepth = std::min<unsigned int>(tree_depth_property_->getInt(), maxDepth);
+  int renderMode = octree_render_property_->getOptionInt();
+  // chunks of 2^chunk_levels nodes of the rendered depth per axis
+  const unsigned int chunk_levels = 6;
+  unsigned int chunkDepth = (treeDepth > chunk_levels) ? treeDepth - chunk_levels : 0;
+
+  unsigned int numLevels = std::max(1, lod_levels_property_->getInt());
+
+  bool all = (treeDepth != culled_depth_ || renderMode != culled_render_mode_ || numLevels != culled_levels_);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    all = all || clouds_cleared_;
+    clouds_cleared_ = false;
+  }
+
+  // chunks of the new map, and the hash of their subtrees:
+  ChunkMap chunks;
+  if (octree_->getRoot())
+  {
+    octomap::OcTreeKey rootKey(1 << (maxDepth - 1), 1 << (maxDepth - 1), 1 << (maxDepth - 1));
+    collectChunks(octree_->getRoot(), rootKey, 0, chunkDepth, chunks);
+  }
+
+  std::vector<Chunk*> chunkList;
+  for (typename ChunkMap::iterator it = chunks.begin(); it != chunks.end(); ++it)
+    chunkList.push_back(&it->second);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < int(chunkList.size()); ++i)
+    chunkList[i]->hash = hashSubtree(*octree_, chunkList[i]->node);
+
+  // changed and removed chunks, together with their neighbors whose occlusion may have changed:
+  std::set<uint64_t> dirty;
+  std::vector<uint64_t> removed;
+  for (typename ChunkMap::const_iterator it = chunks_.begin(); it != chunks_.end(); ++it)
+  {
+    if (chunks.find(it->first) == chunks.end())
+    {
+      removed.push_back(it->first);
+      if (!all)
+        markNeighbors(it->second.key, it->second.depth, chunkDepth, chunks, dirty, all);
+    }
+  }
+
+  for (typename ChunkMap::iterator it = chunks.begin(); it != chunks.end() && !all; ++it)
+  {
+    typename ChunkMap::iterator old = chunks_.find(it->first);
+    if (old == chunks_.end() || old->second.hash != it->second.hash)
+    {
+      dirty.insert(it->first);
+      markNeighbors(it->second.key, it->second.depth, chunkDepth, chunks, dirty, all);
+    }
+    else
+      it->second.levels.swap(old->second.levels);
+  }
+
+  if (all)
+  {
+    for (typename ChunkMap::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+      dirty.insert(it->first);
+  }
+
+  std::vector<Chunk*> cullList;
+  for (std::set<uint64_t>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+    cullList.push_back(&chunks[*it]);
+
+  // the chunks are independent, the map is only read:
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < int(cullList.size()); ++i)
+    cullChunk(*cullList[i], treeDepth, renderMode, numLevels);
+
+  // get dimensions of octree, the coloring of all chunks depends on them
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  octree_->getMetricMin(minX, minY, minZ);
+  octree_->getMetricMax(maxX, maxY, maxZ);
+  refill = refill || minZ != points_min_z_ || maxZ != points_max_z_;
+
+  std::map<uint64_t, ChunkPoints> points;
+  for (typename ChunkMap::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+  {
+    if (refill || dirty.find(it->first) != dirty.end())
+      fillChunk(it->second, minZ, maxZ, points[it->first]);
+  }
+  for (std::size_t i = 0; i < removed.size(); ++i)
+    points[removed[i]].levels.clear();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (std::size_t i = 0; i < max_octree_depth_; ++i)
+      box_size_[i] = octree_->getNodeSize(i + 1);
+
+    // replaces the points of chunks that were not drawn yet:
+    if (new_points_.empty())
+      new_points_.swap(points);
+    for (typename std::map<uint64_t, ChunkPoints>::iterator it = points.begin(); it != points.end(); ++it)
+    {
+      ChunkPoints& pending = new_points_[it->first];
+      pending.bounds = it->second.bounds;
+      pending.levels.swap(it->second.levels);
+    }
+  }
+
+  chunks_.swap(chunks);
+  culled_depth_ = treeDepth;
+  culled_render_mode_ = renderMode;
+  culled_levels_ = numLevels;
+  points_min_z_ = minZ;
+  points_max_z_ = maxZ;
+}
+
+template <typename OcTreeType>
+bool TemplatedOccupancyGridDisplay<OcTreeType>::redraw()
+{
+  boost::mutex::scoped_lock lock(map_mutex_);
+  if (!octree_)
+    return false;
+
+  // re-culls all chunks if tree depth, render mode or LOD levels changed
+  updateChunks(true);
+  context_->queueRender();
+  return true;
+}
+
+template <typename OcTreeType>
+void TemplatedOccupancyGridDisplay<OcTreeType>::clearMap()
+{
+  boost::mutex::scoped_lock lock(map_mutex_);
+  delete octree_;
+  octree_ = NULL;
+  chunks_.clear();
+}
+
 template <typename OcTreeType>
 void TemplatedOccupancyGridDisplay<OcTreeType>::incomingMessageCallback(const octomap_msgs::OctomapConstPtr& msg)
 {
@@ -496,6 +1119,8 @@ void TemplatedOccupancyGridDisplay<OcTreeType>::incomingMessageCallback(const oc
     octomap = dynamic_cast<OcTreeType*>(tree);
     if(!octomap){
       setStatusStd(StatusProperty::Error, "Message", "Wrong octomap type. Use a different display type.");
+      delete tree;
+      return;
     }
   }
   else
@@ -507,111 +1132,12 @@ void TemplatedOccupancyGridDisplay<OcTreeType>::incomingMessageCallback(const oc
 
   tree_depth_property_->setMax(octomap->getTreeDepth());
 
-  // get dimensions of octree
-  double minX, minY, minZ, maxX, maxY, maxZ;
-  octomap->getMetricMin(minX, minY, minZ);
-  octomap->getMetricMax(maxX, maxY, maxZ);
+  // the map is kept for changes of the display properties and to find the changes in the next one:
+  boost::mutex::scoped_lock lock(map_mutex_);
+  delete octree_;
+  octree_ = octomap;
 
-  // reset rviz pointcloud classes
-  for (std::size_t i = 0; i < max_octree_depth_; ++i)
-  {
-    point_buf_[i].clear();
-    box_size_[i] = octomap->getNodeSize(i + 1);
-  }
-
-  size_t pointCount = 0;
-  {
-    // traverse all leafs in the tree:
-    unsigned int treeDepth = std::min<unsigned int>(tree_depth_property_->getInt(), octomap->getTreeDepth());
-    double maxHeight = std::min<double>(max_height_property_->getFloat(), maxZ);
-    double minHeight = std::max<double>(min_height_property_->getFloat(), minZ);
-    int stepSize = 1 << (octomap->getTreeDepth() - treeDepth); // for pruning of occluded voxels
-    for (typename OcTreeType::iterator it = octomap->begin(treeDepth), end = octomap->end(); it != end; ++it)
-    {
-        if(it.getZ() <= maxHeight && it.getZ() >= minHeight)
-        {
-          int render_mode_mask = octree_render_property_->getOptionInt();
-
-          bool display_voxel = false;
-
-          // the left part evaluates to 1 for free voxels and 2 for occupied voxels
-          if (((int)octomap->isNodeOccupied(*it) + 1) & render_mode_mask)
-          {
-            // check if current voxel has neighbors on all sides -> no need to be displayed
-            bool allNeighborsFound = true;
-
-            octomap::OcTreeKey key;
-            octomap::OcTreeKey nKey = it.getKey();
-
-            // determine indices of potentially neighboring voxels for depths < maximum tree depth
-            // +/-1 at maximum depth, +2^(depth_difference-1) and -2^(depth_difference-1)-1 on other depths
-            int diffBase = (it.getDepth() < octomap->getTreeDepth()) ? 1 << (octomap->getTreeDepth() - it.getDepth() - 1) : 1;
-            int diff[2] = {-((it.getDepth() == octomap->getTreeDepth()) ? diffBase : diffBase + 1), diffBase};
-
-            // cells with adjacent faces can occlude a voxel, iterate over the cases x,y,z (idxCase) and +/- (diff)
-            for (unsigned int idxCase = 0; idxCase < 3; ++idxCase)
-            {
-              int idx_0 = idxCase % 3;
-              int idx_1 = (idxCase + 1) % 3;
-              int idx_2 = (idxCase + 2) % 3;
-
-              for (int i = 0; allNeighborsFound && i < 2; ++i)
-              {
-                key[idx_0] = nKey[idx_0] + diff[i];
-                // if rendering is restricted to treeDepth < maximum tree depth inner nodes with distance stepSize can already occlude a voxel
-                for (key[idx_1] = nKey[idx_1] + diff[0] + 1; allNeighborsFound && key[idx_1] < nKey[idx_1] + diff[1]; key[idx_1] += stepSize)
-                {
-                  for (key[idx_2] = nKey[idx_2] + diff[0] + 1; allNeighborsFound && key[idx_2] < nKey[idx_2] + diff[1]; key[idx_2] += stepSize)
-                  {
-                    typename OcTreeType::NodeType* node = octomap->search(key, treeDepth);
-
-                    // the left part evaluates to 1 for free voxels and 2 for occupied voxels
-                    if (!(node && ((((int)octomap->isNodeOccupied(node)) + 1) & render_mode_mask)))
-                    {
-                      // we do not have a neighbor => break!
-                      allNeighborsFound = false;
-                    }
-                  }
-                }
-              }
-            }
-
-            display_voxel |= !allNeighborsFound;
-          }
-
-
-          if (display_voxel)
-          {
-            PointCloud::Point newPoint;
-
-            newPoint.position.x = it.getX();
-            newPoint.position.y = it.getY();
-            newPoint.position.z = it.getZ();
-
-
-
-            setVoxelColor(newPoint, *it, minZ, maxZ);
-            // push to point vectors
-            unsigned int depth = it.getDepth();
-            point_buf_[depth - 1].push_back(newPoint);
-
-            ++pointCount;
-          }
-        }
-    }
-  }
-
-  if (pointCount)
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-
-    new_points_received_ = true;
-
-    for (size_t i = 0; i < max_octree_depth_; ++i)
-      new_points_[i].swap(point_buf_[i]);
-
-  }
-  delete octomap;
+  updateChunks(false);
 }
 
 } // namespace octomap_rviz_plugin
@@ -41,6 +41,8 @@
 #include <octomap_msgs/Octomap.h>
 #include <octomap_msgs/conversions.h>
 
+#include <algorithm>
+
 using namespace rviz;
 
 namespace octomap_rviz_plugin
@@ -51,6 +53,7 @@ static const std::size_t max_octree_depth_ = sizeof(unsigned short) * 8;
 OccupancyMapDisplay::OccupancyMapDisplay()
   : rviz::MapDisplay()
   , octree_depth_ (max_octree_depth_)
+  , worker_ (boost::bind(&OccupancyMapDisplay::handleOctomapBinaryMessage, this, _1))
 {
 
   topic_property_->setName("Octomap Binary Topic");
@@ -106,7 +109,7 @@ void OccupancyMapDisplay::subscribe()
       sub_.reset(new message_filters::Subscriber<octomap_msgs::Octomap>());
 
       sub_->subscribe(threaded_nh_, topicStr, 5);
-      sub_->registerCallback(boost::bind(&OccupancyMapDisplay::handleOctomapBinaryMessage, this, _1));
+      sub_->registerCallback(boost::bind(&LatestMessageWorker::push, &worker_, _1));
 
     }
   }
@@ -118,8 +121,6 @@ void OccupancyMapDisplay::subscribe()
 
 void OccupancyMapDisplay::unsubscribe()
 {
-  clear();
-
   try
   {
     // reset filters
@@ -129,8 +130,125 @@ void OccupancyMapDisplay::unsubscribe()
   {
     setStatus(StatusProperty::Error, "Topic", (std::string("Error unsubscribing: ") + e.what()).c_str());
   }
+
+  // no more maps of the old subscription after clear():
+  worker_.cancel();
+  clear();
 }
 
+template <typename OcTreeType>
+TemplatedOccupancyMapDisplay<OcTreeType>::~TemplatedOccupancyMapDisplay()
+{
+  // no message in progress while the display is destroyed:
+  unsubscribe();
+}
+
+
+// grid of the map display and the key range of its cells
+struct GridProjection
+{
+  int8_t* data;
+  int width;
+  int height;
+  unsigned int depth;     // of the grid cells
+  unsigned int max_depth; // of the tree
+  int min_key[2];         // key of the first cell
+};
+
+// key of the i-th child of the node at key (of depth)
+static octomap::OcTreeKey childKey(const octomap::OcTreeKey& key, unsigned int depth, unsigned int max_depth, unsigned int i)
+{
+  octomap::OcTreeKey child;
+  octomap::computeChildKey(i, (1 << (max_depth - 1)) >> (depth + 1), key, child);
+  return child;
+}
+
+// fill the cells covered by the node at key (of depth) row by row: occupied nodes win over free ones
+static void projectNode(const GridProjection& grid, const octomap::OcTreeKey& key, unsigned int depth, bool occupied)
+{
+  const int size = 1 << (grid.max_depth - depth);
+  const unsigned int shift = grid.max_depth - grid.depth;
+  int lo[2], hi[2];
+  for (unsigned int i = 0; i < 2; ++i)
+  {
+    int minKey = int(key[i]) - (size >> 1);
+    lo[i] = std::max(0, minKey - grid.min_key[i]) >> shift;
+    hi[i] = std::max(0, minKey + size - 1 - grid.min_key[i]) >> shift;
+  }
+  hi[0] = std::min(hi[0], grid.width - 1);
+  hi[1] = std::min(hi[1], grid.height - 1);
+
+  for (int y = lo[1]; y <= hi[1]; ++y)
+  {
+    int8_t* row = grid.data + grid.width * y;
+    if (occupied)
+      std::fill(row + lo[0], row + hi[0] + 1, 100);
+    else
+    {
+      for (int x = lo[0]; x <= hi[0]; ++x)
+      {
+        if (row[x] == -1)
+          row[x] = 0;
+      }
+    }
+  }
+}
+
+// project the leafs below node (at key of depth), down to the depth of the grid
+template <typename OcTreeType>
+static void projectSubtree(const OcTreeType& octree, const typename OcTreeType::NodeType* node, const octomap::OcTreeKey& key,
+                           unsigned int depth, const GridProjection& grid)
+{
+  if (depth < grid.depth && octree.nodeHasChildren(node))
+  {
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (octree.nodeChildExists(node, i))
+        projectSubtree(octree, octree.getNodeChild(node, i), childKey(key, depth, grid.max_depth, i), depth + 1, grid);
+    }
+    return;
+  }
+
+  projectNode(grid, key, depth, octree.isNodeOccupied(node));
+}
+
+// a subtree of the map, projected by one thread
+template <typename NodeType>
+struct ProjectionRoot
+{
+  const NodeType* node;
+  octomap::OcTreeKey key;
+  unsigned int depth;
+};
+
+// sort the nodes at slab depth below node into slabs by their y index, and project larger leafs right away
+template <typename OcTreeType>
+static void collectSlabs(const OcTreeType& octree, const typename OcTreeType::NodeType* node, const octomap::OcTreeKey& key,
+                         unsigned int depth, unsigned int slab_depth, const GridProjection& grid,
+                         std::vector<std::vector<ProjectionRoot<typename OcTreeType::NodeType> > >& slabs)
+{
+  if (depth == slab_depth)
+  {
+    ProjectionRoot<typename OcTreeType::NodeType> root;
+    root.node = node;
+    root.key = key;
+    root.depth = depth;
+    slabs[key[1] >> (grid.max_depth - depth)].push_back(root);
+    return;
+  }
+
+  if (!octree.nodeHasChildren(node))
+  {
+    projectNode(grid, key, depth, octree.isNodeOccupied(node));
+    return;
+  }
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (octree.nodeChildExists(node, i))
+      collectSlabs(octree, octree.getNodeChild(node, i), childKey(key, depth, grid.max_depth, i), depth + 1, slab_depth, grid, slabs);
+  }
+}
 
 template <typename OcTreeType>
 void TemplatedOccupancyMapDisplay<OcTreeType>::handleOctomapBinaryMessage(const octomap_msgs::OctomapConstPtr& msg)
@@ -148,6 +266,7 @@ void TemplatedOccupancyMapDisplay<OcTreeType>::handleOctomapBinaryMessage(const
   if (!octomap)
   {
     this->setStatusStd(StatusProperty::Error, "Message", "Failed to create octree structure");
+    delete tree;
     return;
   }
 
@@ -158,62 +277,61 @@ void TemplatedOccupancyMapDisplay<OcTreeType>::handleOctomapBinaryMessage(const
   octomap::point3d minPt = octomap::point3d(minX, minY, minZ);
 
   unsigned int tree_depth = octomap->getTreeDepth();
+  unsigned int treeDepth = std::min<unsigned int>(octree_depth_, tree_depth);
 
   octomap::OcTreeKey paddedMinKey = octomap->coordToKey(minPt);
 
-  nav_msgs::OccupancyGrid::Ptr occupancy_map (new nav_msgs::OccupancyGrid());
+  // the grid of the last map is reused, unless rviz still holds it
+  if (!occupancy_map_ || !occupancy_map_.unique())
+    occupancy_map_.reset(new nav_msgs::OccupancyGrid());
 
   unsigned int width, height;
   double res;
 
-  unsigned int ds_shift = tree_depth-octree_depth_;
-
-  occupancy_map->header = msg->header;
-  occupancy_map->info.resolution = res = octomap->getNodeSize(octree_depth_);
-  occupancy_map->info.width = width = (maxX-minX) / res + 1;
-  occupancy_map->info.height = height = (maxY-minY) / res + 1;
-  occupancy_map->info.origin.position.x = minX  - (res / (float)(1<<ds_shift) ) + res;
-  occupancy_map->info.origin.position.y = minY  - (res / (float)(1<<ds_shift) );
-
-  occupancy_map->data.clear();
-  occupancy_map->data.resize(width*height, -1);
-
-    // traverse all leafs in the tree:
-  unsigned int treeDepth = std::min<unsigned int>(octree_depth_, octomap->getTreeDepth());
-  for (typename OcTreeType::iterator it = octomap->begin(treeDepth), end = octomap->end(); it != end; ++it)
+  unsigned int ds_shift = tree_depth-treeDepth;
+
+  occupancy_map_->header = msg->header;
+  occupancy_map_->info.resolution = res = octomap->getNodeSize(treeDepth);
+  occupancy_map_->info.width = width = (maxX-minX) / res + 1;
+  occupancy_map_->info.height = height = (maxY-minY) / res + 1;
+  occupancy_map_->info.origin.position.x = minX  - (res / (float)(1<<ds_shift) ) + res;
+  occupancy_map_->info.origin.position.y = minY  - (res / (float)(1<<ds_shift) );
+
+  occupancy_map_->data.assign(width*height, -1);
+
+  GridProjection grid;
+  grid.data = &occupancy_map_->data.front();
+  grid.width = width;
+  grid.height = height;
+  grid.depth = treeDepth;
+  grid.max_depth = tree_depth;
+  grid.min_key[0] = paddedMinKey[0];
+  grid.min_key[1] = paddedMinKey[1];
+
+  // the subtrees at slab depth are projected in parallel, sorted into slabs along y. A cell
+  // is at most as large as a slab, so it only overlaps neighboring slabs: the even and the
+  // odd slabs never write to the same cell.
+  const unsigned int slabDepth = std::min<unsigned int>(treeDepth, 6);
+  std::vector<std::vector<ProjectionRoot<typename OcTreeType::NodeType> > > slabs(1 << slabDepth);
+  if (octomap->getRoot())
   {
-    bool occupied = octomap->isNodeOccupied(*it);
-    int intSize = 1 << (octree_depth_ - it.getDepth());
-
-    octomap::OcTreeKey minKey=it.getIndexKey();
+    octomap::OcTreeKey rootKey(1 << (tree_depth - 1), 1 << (tree_depth - 1), 1 << (tree_depth - 1));
+    collectSlabs(*octomap, octomap->getRoot(), rootKey, 0, slabDepth, grid, slabs);
+  }
 
-    for (int dx = 0; dx < intSize; dx++)
+  for (int parity = 0; parity < 2; ++parity)
+  {
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = parity; i < int(slabs.size()); i += 2)
     {
-      for (int dy = 0; dy < intSize; dy++)
-      {
-        int posX = std::max<int>(0, minKey[0] + dx - paddedMinKey[0]);
-        posX>>=ds_shift;
-
-        int posY = std::max<int>(0, minKey[1] + dy - paddedMinKey[1]);
-        posY>>=ds_shift;
-
-        int idx = width * posY + posX;
-
-        if (occupied)
-          occupancy_map->data[idx] = 100;
-        else if (occupancy_map->data[idx] == -1)
-        {
-          occupancy_map->data[idx] = 0;
-        }
-
-      }
+      for (std::size_t j = 0; j < slabs[i].size(); ++j)
+        projectSubtree(*octomap, slabs[i][j].node, slabs[i][j].key, slabs[i][j].depth, grid);
     }
-
   }
 
   delete octomap;
 
-  this->incomingMap(occupancy_map);
+  this->incomingMap(occupancy_map_);
 }
 
 } // namespace rviz
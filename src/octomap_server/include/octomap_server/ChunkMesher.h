@@ -0,0 +1,221 @@
+/**
+* ChunkMesher: greedy-meshed occupied voxels in spatial chunks for the
+* octomap_server
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_CHUNKMESHER_H
+#define OCTOMAP_SERVER_CHUNKMESHER_H
+
+#include <ros/time.h>
+#include <std_msgs/ColorRGBA.h>
+#include <visualization_msgs/MarkerArray.h>
+
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/SpeckleFilter.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Keeps a triangle mesh of the occupied voxels for each chunk of
+ * chunkSize^3 voxels. Faces between two occupied voxels are dropped and
+ * coplanar visible faces are merged greedily into rectangles, so that a
+ * flat wall of a chunk takes two triangles instead of twelve per voxel.
+ * Only the chunks marked as touched are meshed again in update(), and
+ * getChangedMarkers() returns one TRIANGLE_LIST marker per changed chunk
+ * (with a stable marker id) and a DELETE for chunks that became empty.
+ */
+class ChunkMesher {
+
+public:
+  /// @param chunkSize edge length of a chunk in voxels (rounded up to a power of two)
+  ChunkMesher(unsigned chunkSize);
+
+  /// mark voxels whose occupancy changed, together with the chunks their faces and speckle status affect
+  void markTouched(const octomap::KeySet& keys);
+  void markTouched(const std::vector<octomap::OcTreeKey>& keys);
+
+  /// mark all chunks overlapping the key box [min, max] (plus the same margin)
+  void markBox(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+
+  /// mark all meshed chunks and the chunks of all occupied leafs of tree, e.g. after loading it
+  template <class TreeT>
+  void markOccupied(const TreeT& tree);
+
+  /**
+   * Mesh the touched chunks. Voxels count as occupied if their center is in
+   * (minZ, maxZ) and they are not in speckles (if not NULL), as in publishAll().
+   * A change of these settings re-meshes all chunks.
+   */
+  template <class TreeT>
+  void update(const TreeT& tree, double minZ, double maxZ, const SpeckleFilter* speckles);
+
+  /// append the markers of the chunks changed (or deleted) since the last call to markers
+  void getChangedMarkers(visualization_msgs::MarkerArray& markers, const std::string& frameId, const ros::Time& stamp,
+                         const std_msgs::ColorRGBA& color);
+
+  /// append the markers of all chunks to markers, e.g. for a new subscriber
+  void getAllMarkers(visualization_msgs::MarkerArray& markers, const std::string& frameId, const ros::Time& stamp,
+                     const std_msgs::ColorRGBA& color) const;
+
+  /// removes all chunks (the next getChangedMarkers() deletes their markers)
+  void clear();
+
+  size_t numChunks() const { return m_chunks.size(); }
+
+protected:
+  struct Chunk {
+    int id;
+    std::vector<geometry_msgs::Point> triangles;
+  };
+
+  typedef unordered_ns::unordered_map<uint64_t, Chunk> ChunkMap;
+
+  /// voxels of a touched key that may change a chunk: faces of the neighbors and their speckle status
+  static const int s_margin = 2;
+
+  uint64_t chunkIndex(unsigned x, unsigned y, unsigned z) const{
+    return uint64_t(x >> m_chunkBits) | (uint64_t(y >> m_chunkBits) << 16) | (uint64_t(z >> m_chunkBits) << 32);
+  }
+
+  /// ADD marker of a chunk without points
+  visualization_msgs::Marker chunkMarker(const std::string& frameId, const ros::Time& stamp, const std_msgs::ColorRGBA& color) const;
+
+  /// mark the chunks overlapping the key box [min, max]
+  void markRange(const unsigned min[3], const unsigned max[3]);
+
+  /// mesh of the occupancy grid of a chunk (chunkSize+2 voxels per axis including the border)
+  void meshChunk(const std::vector<char>& solid, const double origin[3], double resolution,
+                 std::vector<geometry_msgs::Point>& triangles) const;
+
+  void addQuad(unsigned d, unsigned u, unsigned v, bool positive, int slice, int i, int j, int w, int h,
+               const double origin[3], double resolution, std::vector<geometry_msgs::Point>& triangles) const;
+
+  unsigned m_chunkBits;
+  unsigned m_chunkSize;
+  ChunkMap m_chunks;
+  std::set<uint64_t> m_dirty;   // to mesh in the next update()
+  std::set<uint64_t> m_changed; // meshed since the last getChangedMarkers()
+  std::vector<int> m_deleted;   // marker ids of removed chunks since the last getChangedMarkers()
+  int m_nextId;
+
+  // voxel filter of the current meshes:
+  double m_minZ;
+  double m_maxZ;
+  bool m_filterSpeckles;
+};
+
+template <class TreeT>
+void ChunkMesher::markOccupied(const TreeT& tree){
+  for (ChunkMap::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    m_dirty.insert(it->first);
+
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (typename TreeT::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it){
+    if (!tree.isNodeOccupied(*it))
+      continue;
+
+    octomap::OcTreeKey indexKey = it.getIndexKey();
+    unsigned width = 1 << (treeDepth - it.getDepth());
+    unsigned min[3], max[3];
+    for (unsigned i = 0; i < 3; ++i){
+      min[i] = indexKey[i];
+      max[i] = indexKey[i] + width - 1;
+    }
+    markRange(min, max);
+  }
+}
+
+template <class TreeT>
+void ChunkMesher::update(const TreeT& tree, double minZ, double maxZ, const SpeckleFilter* speckles){
+  if (minZ != m_minZ || maxZ != m_maxZ || (speckles != NULL) != m_filterSpeckles){
+    m_minZ = minZ;
+    m_maxZ = maxZ;
+    m_filterSpeckles = (speckles != NULL);
+    markOccupied(tree);
+  }
+
+  const unsigned treeDepth = tree.getTreeDepth();
+  const double resolution = tree.getResolution();
+  const int gridSize = m_chunkSize + 2;
+  const unsigned maxKey = std::numeric_limits<octomap::key_type>::max();
+  std::vector<char> solid(gridSize * gridSize * gridSize);
+
+  for (std::set<uint64_t>::const_iterator it = m_dirty.begin(); it != m_dirty.end(); ++it){
+    // chunk with a border of one voxel, for the faces towards the neighboring chunks:
+    unsigned base[3];
+    octomap::OcTreeKey gridMin, gridMax;
+    for (unsigned i = 0; i < 3; ++i){
+      base[i] = unsigned((*it >> (16 * i)) & 0xFFFF) << m_chunkBits;
+      gridMin[i] = base[i] > 0 ? base[i] - 1 : 0;
+      gridMax[i] = std::min(base[i] + m_chunkSize, maxKey);
+    }
+
+    std::fill(solid.begin(), solid.end(), 0);
+    for (typename TreeT::leaf_bbx_iterator lit = tree.begin_leafs_bbx(gridMin, gridMax), end = tree.end_leafs_bbx(); lit != end; ++lit){
+      if (!tree.isNodeOccupied(*lit))
+        continue;
+
+      // the part of the leaf inside the grid:
+      octomap::OcTreeKey indexKey = lit.getIndexKey();
+      unsigned width = 1 << (treeDepth - lit.getDepth());
+      int lo[3], hi[3];
+      for (unsigned i = 0; i < 3; ++i){
+        lo[i] = std::max(int(indexKey[i]), int(gridMin[i])) - int(base[i]) + 1;
+        hi[i] = std::min(int(indexKey[i] + width - 1), int(gridMax[i])) - int(base[i]) + 1;
+      }
+
+      bool speckle = speckles && width == 1 && speckles->isSpeckle(indexKey);
+      if (speckle)
+        continue;
+
+      for (int z = lo[2]; z <= hi[2]; ++z){
+        double zCoord = tree.keyToCoord(octomap::key_type(base[2] + z - 1));
+        if (zCoord <= minZ || zCoord >= maxZ)
+          continue;
+
+        for (int y = lo[1]; y <= hi[1]; ++y){
+          for (int x = lo[0]; x <= hi[0]; ++x)
+            solid[x + gridSize * (y + gridSize * z)] = 1;
+        }
+      }
+    }
+
+    double origin[3];
+    for (unsigned i = 0; i < 3; ++i)
+      origin[i] = tree.keyToCoord(octomap::key_type(base[i])) - 0.5 * resolution;
+
+    std::vector<geometry_msgs::Point> triangles;
+    meshChunk(solid, origin, resolution, triangles);
+
+    ChunkMap::iterator chunk = m_chunks.find(*it);
+    if (triangles.empty()){
+      if (chunk != m_chunks.end()){
+        m_deleted.push_back(chunk->second.id);
+        m_chunks.erase(chunk);
+        m_changed.erase(*it);
+      }
+      continue;
+    }
+
+    if (chunk == m_chunks.end()){
+      chunk = m_chunks.insert(std::make_pair(*it, Chunk())).first;
+      chunk->second.id = m_nextId++;
+    }
+    chunk->second.triangles.swap(triangles);
+    m_changed.insert(*it);
+  }
+
+  m_dirty.clear();
+}
+
+}
+
+#endif
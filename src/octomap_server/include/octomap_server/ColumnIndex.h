@@ -0,0 +1,128 @@
+/**
+* ColumnIndex: incremental 2.5D summary of the (x,y) columns of an octree
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_COLUMNINDEX_H
+#define OCTOMAP_SERVER_COLUMNINDEX_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Summary of each (x,y) voxel column of the octree at max. depth: extent of
+ * the occupied and known voxels plus their runs of consecutive z keys.
+ * Columns are recomputed from the octree only when marked dirty, so 2D
+ * projections can be produced from the changed columns alone.
+ */
+class ColumnIndex {
+
+public:
+  typedef std::pair<octomap::key_type, octomap::key_type> Run; ///< z keys [first, second]
+
+  struct Column {
+    octomap::key_type minOccupied; ///< z key range of occupied voxels (min > max: none)
+    octomap::key_type maxOccupied;
+    octomap::key_type minKnown;    ///< z key range of known voxels (min > max: none)
+    octomap::key_type maxKnown;
+    std::vector<Run> occupiedRuns; ///< sorted, disjoint and not adjacent
+    std::vector<Run> knownRuns;
+
+    Column();
+    bool hasOccupied() const { return minOccupied <= maxOccupied; }
+    bool isKnown() const { return minKnown <= maxKnown; }
+  };
+
+  typedef unordered_ns::unordered_map<uint32_t, Column> ColumnMap;
+  typedef unordered_ns::unordered_set<uint32_t> ColumnSet;
+
+  static inline uint32_t columnKey(octomap::key_type x, octomap::key_type y) {
+    return (uint32_t(x) << 16) | y;
+  }
+  static inline octomap::key_type columnX(uint32_t column) { return column >> 16; }
+  static inline octomap::key_type columnY(uint32_t column) { return column & 0xffff; }
+
+  /// mark the columns of all keys as dirty
+  void markDirty(const octomap::KeySet& keys);
+
+  /// mark all columns in the x/y range (inclusive) as dirty
+  void markDirty(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+
+  /// recompute all dirty columns from tree
+  template <class TreeT>
+  void update(const TreeT& tree);
+
+  void clear();
+
+  /// occupancy grid value (100 / 0 / -1) of a column restricted to the z keys [lo, hi] (lo > hi: none)
+  static int8_t classify(const Column& column, octomap::key_type lo, octomap::key_type hi);
+
+  const ColumnMap& getColumns() const { return m_columns; }
+
+  /// columns recomputed since the last clearChanged()
+  const std::vector<uint32_t>& getChanged() const { return m_changed; }
+  void clearChanged() { m_changed.clear(); }
+
+protected:
+  /// true if one of runs overlaps the z keys [lo, hi]
+  static bool overlaps(const std::vector<Run>& runs, octomap::key_type lo, octomap::key_type hi);
+
+  /// sorts runs and merges the overlapping and adjacent ones
+  static void mergeRuns(std::vector<Run>& runs);
+
+  ColumnMap m_columns;
+  ColumnSet m_dirty;
+  std::vector<uint32_t> m_changed;
+};
+
+template <class TreeT>
+void ColumnIndex::update(const TreeT& tree){
+  for (ColumnSet::const_iterator dirty = m_dirty.begin(); dirty != m_dirty.end(); ++dirty){
+    octomap::key_type x = columnX(*dirty);
+    octomap::key_type y = columnY(*dirty);
+
+    Column column;
+    octomap::OcTreeKey minKey(x, y, 0);
+    octomap::OcTreeKey maxKey(x, y, std::numeric_limits<octomap::key_type>::max());
+    for (typename TreeT::leaf_bbx_iterator it = tree.begin_leafs_bbx(minKey, maxKey),
+         end = tree.end_leafs_bbx(); it != end; ++it)
+    {
+      // z key range covered by the leaf:
+      octomap::key_type lo = it.getIndexKey()[2];
+      octomap::key_type hi = lo + (1 << (tree.getTreeDepth() - it.getDepth())) - 1;
+
+      column.knownRuns.push_back(Run(lo, hi));
+      if (tree.isNodeOccupied(*it))
+        column.occupiedRuns.push_back(Run(lo, hi));
+    }
+
+    if (column.knownRuns.empty()){
+      m_columns.erase(*dirty);
+    } else{
+      mergeRuns(column.knownRuns);
+      column.minKnown = column.knownRuns.front().first;
+      column.maxKnown = column.knownRuns.back().second;
+      if (!column.occupiedRuns.empty()){
+        mergeRuns(column.occupiedRuns);
+        column.minOccupied = column.occupiedRuns.front().first;
+        column.maxOccupied = column.occupiedRuns.back().second;
+      }
+      m_columns[*dirty] = column;
+    }
+
+    m_changed.push_back(*dirty);
+  }
+
+  m_dirty.clear();
+}
+
+}
+
+#endif
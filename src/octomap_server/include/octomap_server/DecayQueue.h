@@ -0,0 +1,55 @@
+/**
+* DecayQueue: time-bucketed expiry of occupied voxels for the octomap_server
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_DECAYQUEUE_H
+#define OCTOMAP_SERVER_DECAYQUEUE_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <map>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Keeps an expiry time for each scheduled voxel (the last observation time
+ * plus the decay time, as the node stamp in OcTreeStamped would give) and
+ * the voxels in buckets of their expiry time. Scheduling a voxel again only
+ * moves it to a later bucket, the entry in the earlier bucket is skipped
+ * when that bucket expires. popExpired() therefore only visits the buckets
+ * that are due, instead of all nodes as OcTreeStamped::degradeOutdatedNodes().
+ */
+class DecayQueue {
+
+public:
+  /// @param bucketWidth time resolution of the expiry (s)
+  DecayQueue(double bucketWidth);
+
+  /// (re-)schedule keys to expire at time expiry (s)
+  void schedule(const octomap::KeySet& keys, double expiry);
+  void schedule(const octomap::OcTreeKey& key, double expiry);
+
+  /// remove all keys with an expiry time in a bucket before time (s) and append them to expired
+  void popExpired(double time, std::vector<octomap::OcTreeKey>& expired);
+
+  void clear();
+
+  /// number of scheduled keys
+  size_t size() const { return m_expiry.size(); }
+
+protected:
+  typedef unordered_ns::unordered_map<octomap::OcTreeKey, long, octomap::OcTreeKey::KeyHash> ExpiryMap;
+  typedef std::map<long, std::vector<octomap::OcTreeKey> > BucketMap;
+
+  long bucket(double time) const;
+
+  double m_bucketWidth;
+  ExpiryMap m_expiry; // key -> current bucket
+  BucketMap m_buckets;
+};
+
+}
+
+#endif
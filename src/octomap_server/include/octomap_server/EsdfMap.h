@@ -0,0 +1,101 @@
+/**
+* EsdfMap: incrementally updated Euclidean distance field for the
+* octomap_server (dynamic brushfire, see B. Lau, C. Sprunk and W. Burgard,
+* "Improved Updating of Euclidean Distance Maps and Voronoi Diagrams", IROS 2010).
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_ESDFMAP_H
+#define OCTOMAP_SERVER_ESDFMAP_H
+
+#include <octomap/OcTreeKey.h>
+#include <octomap/octomap_types.h>
+
+#include <cmath>
+#include <queue>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Sparse distance field on the voxel grid of the octree (max. depth).
+ * Only cells closer than the maximum distance to an obstacle are stored, and
+ * an update only visits cells whose distance is affected by the obstacles
+ * that were added or removed since the last update.
+ */
+class EsdfMap {
+
+public:
+  struct Cell {
+    octomap::OcTreeKey obstacle; ///< closest obstacle
+    float distance; ///< distance to the closest obstacle in voxels
+    bool raise;     ///< in the raise wavefront (obstacle was removed)
+
+    Cell() : distance(0.0f), raise(false) {}
+  };
+
+  typedef unordered_ns::unordered_map<octomap::OcTreeKey, Cell, octomap::OcTreeKey::KeyHash> CellMap;
+
+  /// @param resolution voxel size (m) @param maxDistance max. distance (m) to propagate
+  EsdfMap(double resolution, double maxDistance);
+
+  /// mark key as obstacle, takes effect with the next update()
+  void setObstacle(const octomap::OcTreeKey& key);
+
+  /// remove key from the obstacles, takes effect with the next update()
+  void removeObstacle(const octomap::OcTreeKey& key);
+
+  inline bool isObstacle(const octomap::OcTreeKey& key) const {
+    return m_obstacles.find(key) != m_obstacles.end();
+  }
+
+  /// propagate all pending obstacle changes
+  void update();
+
+  /// remove all obstacles and distances
+  void clear();
+
+  /// distance (m) to the closest obstacle, clamped at getMaxDistance()
+  float getDistance(const octomap::OcTreeKey& key) const;
+
+  /// distance (m) and its gradient (central differences) at key
+  float getDistanceAndGradient(const octomap::OcTreeKey& key, octomap::point3d& gradient) const;
+
+  double getMaxDistance() const { return m_maxDistance; }
+  const CellMap& getCells() const { return m_cells; }
+  const octomap::KeySet& getObstacles() const { return m_obstacles; }
+
+protected:
+  struct QueueEntry {
+    float distance;
+    octomap::OcTreeKey key;
+
+    QueueEntry(float d, const octomap::OcTreeKey& k) : distance(d), key(k) {}
+    bool operator>(const QueueEntry& other) const { return distance > other.distance; }
+  };
+
+  typedef std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > Queue;
+
+  void raise(const octomap::OcTreeKey& key);
+  void lower(const octomap::OcTreeKey& key, const Cell& cell);
+
+  static inline float keyDistance(const octomap::OcTreeKey& a, const octomap::OcTreeKey& b) {
+    float dx = float(a[0]) - float(b[0]);
+    float dy = float(a[1]) - float(b[1]);
+    float dz = float(a[2]) - float(b[2]);
+    return sqrtf(dx*dx + dy*dy + dz*dz);
+  }
+
+  double m_resolution;
+  double m_maxDistance;
+  float m_maxDistanceVoxels;
+
+  CellMap m_cells;
+  octomap::KeySet m_obstacles;
+  Queue m_open;
+  std::vector<octomap::OcTreeKey> m_cleared; // candidates for removal after an update
+};
+
+}
+
+#endif
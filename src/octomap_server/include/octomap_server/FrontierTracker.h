@@ -0,0 +1,128 @@
+/**
+* FrontierTracker: incremental frontier extraction and clustering for the
+* octomap_server
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_FRONTIERTRACKER_H
+#define OCTOMAP_SERVER_FRONTIERTRACKER_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <map>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Keeps the set of frontier voxels (known free, with at least one unknown
+ * 6-neighbor) and their 26-connected clusters. Only voxels marked as touched
+ * and their neighbors are re-evaluated in update(), and clusters are only
+ * flooded from the voxels around the changes. Cluster ids are stable: a
+ * cluster that splits or merges keeps its id for the largest part.
+ */
+class FrontierTracker {
+
+public:
+  typedef unordered_ns::unordered_map<octomap::OcTreeKey, unsigned, octomap::OcTreeKey::KeyHash> KeyClusterMap;
+  typedef std::map<unsigned, octomap::KeySet> ClusterMap;
+
+  FrontierTracker();
+
+  /// mark voxels (and implicitly their neighbors) for re-evaluation in the next update()
+  void markTouched(const octomap::KeySet& keys);
+
+  /// mark the boundary voxels of a leaf node (width in voxels) for re-evaluation
+  void markLeafBoundary(const octomap::OcTreeKey& indexKey, unsigned width);
+
+  /// mark the voxels just outside the key box [min, max] (sharing a face with it) for re-evaluation
+  void markBoxShell(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+
+  /// re-evaluate the touched voxels against tree and update the clusters
+  template <class TreeT>
+  void update(const TreeT& tree);
+
+  void clear();
+
+  const ClusterMap& getClusters() const { return m_clusters; }
+  size_t size() const { return m_frontiers.size(); }
+
+  /// true if the frontiers changed since the last call to resetChanged()
+  bool changed() const { return m_changed; }
+  void resetChanged() { m_changed = false; }
+
+protected:
+  template <class TreeT>
+  bool isFrontier(const TreeT& tree, const octomap::OcTreeKey& key) const;
+
+  /// re-cluster the affected clusters after frontier voxels were added / removed
+  void updateClusters(const std::vector<octomap::OcTreeKey>& added, const std::vector<octomap::OcTreeKey>& removed);
+
+  /// splits cluster id into its connected parts after it lost the voxels next to seeds (its remaining voxels)
+  void splitCluster(unsigned id, const octomap::KeySet& seeds);
+
+  /// assigns voxels (taken out of cluster from) to cluster into, drops from if it is empty then
+  void moveVoxels(const octomap::KeySet& voxels, unsigned from, unsigned into);
+
+  static const int s_faceNeighbors[6][3];
+
+  octomap::KeySet m_touched;
+  KeyClusterMap m_frontiers; // frontier voxel -> cluster id
+  ClusterMap m_clusters;
+  unsigned m_nextClusterId;
+  bool m_changed;
+};
+
+template <class TreeT>
+bool FrontierTracker::isFrontier(const TreeT& tree, const octomap::OcTreeKey& key) const{
+  typename TreeT::NodeType* node = tree.search(key);
+  if (!node || tree.isNodeOccupied(node))
+    return false;
+
+  octomap::OcTreeKey nKey;
+  for (unsigned i = 0; i < 6; ++i){
+    nKey[0] = key[0] + s_faceNeighbors[i][0];
+    nKey[1] = key[1] + s_faceNeighbors[i][1];
+    nKey[2] = key[2] + s_faceNeighbors[i][2];
+    if (!tree.search(nKey))
+      return true;
+  }
+
+  return false;
+}
+
+template <class TreeT>
+void FrontierTracker::update(const TreeT& tree){
+  if (m_touched.empty())
+    return;
+
+  // a voxel's status depends on itself and its face neighbors:
+  octomap::KeySet candidates(m_touched);
+  for (octomap::KeySet::const_iterator it = m_touched.begin(); it != m_touched.end(); ++it){
+    octomap::OcTreeKey nKey;
+    for (unsigned i = 0; i < 6; ++i){
+      nKey[0] = (*it)[0] + s_faceNeighbors[i][0];
+      nKey[1] = (*it)[1] + s_faceNeighbors[i][1];
+      nKey[2] = (*it)[2] + s_faceNeighbors[i][2];
+      candidates.insert(nKey);
+    }
+  }
+  m_touched.clear();
+
+  std::vector<octomap::OcTreeKey> added, removed;
+  for (octomap::KeySet::const_iterator it = candidates.begin(); it != candidates.end(); ++it){
+    bool wasFrontier = (m_frontiers.find(*it) != m_frontiers.end());
+    bool frontier = isFrontier(tree, *it);
+    if (frontier && !wasFrontier)
+      added.push_back(*it);
+    else if (!frontier && wasFrontier)
+      removed.push_back(*it);
+  }
+
+  if (!added.empty() || !removed.empty())
+    updateClusters(added, removed);
+}
+
+}
+
+#endif
@@ -0,0 +1,131 @@
+/**
+* MapTiles: multi-resolution tiles of a static octree for the
+* octomap_server_static
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_MAPTILES_H
+#define OCTOMAP_SERVER_MAPTILES_H
+
+#include <octomap/octomap.h>
+#include <octomap/OcTreeKey.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_msgs/conversions.h>
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Precomputed binary octomap messages of a static map, cut into cubic tiles
+ * for a number of levels of detail. At level l, a tile is 2^l times as large
+ * as at level 0 and its leafs are at most at depth treeDepth - l (merged to
+ * the max. occupancy of their children, as in the inner nodes of the tree),
+ * so every tile holds at most as many voxels as a full resolution tile. A
+ * viewer loads the coarse tiles for an overview and the level 0 tiles of the
+ * region it shows, instead of the whole map.
+ *
+ * Tiles are indexed by signed integer coordinates: tile (x, y, z) at level l
+ * covers [x, x+1) * getTileSize(l) in x (relative to the map origin), etc.
+ * Only tiles with known space are stored.
+ */
+class MapTiles {
+
+public:
+  /**
+   * @param resolution of the map
+   * @param tileKeys edge length of a tile at level 0 in voxels (rounded up to a power of two)
+   * @param numLevels number of levels of detail (limited so that the coarsest tile fits into the map)
+   */
+  MapTiles(double resolution, unsigned tileKeys, unsigned numLevels);
+
+  /// replaces the tiles with those of tree (of the resolution given in the constructor)
+  template <class TreeT>
+  void build(const TreeT& tree);
+
+  /// binary octomap message of tile (x, y, z) at level, false if it has no known space
+  bool getTile(int x, int y, int z, unsigned level, octomap_msgs::Octomap& msg) const;
+
+  /// indices of the tiles with known space at level
+  void getTileIndices(unsigned level, std::vector<int>& x, std::vector<int>& y, std::vector<int>& z) const;
+
+  /// edge length of a tile at level (m)
+  double getTileSize(unsigned level) const { return m_resolution * double(1 << (m_tileBits + level)); }
+
+  unsigned getNumLevels() const { return m_numLevels; }
+  double getResolution() const { return m_resolution; }
+
+  size_t numTiles() const;
+  /// bytes of all tile messages
+  size_t memoryUsage() const;
+
+  void clear();
+
+protected:
+  typedef unordered_ns::unordered_map<uint64_t, octomap_msgs::Octomap> TileMap;
+  typedef unordered_ns::unordered_map<uint64_t, octomap::OcTree*> TreeMap;
+
+  unsigned tileBits(unsigned level) const { return m_tileBits + level; }
+
+  /// tile of key packed into 3x16 bits
+  uint64_t tileId(const octomap::OcTreeKey& key, unsigned level) const{
+    const unsigned bits = tileBits(level);
+    return uint64_t(key[0] >> bits) | (uint64_t(key[1] >> bits) << 16) | (uint64_t(key[2] >> bits) << 32);
+  }
+
+  /// tree of the tile of key, created on first use
+  octomap::OcTree* tileTree(TreeMap& trees, const octomap::OcTreeKey& key, unsigned level) const;
+
+  /// sets the node covering key at depth to a leaf with logOdds
+  static void setNode(octomap::OcTree& tree, const octomap::OcTreeKey& key, unsigned depth, float logOdds);
+
+  /// serializes the tile trees of level into m_tiles and deletes them
+  void storeTiles(TreeMap& trees, unsigned level);
+
+  unsigned m_tileBits;
+  unsigned m_numLevels;
+  double m_resolution;
+  std::vector<TileMap> m_tiles; // per level
+};
+
+template <class TreeT>
+void MapTiles::build(const TreeT& tree){
+  clear();
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (unsigned level = 0; level < m_numLevels; ++level){
+    // at level l, the leaf iterator stops l levels above the voxels:
+    const unsigned bits = tileBits(level);
+    TreeMap trees;
+    for (typename TreeT::leaf_iterator it = tree.begin_leafs(treeDepth - level), end = tree.end_leafs(); it != end; ++it){
+      octomap::OcTreeKey indexKey = it.getIndexKey();
+      const unsigned nodeBits = treeDepth - it.getDepth();
+      const float logOdds = it->getLogOdds();
+      if (nodeBits <= bits){
+        setNode(*tileTree(trees, indexKey, level), indexKey, it.getDepth(), logOdds);
+        continue;
+      }
+
+      // pruned leaf larger than a tile: fills all tiles it covers
+      const unsigned n = 1 << (nodeBits - bits);
+      octomap::OcTreeKey key;
+      for (unsigned dz = 0; dz < n; ++dz){
+        key[2] = indexKey[2] + (dz << bits);
+        for (unsigned dy = 0; dy < n; ++dy){
+          key[1] = indexKey[1] + (dy << bits);
+          for (unsigned dx = 0; dx < n; ++dx){
+            key[0] = indexKey[0] + (dx << bits);
+            setNode(*tileTree(trees, key, level), key, treeDepth - bits, logOdds);
+          }
+        }
+      }
+    }
+
+    storeTiles(trees, level);
+  }
+}
+
+}
+
+#endif
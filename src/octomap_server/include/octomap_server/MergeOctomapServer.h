@@ -0,0 +1,98 @@
+/**
+* MergeOctomapServer: octomap_server fusing the maps of several robots
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_MERGEOCTOMAPSERVER_H
+#define OCTOMAP_SERVER_MERGEOCTOMAPSERVER_H
+
+#include <octomap_server/OctomapServer.h>
+#include <octomap_server/TreeComposition.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Subscribes to merge/topic (octomap_binary or octomap_full) of each source
+ * namespace in merge/sources and keeps m_octree as the log-odds sum of all
+ * source maps, transformed into the map frame with the TF transform from
+ * each map's frame. Sources are decoded and transformed in parallel on their
+ * own callback queue; a new map of a source only changes the voxels whose
+ * contribution differs from its previous map. The changed voxels are
+ * published on merged_changes (same format as the TrackingOctomapServer).
+ *
+ * Pruned leafs of a source map contribute as whole nodes where the transform
+ * maps the source voxel grid onto the map grid (axes swapped or flipped, a
+ * whole number of voxels apart, e.g. a common frame). Otherwise they are
+ * sampled in cubes of merge/sample_size voxels, each contributing to the map
+ * node of its size around its transformed center. The samples of a source
+ * within one map node are averaged, only different sources are summed.
+ *
+ * The layers fed by scan insertion (distance field, frontiers, columns,
+ * traversability, decay, voxel blocks) are disabled.
+ */
+class MergeOctomapServer : public OctomapServer {
+
+public:
+  MergeOctomapServer(ros::NodeHandle private_nh_ = ros::NodeHandle("~"));
+  virtual ~MergeOctomapServer();
+
+  void mapCallback(const octomap_msgs::Octomap::ConstPtr& msg, unsigned source);
+  virtual bool openFile(const std::string& filename);
+  bool resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+
+protected:
+  typedef TreeComposition<OcTreeT> Composition;
+  typedef unordered_ns::unordered_map<uint64_t, float> NodeLogOddsMap; // Composition::nodeId() -> log-odds
+
+  /// change of a source's contribution at a map node
+  struct Delta {
+    uint64_t node;
+    float logOdds;
+    int countChange;
+  };
+
+  struct Source {
+    std::string name;
+    ros::Subscriber sub;
+    NodeLogOddsMap contributions; // map node -> summed log-odds of this source (callback thread only)
+    unsigned numMerges;
+    double totalTime;            // sum of all merge times (s)
+  };
+
+  /// summed log-odds of all leafs of tree at their map nodes for the source-to-map transform
+  void transformLeafs(const octomap::OcTree& tree, const tf::Transform& sourceToMap, NodeLogOddsMap& contributions) const;
+
+  /**
+   * True if sourceToMap maps the voxel grid of tree onto the map grid:
+   * map key[a] = sign[a] * source key[axis[a]] + offset[a].
+   */
+  bool isGridAligned(const octomap::OcTree& tree, const tf::Transform& sourceToMap, int axis[3], int sign[3], int offset[3]) const;
+
+  /// publishes the merged map if it changed since the last call
+  void publishMerged(const ros::TimerEvent& event);
+
+  virtual void publishAll(const ros::Time& rostime = ros::Time::now());
+
+  /// publishes the changed voxels, the changed nodes voxel by voxel
+  void publishChanges(const std::vector<octomap::OcTreeKey>& changed, const std::vector<Composition::Node>& changedNodes,
+                      const ros::Time& rostime) const;
+
+  std::vector<Source*> m_sources;
+  Composition m_composition; // guarded by m_octreeMutex
+  unsigned m_sampleDepthOffset; // log2 of the edge length (voxels) of the cubes pruned leafs are sampled in
+  boost::mutex m_mergedMutex;
+  bool m_merged; // map changed since the last publish (guarded by m_mergedMutex)
+
+  ros::CallbackQueue m_mergeQueue;
+  ros::AsyncSpinner* m_mergeSpinner;
+  ros::Publisher m_changesPub;
+  ros::Timer m_publishTimer;
+};
+
+}
+
+#endif
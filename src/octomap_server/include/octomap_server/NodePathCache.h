@@ -0,0 +1,211 @@
+/**
+* NodePathCache: octree lookups and updates resuming from the path of the
+* previous key
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_NODEPATHCACHE_H
+#define OCTOMAP_SERVER_NODEPATHCACHE_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <algorithm>
+#include <cstddef>
+
+namespace octomap_server {
+
+/**
+ * Keeps the nodes on the root-to-leaf path of the last key. A search or
+ * update for the next key starts at the deepest common ancestor of both keys,
+ * found from the highest differing key bit, instead of the root. Consecutive
+ * keys of a ray or of a voxel neighborhood share most of their path, so only
+ * the last few levels are walked.
+ *
+ * updateNode() gives the same tree as the non-lazy TreeT::updateNode(), but
+ * the inner nodes of the path are only updated (and pruned) when the path
+ * leaves them, once for all updates below. The tree must not be changed by
+ * other means while the cache is in use: call flush() after the last update
+ * (which also resets the path), reset() after any other change.
+ * Change detection of the tree is not supported. With setPruning(false), the
+ * inner nodes are updated but never pruned (as after TreeT::expand()).
+ */
+template <class TreeT>
+class NodePathCache {
+
+public:
+  typedef typename TreeT::NodeType NodeType;
+
+  NodePathCache(TreeT* tree = NULL) : m_tree(tree), m_prune(true) {
+    reset();
+    resetStatistics();
+  }
+
+  void setTree(TreeT* tree) {
+    m_tree = tree;
+    reset();
+  }
+
+  /// prune inner nodes whose children are equal leafs when leaving them (default)
+  void setPruning(bool prune) { m_prune = prune; }
+
+  /// forgets the path, without updating its inner nodes
+  void reset(){
+    m_path[0] = NULL;
+    m_pathDepth = 0;
+    m_key = octomap::OcTreeKey(0, 0, 0);
+    std::fill(m_modified, m_modified + MAX_DEPTH + 1, false);
+  }
+
+  /// as TreeT::search(key)
+  NodeType* search(const octomap::OcTreeKey& key){
+    unsigned depth = resume(key);
+    NodeType* node = m_path[depth];
+    if (!node)
+      return NULL;
+
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    for (; depth < treeDepth; ++depth){
+      unsigned pos = octomap::computeChildIdx(key, treeDepth - 1 - depth);
+      if (!m_tree->nodeChildExists(node, pos)){
+        if (m_tree->nodeHasChildren(node))
+          node = NULL; // unknown
+        // else: pruned leaf, covers key
+        break;
+      }
+
+      node = m_tree->getNodeChild(node, pos);
+      m_path[depth + 1] = node;
+    }
+
+    m_key = key;
+    m_pathDepth = depth;
+    return node;
+  }
+
+  /// as TreeT::updateNode(key, logOddsChange), once flush() was called
+  void updateNode(const octomap::OcTreeKey& key, float logOddsChange){
+    unsigned depth = resume(key);
+    NodeType* node = m_path[depth];
+    if (!node){
+      // empty tree, the root is created by the tree itself:
+      m_tree->updateNode(key, logOddsChange);
+      reset();
+      return;
+    }
+
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    bool created = false;
+    for (; depth < treeDepth; ++depth){
+      unsigned pos = octomap::computeChildIdx(key, treeDepth - 1 - depth);
+      if (!m_tree->nodeChildExists(node, pos)){
+        if (!m_tree->nodeHasChildren(node) && !created){
+          // pruned leaf, only expanded if it changes:
+          if (isClamped(node, logOddsChange))
+            break;
+          m_tree->expandNode(node);
+        } else{
+          m_tree->createNodeChild(node, pos);
+          created = true;
+        }
+      }
+
+      node = m_tree->getNodeChild(node, pos);
+      m_path[depth + 1] = node;
+    }
+
+    m_key = key;
+    m_pathDepth = depth;
+    if (depth < treeDepth || isClamped(node, logOddsChange))
+      return;
+
+    m_tree->updateNodeLogOdds(node, logOddsChange);
+    std::fill(m_modified, m_modified + treeDepth, true);
+  }
+
+  void updateNode(const octomap::OcTreeKey& key, bool occupied){
+    updateNode(key, occupied ? m_tree->getProbHitLog() : m_tree->getProbMissLog());
+  }
+
+  /// updates (and prunes) the inner nodes of the path that are pending, then resets it
+  void flush(){
+    leave(0);
+    reset();
+  }
+
+  void resetStatistics(){
+    m_lookups = 0;
+    m_hits = 0;
+    m_levelsSkipped = 0;
+  }
+
+  /// number of searches / updates
+  size_t numLookups() const { return m_lookups; }
+  /// number of searches / updates that started below the root
+  size_t numHits() const { return m_hits; }
+  /// sum of the levels not walked from the root
+  size_t levelsSkipped() const { return m_levelsSkipped; }
+
+  double hitRate() const { return m_lookups > 0 ? double(m_hits) / m_lookups : 0.0; }
+
+protected:
+  static const unsigned MAX_DEPTH = 16;
+
+  /// depth of the deepest common ancestor of key and the path, after leaving the deeper nodes of the path
+  unsigned resume(const octomap::OcTreeKey& key){
+    NodeType* root = m_tree->getRoot();
+    if (m_path[0] != root){
+      // tree cleared or replaced, nothing of the path is valid any more:
+      reset();
+      m_path[0] = root;
+    }
+
+    // nodes at depth d branch on key bit treeDepth-1-d, the highest differing bit ends the common path:
+    unsigned diff = (key[0] ^ m_key[0]) | (key[1] ^ m_key[1]) | (key[2] ^ m_key[2]);
+    unsigned depth = m_tree->getTreeDepth();
+    while (diff){
+      diff >>= 1;
+      --depth;
+    }
+    depth = std::min(depth, m_pathDepth);
+
+    leave(depth + 1);
+    m_lookups++;
+    if (depth > 0){
+      m_hits++;
+      m_levelsSkipped += depth;
+    }
+    return depth;
+  }
+
+  /// updates the modified inner nodes of the path from its end up to depth minDepth
+  void leave(unsigned minDepth){
+    for (int d = int(m_pathDepth); d >= int(minDepth); --d){
+      if (!m_modified[d])
+        continue;
+
+      if (!m_prune || !m_tree->pruneNode(m_path[d]))
+        m_path[d]->updateOccupancyChildren();
+      m_modified[d] = false;
+    }
+  }
+
+  bool isClamped(const NodeType* node, float logOddsChange) const{
+    return (logOddsChange >= 0 && node->getLogOdds() >= m_tree->getClampingThresMaxLog())
+        || (logOddsChange <= 0 && node->getLogOdds() <= m_tree->getClampingThresMinLog());
+  }
+
+  TreeT* m_tree;
+  bool m_prune;
+  NodeType* m_path[MAX_DEPTH + 1]; // m_path[d]: node at depth d on the path to m_key, valid up to m_pathDepth
+  bool m_modified[MAX_DEPTH + 1];  // inner node needs to be updated from its children when left
+  octomap::OcTreeKey m_key;
+  unsigned m_pathDepth;
+
+  size_t m_lookups;
+  size_t m_hits;
+  size_t m_levelsSkipped;
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+* OctomapMapper: scan integration part of the octomap_server, free of any
+* ROS communication so that it can also be driven offline
+* (see octomap_server_bench).
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_OCTOMAPMAPPER_H
+#define OCTOMAP_SERVER_OCTOMAPMAPPER_H
+
+#include <ros/console.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <tf/transform_datatypes.h>
+
+#include <octomap_ros/conversions.h>
+#include <octomap/octomap.h>
+#include <octomap/OcTreeKey.h>
+
+#include <octomap_server/TreeTraits.h>
+#include <octomap_server/NodePathCache.h>
+#include <octomap_server/VoxelBlockMap.h>
+
+namespace octomap_server {
+
+/**
+ * Scan integration for the tree type TreeT (OcTree, ColorOcTree, OcTreeStamped)
+ * and the point type PointT of the clouds. Node payloads such as colors are
+ * integrated through the overloads in TreeTraits.h, resolved at compile time.
+ */
+template <class TreeT, class PointT>
+class OctomapMapperT {
+
+public:
+  typedef PointT PCLPoint;
+  typedef pcl::PointCloud<PointT> PCLPointCloud;
+  typedef TreeT OcTreeT;
+
+  OctomapMapperT();
+  virtual ~OctomapMapperT();
+
+  /**
+  * @brief update occupancy map with a scan labeled as ground and nonground.
+  * The scans should be in the global map frame.
+  *
+  * @param sensorOrigin origin of the measurements for raycasting
+  * @param ground scan endpoints on the ground plane (only clear space)
+  * @param nonground all other endpoints (clear up to occupied endpoint)
+  */
+  virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
+
+protected:
+  /// computes the cells to update for a scan (m_freeCells, m_occupiedCells, update BBX) without changing their occupancy
+  void computeScanUpdate(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
+
+  /// integrates the cells computed by computeScanUpdate() into the octree (or m_blocks)
+  void applyScanUpdate();
+
+  /**
+   * integrates the cells into m_blocks, m_octree only follows the voxels
+   * whose occupancy state changes (with their log-odds at that time)
+   */
+  void applyBlockUpdate();
+
+  inline static void updateMinKey(const octomap::OcTreeKey& in, octomap::OcTreeKey& min) {
+    for (unsigned i = 0; i < 3; ++i)
+      min[i] = std::min(in[i], min[i]);
+  };
+
+  inline static void updateMaxKey(const octomap::OcTreeKey& in, octomap::OcTreeKey& max) {
+    for (unsigned i = 0; i < 3; ++i)
+      max[i] = std::max(in[i], max[i]);
+  };
+
+  OcTreeT* m_octree;
+  VoxelBlockMap* m_blocks; // scan integration backend, NULL: updates go into m_octree directly
+  NodePathCache<OcTreeT> m_nodeCache; // resumes the octree updates of a scan from the previous path
+  bool m_useNodeCache;
+  bool m_pruneTree; // false: scan updates never prune, every leaf stays a single voxel
+  octomap::KeyRay m_keyRay;  // temp storage for ray casting
+  octomap::OcTreeKey m_updateBBXMin;
+  octomap::OcTreeKey m_updateBBXMax;
+  octomap::KeySet m_freeCells;     // cells cleared by the last insertScan()
+  octomap::KeySet m_occupiedCells; // cells marked occupied by the last insertScan()
+
+  double m_maxRange;
+  double m_res;
+  unsigned m_treeDepth;
+  unsigned m_maxTreeDepth;
+
+  bool m_compressMap;
+};
+
+typedef OctomapMapperT<octomap::OcTree, pcl::PointXYZ> OctomapMapper;
+typedef OctomapMapperT<octomap::ColorOcTree, pcl::PointXYZRGB> ColorOctomapMapper;
+typedef OctomapMapperT<octomap::OcTreeStamped, pcl::PointXYZ> StampedOctomapMapper;
+
+}
+
+#endif
@@ -31,8 +31,10 @@
 #define OCTOMAP_SERVER_OCTOMAPSERVER_H
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <std_msgs/ColorRGBA.h>
 
 // #include <moveit_msgs/CollisionObject.h>
@@ -62,55 +64,99 @@
 #include <octomap_msgs/BoundingBoxQuery.h>
 #include <octomap_msgs/conversions.h>
 
-#include <octomap_ros/conversions.h>
-#include <octomap/octomap.h>
-#include <octomap/OcTreeKey.h>
-
-//#define COLOR_OCTOMAP_SERVER // turned off here, turned on identical ColorOctomapServer.h - easier maintenance, only maintain OctomapServer and then copy and paste to ColorOctomapServer and change define. There are prettier ways to do this, but this works for now
-
-#ifdef COLOR_OCTOMAP_SERVER
-#include <octomap/ColorOcTree.h>
-#endif
+#include <octomap_server/OctomapMapper.h>
+#include <octomap_server/EsdfMap.h>
+#include <octomap_server/FrontierTracker.h>
+#include <octomap_server/SpeckleFilter.h>
+#include <octomap_server/ChunkMesher.h>
+#include <octomap_server/DecayQueue.h>
+#include <octomap_server/ColumnIndex.h>
+#include <octomap_server/TraversabilityEstimator.h>
+#include <octomap_server/GetDistances.h>
+#include <octomap_server/QueryOccupancy.h>
+#include <octomap_server/CheckSegments.h>
+#include <octomap_server/CastRays.h>
+#include <octomap_server/RegisterRegion.h>
+
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
 
 namespace octomap_server {
-class OctomapServer {
+
+/**
+ * ROS interface of the mapping for the tree type TreeT and the cloud point
+ * type PointT (see OctomapMapperT). Instantiated for OcTree (OctomapServer),
+ * ColorOcTree (ColorOctomapServer) and OcTreeStamped (StampedOctomapServer).
+ */
+template <class TreeT, class PointT>
+class OctomapServerT : public OctomapMapperT<TreeT, PointT> {
 
 public:
-#ifdef COLOR_OCTOMAP_SERVER
-  typedef pcl::PointXYZRGB PCLPoint;
-  typedef pcl::PointCloud<pcl::PointXYZRGB> PCLPointCloud;
-  typedef octomap::ColorOcTree OcTreeT;
-#else
-  typedef pcl::PointXYZ PCLPoint;
-  typedef pcl::PointCloud<pcl::PointXYZ> PCLPointCloud;
-  typedef octomap::OcTree OcTreeT;
-#endif
+  typedef OctomapMapperT<TreeT, PointT> Mapper;
+  typedef typename Mapper::OcTreeT OcTreeT;
+  typedef typename Mapper::PCLPoint PCLPoint;
+  typedef typename Mapper::PCLPointCloud PCLPointCloud;
   typedef octomap_msgs::GetOctomap OctomapSrv;
   typedef octomap_msgs::BoundingBoxQuery BBXSrv;
-
-  OctomapServer(ros::NodeHandle private_nh_ = ros::NodeHandle("~"));
-  virtual ~OctomapServer();
+  typedef octomap_server::GetDistances DistancesSrv;
+  typedef octomap_server::QueryOccupancy OccupancySrv;
+  typedef octomap_server::CheckSegments SegmentsSrv;
+  typedef octomap_server::CastRays RaysSrv;
+  typedef octomap_server::RegisterRegion RegionSrv;
+
+  OctomapServerT(ros::NodeHandle private_nh_ = ros::NodeHandle("~"));
+  virtual ~OctomapServerT();
   virtual bool octomapBinarySrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
   virtual bool octomapFullSrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
   bool clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp);
   bool resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+  bool getDistancesSrv(DistancesSrv::Request& req, DistancesSrv::Response& resp);
+
+  // batch queries, served in parallel to the mapping from a separate callback queue:
+  bool queryOccupancySrv(OccupancySrv::Request& req, OccupancySrv::Response& resp);
+  bool checkSegmentsSrv(SegmentsSrv::Request& req, SegmentsSrv::Response& resp);
+  bool castRaysSrv(RaysSrv::Request& req, RaysSrv::Response& resp);
+
+  bool registerRegionSrv(RegionSrv::Request& req, RegionSrv::Response& resp);
 
   virtual void insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud);
+  virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
   virtual bool openFile(const std::string& filename);
 
 protected:
-  inline static void updateMinKey(const octomap::OcTreeKey& in, octomap::OcTreeKey& min) {
-    for (unsigned i = 0; i < 3; ++i)
-      min[i] = std::min(in[i], min[i]);
-  };
-
-  inline static void updateMaxKey(const octomap::OcTreeKey& in, octomap::OcTreeKey& max) {
-    for (unsigned i = 0; i < 3; ++i)
-      max[i] = std::max(in[i], max[i]);
+  using Mapper::m_octree;
+  using Mapper::m_blocks;
+  using Mapper::m_nodeCache;
+  using Mapper::m_useNodeCache;
+  using Mapper::m_keyRay;
+  using Mapper::m_updateBBXMin;
+  using Mapper::m_updateBBXMax;
+  using Mapper::m_freeCells;
+  using Mapper::m_occupiedCells;
+  using Mapper::m_maxRange;
+  using Mapper::m_res;
+  using Mapper::m_treeDepth;
+  using Mapper::m_maxTreeDepth;
+  using Mapper::m_compressMap;
+  using Mapper::updateMinKey;
+  using Mapper::updateMaxKey;
+
+  /// client region of interest, see registerRegionSrv()
+  struct RegionSubscription {
+    octomap::point3d min; // box in frameId (or the map frame)
+    octomap::point3d max;
+    std::string frameId;
+    bool full;
+    bool dirty;
+    bool published;
+    octomap::point3d lastMin; // last published box in the map frame
+    octomap::point3d lastMax;
+    ros::Publisher pub;
+    ros::Timer timer;
   };
 
   /// Test if key is within update area of map (2D, ignores height)
-  inline bool isInUpdateBBX(const OcTreeT::iterator& it) const {
+  inline bool isInUpdateBBX(const typename OcTreeT::iterator& it) const {
     // 2^(tree_depth-depth) voxels wide:
     unsigned voxelWidth = (1 << (m_maxTreeDepth - it.getDepth()));
     octomap::OcTreeKey key = it.getIndexKey(); // lower corner of voxel
@@ -121,56 +167,133 @@ protected:
   }
 
   void reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level);
-  void publishBinaryOctoMap(const ros::Time& rostime = ros::Time::now()) const;
-  void publishFullOctoMap(const ros::Time& rostime = ros::Time::now()) const;
+  /// publish m_octree on the binary / full map topic, truncated to the LOD depths if lod
+  void publishBinaryOctoMap(const ros::Time& rostime = ros::Time::now(), bool lod = false) const;
+  void publishFullOctoMap(const ros::Time& rostime = ros::Time::now(), bool lod = false) const;
+  void publishEsdfSlice(const ros::Time& rostime = ros::Time::now()) const;
+  void publishFrontiers(const ros::TimerEvent& event);
+  void publishRegion(const ros::TimerEvent& event, const std::string& name);
+
+  /// decays the occupied voxels that were not observed for m_decayTime
+  void decayCallback(const ros::TimerEvent& event);
+
+  /// mark all regions overlapping the box [min, max] (map frame) as changed
+  void markRegionsDirty(const octomap::point3d& min, const octomap::point3d& max);
   virtual void publishAll(const ros::Time& rostime = ros::Time::now());
 
-  /**
-  * @brief update occupancy map with a scan labeled as ground and nonground.
-  * The scans should be in the global map frame.
-  *
-  * @param sensorOrigin origin of the measurements for raycasting
-  * @param ground scan endpoints on the ground plane (only clear space)
-  * @param nonground all other endpoints (clear up to occupied endpoint)
-  */
-  virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
-
   /// label the input cloud "pc" into ground and nonground. Should be in the robot's fixed frame (not world!)
   void filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const;
 
+  /// true if the segment start-end is free (without holding the octree lock)
+  bool isSegmentFree(const octomap::point3d& start, const octomap::point3d& end, bool unknownIsOccupied, octomap::KeyRay& keyRay) const;
+
   /**
-  * @brief Find speckle nodes (single occupied voxels with no neighbors). Only works on lowest resolution!
-  * @param key
-  * @return
+  * @brief Clear the key box [minKey, maxKey] below node (with center key nodeKey),
+  * overwriting / deleting subtrees completely inside the box at once.
+  * @return true if node is unknown afterwards and should be deleted by the caller
   */
-  bool isSpeckleNode(const octomap::OcTreeKey& key) const;
+  bool clearBBXRecurs(typename OcTreeT::NodeType* node, unsigned depth, const octomap::OcTreeKey& nodeKey,
+                      const octomap::OcTreeKey& minKey, const octomap::OcTreeKey& maxKey, float clearLogOdds);
+
+  /// looks up the position of m_lodFrameId as m_lodCenter, false if it is not available
+  bool updateLODCenter();
+
+  /**
+   * Max. depth of the published nodes around key: m_maxTreeDepth within
+   * m_lodRadius of m_lodCenter, one level less for each doubling of the
+   * distance, down to m_lodMinDepth. The depth is the same for all keys of a
+   * node at m_lodMinDepth, so that their coarse nodes are complete.
+   */
+  unsigned lodDepth(const octomap::OcTreeKey& key) const;
+
+  /// true if node is published as a leaf: it has no children, or it is at its LOD depth (or deeper)
+  bool isLODLeaf(const typename OcTreeT::NodeType* node, unsigned depth, const octomap::OcTreeKey& nodeKey) const;
+
+  /**
+   * Serializes m_octree as binaryMapToMsg() / fullMapToMsg() would serialize
+   * a copy of it with all nodes truncated at their LOD depth, without copying
+   * the tree: the inner nodes at the LOD depth are written as leafs (with the
+   * max. occupancy of their children).
+   */
+  bool lodMapToMsg(bool binary, octomap_msgs::Octomap& map) const;
+
+  /// binary format of OccupancyOcTreeBase::writeBinaryNode(), of the subtree truncated by the LOD depths
+  void writeLODBinaryRecurs(std::ostream& s, const typename OcTreeT::NodeType* node, unsigned depth,
+                            const octomap::OcTreeKey& nodeKey) const;
+
+  /// full format of OcTreeBaseImpl::writeNodesRecurs(), of the subtree truncated by the LOD depths
+  void writeLODFullRecurs(std::ostream& s, const typename OcTreeT::NodeType* node, unsigned depth,
+                          const octomap::OcTreeKey& nodeKey) const;
+
+  /// update the distance field, frontiers and columns with m_freeCells / m_occupiedCells
+  void updateIncrementalLayers();
+
+  /// update the distance field with the cells changed by the last insertScan()
+  void updateEsdf();
+
+  /// set the occupancy of all voxels of a leaf node in the distance field
+  void updateEsdfLeaf(const octomap::OcTreeKey& indexKey, unsigned depth, bool occupied);
+
+  /// rebuild the distance field from the complete octree (e.g. after loading a map)
+  void resetEsdf();
+
+  /// rebuild the frontiers from the complete octree (e.g. after loading a map)
+  void resetFrontiers();
 
   /// hook that is called before traversing all nodes
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
 
   /// hook that is called when traversing all nodes of the updated Octree (does nothing here)
-  virtual void handleNode(const OcTreeT::iterator& it) {};
+  virtual void handleNode(const typename OcTreeT::iterator& it) {};
 
   /// hook that is called when traversing all nodes of the updated Octree in the updated area (does nothing here)
-  virtual void handleNodeInBBX(const OcTreeT::iterator& it) {};
+  virtual void handleNodeInBBX(const typename OcTreeT::iterator& it) {};
 
   /// hook that is called when traversing occupied nodes of the updated Octree
-  virtual void handleOccupiedNode(const OcTreeT::iterator& it);
+  virtual void handleOccupiedNode(const typename OcTreeT::iterator& it);
 
   /// hook that is called when traversing occupied nodes in the updated area (updates 2D map projection here)
-  virtual void handleOccupiedNodeInBBX(const OcTreeT::iterator& it);
+  virtual void handleOccupiedNodeInBBX(const typename OcTreeT::iterator& it);
 
   /// hook that is called when traversing free nodes of the updated Octree
-  virtual void handleFreeNode(const OcTreeT::iterator& it);
+  virtual void handleFreeNode(const typename OcTreeT::iterator& it);
 
   /// hook that is called when traversing free nodes in the updated area (updates 2D map projection here)
-  virtual void handleFreeNodeInBBX(const OcTreeT::iterator& it);
+  virtual void handleFreeNodeInBBX(const typename OcTreeT::iterator& it);
 
   /// hook that is called after traversing all nodes
   virtual void handlePostNodeTraversal(const ros::Time& rostime);
 
   /// updates the downprojected 2D map as either occupied or free
-  virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
+  virtual void update2DMap(const typename OcTreeT::iterator& it, bool occupied);
+
+  /// updates the 2D map cell idx from its column summary (instead of update2DMap)
+  virtual void update2DMapColumn(unsigned idx, const ColumnIndex::Column& column);
+
+  /// updates the 2D map(s) from the columns changed since the last publish (or all)
+  void projectColumns();
+
+  /// rebuild the column index from the complete octree (e.g. after loading a map)
+  void resetColumns();
+
+  /**
+   * z key range [lo, hi] of the voxels touching the heights [minZ, maxZ] (centers: with their
+   * center in (minZ, maxZ)), clamped to the map bounds. lo > hi if there is none.
+   */
+  void zKeyRange(double minZ, double maxZ, octomap::key_type& lo, octomap::key_type& hi, bool centers = false) const;
+
+  /// recomputes the traversability costs around the changed columns (or all) and publishes them
+  void updateTraversabilityMap();
+
+  /// publishes the cells [minX, maxX] x [minY, maxY] of map as map_msgs/OccupancyGridUpdate
+  void publishGridUpdate(const ros::Publisher& pub, const nav_msgs::OccupancyGrid& map,
+                         unsigned minX, unsigned minY, unsigned maxX, unsigned maxY) const;
+
+  /// sends the current map to a newly connected subscriber
+  void mapConnectCallback(const ros::SingleSubscriberPublisher& pub, const nav_msgs::OccupancyGrid* map);
+
+  /// sends all chunks of the occupied mesh to a newly connected subscriber
+  void meshConnectCallback(const ros::SingleSubscriberPublisher& pub);
 
   inline unsigned mapIdx(int i, int j) const {
     return m_gridmap.info.width * j + i;
@@ -199,20 +322,20 @@ protected:
 
   static std_msgs::ColorRGBA heightMapColor(double h);
   ros::NodeHandle m_nh;
+  ros::CallbackQueue m_queryQueue;
+  ros::AsyncSpinner* m_querySpinner;
+  boost::shared_mutex m_octreeMutex; // write access to m_octree while the batch queries are running
   ros::Publisher  m_markerPub, m_binaryMapPub, m_fullMapPub, m_pointCloudPub, m_collisionObjectPub, m_mapPub, m_cmapPub, m_fmapPub, m_fmarkerPub;
   message_filters::Subscriber<sensor_msgs::PointCloud2>* m_pointCloudSub;
   tf::MessageFilter<sensor_msgs::PointCloud2>* m_tfPointCloudSub;
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_clearBBXService, m_resetService;
+  ros::Publisher  m_meshPub, m_esdfSlicePub, m_frontierPub, m_mapUpdatesPub, m_traversabilityPub, m_traversabilityUpdatesPub;
+  ros::Timer m_frontierTimer, m_decayTimer;
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_clearBBXService, m_resetService, m_distancesService;
+  ros::ServiceServer m_occupancyQueryService, m_segmentQueryService, m_rayQueryService, m_registerRegionService;
   tf::TransformListener m_tfListener;
   boost::recursive_mutex m_config_mutex;
   dynamic_reconfigure::Server<OctomapServerConfig> m_reconfigureServer;
 
-  OcTreeT* m_octree;
-  octomap::KeyRay m_keyRay;  // temp storage for ray casting
-  octomap::OcTreeKey m_updateBBXMin;
-  octomap::OcTreeKey m_updateBBXMax;
-
-  double m_maxRange;
   std::string m_worldFrameId; // the map frame
   std::string m_baseFrameId; // base of the robot for ground plane filtering
   bool m_useHeightMap;
@@ -223,10 +346,6 @@ protected:
   bool m_latchedTopics;
   bool m_publishFreeSpace;
 
-  double m_res;
-  unsigned m_treeDepth;
-  unsigned m_maxTreeDepth;
-
   double m_pointcloudMinX;
   double m_pointcloudMaxX;
   double m_pointcloudMinY;
@@ -238,14 +357,15 @@ protected:
   double m_minSizeX;
   double m_minSizeY;
   bool m_filterSpeckles;
+  SpeckleFilter* m_speckles; // isolated occupied voxels, not published (NULL if filter_speckles is off)
+  std::vector<octomap::OcTreeKey> m_freedCells; // free cells of the last scan that were occupied before it (only with m_speckles)
+  bool m_clearBBXToUnknown; // delete cleared areas instead of marking them free
 
   bool m_filterGroundPlane;
   double m_groundFilterDistance;
   double m_groundFilterAngle;
   double m_groundFilterPlaneDistance;
 
-  bool m_compressMap;
-
   bool m_initConfig;
 
   // downprojected 2D map:
@@ -256,8 +376,52 @@ protected:
   octomap::OcTreeKey m_paddedMinKey;
   unsigned m_multires2DScale;
   bool m_projectCompleteMap;
+  bool m_partialMapUpdates;  // publish map_msgs/OccupancyGridUpdate instead of the full map when possible
+  int m_mapChunkSize;        // the 2D map grows in multiples of this (cells)
+  bool m_mapResized;
+  unsigned m_mapUpdateMinX, m_mapUpdateMinY, m_mapUpdateMaxX, m_mapUpdateMaxY; // updated cells
+  ColumnIndex* m_columns;    // 2.5D column summary (NULL if disabled)
+  bool m_columnProjection;   // 2D map(s) are projected from m_columns in the current publish
+
+  // traversability costmap (same geometry as the 2D map, NULL if disabled):
+  TraversabilityEstimator* m_traversability;
+  nav_msgs::OccupancyGrid m_traversabilityMap;
+  bool m_publishTraversability;
   bool m_useColoredMap;
+
+  // incremental distance field (NULL if disabled):
+  EsdfMap* m_esdf;
+  double m_esdfMaxDistance;
+  bool m_publishEsdfSlice;
+  double m_esdfSliceZ;
+
+  std::map<std::string, RegionSubscription> m_regions;
+
+  // incremental frontiers (NULL if disabled):
+  FrontierTracker* m_frontiers;
+  int m_frontierMinClusterSize;
+
+  // decay of unobserved occupied voxels (NULL if disabled):
+  DecayQueue* m_decay;
+  double m_decayTime;     // time without observation until an occupied voxel decays (s)
+  double m_decayPeriod;   // interval between decay steps (s)
+  double m_decayLogOdds;  // log-odds removed per decay step
+
+  // greedy-meshed occupied voxels, re-meshed per touched chunk (NULL if disabled):
+  ChunkMesher* m_mesher;
+
+  // level of detail of the markers, point cloud and octomap topics by distance from m_lodFrameId:
+  bool m_lodEnabled;
+  std::string m_lodFrameId;
+  double m_lodRadius;          // full depth within this distance (m)
+  unsigned m_lodMinDepth;      // coarsest depth
+  octomap::point3d m_lodCenter;
 };
+
+typedef OctomapServerT<octomap::OcTree, pcl::PointXYZ> OctomapServer;
+typedef OctomapServerT<octomap::ColorOcTree, pcl::PointXYZRGB> ColorOctomapServer;
+typedef OctomapServerT<octomap::OcTreeStamped, pcl::PointXYZ> StampedOctomapServer;
+
 }
 
 #endif
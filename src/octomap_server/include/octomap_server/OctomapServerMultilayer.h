@@ -54,6 +54,9 @@ protected:
   /// updates the downprojected 2D map as either occupied or free
   virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
 
+  /// updates the 2D maps from a column summary
+  virtual void update2DMapColumn(unsigned idx, const ColumnIndex::Column& column);
+
   /// hook that is called after traversing all nodes
   virtual void handlePostNodeTraversal(const ros::Time& rostime);
 
@@ -0,0 +1,186 @@
+/**
+* SpeckleFilter: incremental detection of isolated occupied voxels for the
+* octomap_server
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_SPECKLEFILTER_H
+#define OCTOMAP_SERVER_SPECKLEFILTER_H
+
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/NodePathCache.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Keeps the set of speckles: occupied voxels without any occupied voxel in
+ * their 26-neighborhood. A voxel's status only changes if the voxel itself
+ * or one of its neighbors changes, so update() only re-evaluates the voxels
+ * around the ones marked as touched. Their neighborhoods are evaluated in
+ * one sweep in key order: the occupancy of each voxel involved is searched
+ * once (resuming from the previous search path) and then looked up in a
+ * hash map, instead of searching the 26 neighbors of every occupied voxel
+ * from the root in each publish.
+ */
+class SpeckleFilter {
+
+public:
+  SpeckleFilter();
+
+  /// mark voxels whose occupancy changed (their neighbors are re-evaluated implicitly)
+  void markTouched(const octomap::KeySet& keys);
+  void markTouched(const std::vector<octomap::OcTreeKey>& keys);
+
+  /// mark all occupied voxels of tree, e.g. after loading it
+  template <class TreeT>
+  void markOccupied(const TreeT& tree);
+
+  /**
+   * After the key box [min, max] was cleared: drops the speckles inside and
+   * marks the occupied voxels around it, which may have lost their neighbors.
+   */
+  template <class TreeT>
+  void clearBox(const TreeT& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+
+  /// re-evaluate the voxels around the touched ones against tree
+  template <class TreeT>
+  void update(TreeT& tree);
+
+  bool isSpeckle(const octomap::OcTreeKey& key) const { return m_speckles.find(key) != m_speckles.end(); }
+
+  void clear();
+
+  size_t size() const { return m_speckles.size(); }
+
+protected:
+  typedef unordered_ns::unordered_map<octomap::OcTreeKey, bool, octomap::OcTreeKey::KeyHash> OccupancyMap;
+
+  /// z-y-x order, so that consecutive keys share most of their octree path
+  static bool keyLess(const octomap::OcTreeKey& a, const octomap::OcTreeKey& b){
+    if (a[2] != b[2])
+      return a[2] < b[2];
+    if (a[1] != b[1])
+      return a[1] < b[1];
+    return a[0] < b[0];
+  }
+
+  template <class TreeT>
+  static bool isOccupied(const TreeT& tree, NodePathCache<TreeT>& cache, OccupancyMap& occupancy, const octomap::OcTreeKey& key);
+
+  octomap::KeySet m_touched;
+  octomap::KeySet m_speckles;
+};
+
+template <class TreeT>
+void SpeckleFilter::markOccupied(const TreeT& tree){
+  // voxels of larger leafs always have occupied neighbors:
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (typename TreeT::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it){
+    if (it.getDepth() == treeDepth && tree.isNodeOccupied(*it))
+      m_touched.insert(it.getKey());
+  }
+}
+
+template <class TreeT>
+void SpeckleFilter::clearBox(const TreeT& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max){
+  for (octomap::KeySet::iterator it = m_speckles.begin(); it != m_speckles.end();){
+    const octomap::OcTreeKey& key = *it;
+    if (key[0] >= min[0] && key[0] <= max[0] && key[1] >= min[1] && key[1] <= max[1]
+        && key[2] >= min[2] && key[2] <= max[2])
+      m_speckles.erase(it++);
+    else
+      ++it;
+  }
+
+  // the one voxel thick shell around the box, face by face:
+  const unsigned treeDepth = tree.getTreeDepth();
+  const octomap::key_type maxKey = std::numeric_limits<octomap::key_type>::max();
+  for (unsigned axis = 0; axis < 3; ++axis){
+    for (int side = 0; side < 2; ++side){
+      if ((side == 0 && min[axis] == 0) || (side == 1 && max[axis] == maxKey))
+        continue;
+
+      octomap::OcTreeKey shellMin, shellMax;
+      for (unsigned i = 0; i < 3; ++i){
+        shellMin[i] = (min[i] > 0) ? min[i] - 1 : min[i];
+        shellMax[i] = (max[i] < maxKey) ? max[i] + 1 : max[i];
+      }
+      shellMin[axis] = shellMax[axis] = (side == 0) ? min[axis] - 1 : max[axis] + 1;
+
+      for (typename TreeT::leaf_bbx_iterator it = tree.begin_leafs_bbx(shellMin, shellMax),
+           end = tree.end_leafs_bbx(); it != end; ++it){
+        if (it.getDepth() == treeDepth && tree.isNodeOccupied(*it))
+          m_touched.insert(it.getKey());
+      }
+    }
+  }
+}
+
+template <class TreeT>
+bool SpeckleFilter::isOccupied(const TreeT& tree, NodePathCache<TreeT>& cache, OccupancyMap& occupancy, const octomap::OcTreeKey& key){
+  OccupancyMap::iterator it = occupancy.find(key);
+  if (it != occupancy.end())
+    return it->second;
+
+  typename TreeT::NodeType* node = cache.search(key);
+  bool occupied = node && tree.isNodeOccupied(node);
+  occupancy.insert(std::make_pair(key, occupied));
+  return occupied;
+}
+
+template <class TreeT>
+void SpeckleFilter::update(TreeT& tree){
+  if (m_touched.empty())
+    return;
+
+  // a voxel's status depends on itself and its 26 neighbors:
+  octomap::KeySet candidateSet;
+  octomap::OcTreeKey nKey;
+  for (octomap::KeySet::const_iterator it = m_touched.begin(); it != m_touched.end(); ++it){
+    for (int dz = -1; dz <= 1; ++dz){
+      nKey[2] = (*it)[2] + dz;
+      for (int dy = -1; dy <= 1; ++dy){
+        nKey[1] = (*it)[1] + dy;
+        for (int dx = -1; dx <= 1; ++dx){
+          nKey[0] = (*it)[0] + dx;
+          candidateSet.insert(nKey);
+        }
+      }
+    }
+  }
+  m_touched.clear();
+
+  std::vector<octomap::OcTreeKey> candidates(candidateSet.begin(), candidateSet.end());
+  std::sort(candidates.begin(), candidates.end(), keyLess);
+
+  NodePathCache<TreeT> cache(&tree);
+  OccupancyMap occupancy;
+  for (unsigned i = 0; i < candidates.size(); ++i){
+    const octomap::OcTreeKey& key = candidates[i];
+    bool speckle = isOccupied(tree, cache, occupancy, key);
+    for (int dz = -1; speckle && dz <= 1; ++dz){
+      nKey[2] = key[2] + dz;
+      for (int dy = -1; speckle && dy <= 1; ++dy){
+        nKey[1] = key[1] + dy;
+        for (int dx = -1; speckle && dx <= 1; ++dx){
+          nKey[0] = key[0] + dx;
+          if (nKey != key && isOccupied(tree, cache, occupancy, nKey))
+            speckle = false;
+        }
+      }
+    }
+
+    if (speckle)
+      m_speckles.insert(key);
+    else
+      m_speckles.erase(key);
+  }
+}
+
+}
+
+#endif
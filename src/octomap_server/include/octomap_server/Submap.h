@@ -0,0 +1,46 @@
+/**
+* Submap: local octree of one keyframe for the SubmapOctomapServer
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_SUBMAP_H
+#define OCTOMAP_SERVER_SUBMAP_H
+
+#include <octomap_server/OctomapMapper.h>
+
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Octree in the frame of a keyframe, integrating the scans taken while the
+ * keyframe is the current one. The tree is never pruned (neither by the scan
+ * updates nor by compression), so that each leaf is a single voxel that can
+ * be moved into the global map on its own.
+ */
+class Submap : public OctomapMapper {
+
+public:
+  /// log-odds change of a voxel by insertLocalScan()
+  struct Delta {
+    octomap::OcTreeKey key;
+    float logOdds;
+    bool added; ///< voxel was unknown before
+  };
+
+  /// @param params tree to copy resolution and sensor model from
+  Submap(const OcTreeT& params, double maxRange);
+
+  /**
+  * @brief Integrate a scan given in the submap frame like insertScan(), and
+  * report the changes of all updated voxels in deltas.
+  */
+  void insertLocalScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground,
+                       std::vector<Delta>& deltas);
+
+  const OcTreeT& getTree() const { return *m_octree; }
+};
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+/**
+* SubmapOctomapServer: octomap_server composing the map from keyframe submaps
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_SUBMAPOCTOMAPSERVER_H
+#define OCTOMAP_SERVER_SUBMAPOCTOMAPSERVER_H
+
+#include <octomap_server/OctomapServer.h>
+#include <octomap_server/Submap.h>
+#include <octomap_server/TreeComposition.h>
+
+#include <nav_msgs/Path.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <set>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Integrates each scan into the submap of the current (last) keyframe
+ * received on keyframe_poses, and keeps m_octree as the sum of all submaps
+ * at their keyframe poses. When a keyframe pose changes (e.g. after a loop
+ * closure), only its submap is moved: a background thread computes the old
+ * and new global keys of all its voxels in parallel, and the main thread
+ * then swaps the contributions in one step.
+ *
+ * The distance field, frontiers, column index, decay and clear_bbx are not
+ * supported in this mode, and no map can be loaded.
+ */
+class SubmapOctomapServer : public OctomapServer {
+
+public:
+  SubmapOctomapServer(ros::NodeHandle private_nh_ = ros::NodeHandle("~"));
+  virtual ~SubmapOctomapServer();
+
+  /// poses[i] is the pose of keyframe / submap i in the map frame
+  void keyframeCallback(const nav_msgs::Path::ConstPtr& path);
+  virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
+  virtual bool openFile(const std::string& filename);
+  bool resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+
+protected:
+  /// voxels of a submap with their global keys before and after a pose change
+  struct Recomposition {
+    unsigned epoch;
+    std::vector<float> logOdds;
+    std::vector<octomap::OcTreeKey> oldKeys;
+    std::vector<octomap::OcTreeKey> newKeys;
+    std::vector<char> oldValid; // global key within the map bounds
+    std::vector<char> newValid;
+  };
+
+  /// background thread: computes a Recomposition for each pending submap
+  void composeThread();
+
+  /// moves the computed submaps in m_octree and publishes the result
+  void commitRecompositions(const ros::TimerEvent& event);
+
+  /// global key of the submap voxel localKey for the submap pose, false if outside of the map
+  bool worldKey(const octomap::OcTreeKey& localKey, const tf::Pose& pose, octomap::OcTreeKey& key) const;
+
+  /// true if b differs from a by more than the tolerances
+  bool poseChanged(const tf::Pose& a, const tf::Pose& b) const;
+
+  // submaps with their latest and their composed keyframe pose (guarded by m_octreeMutex):
+  std::vector<Submap*> m_submaps;
+  std::vector<tf::Pose> m_targetPoses;
+  std::vector<tf::Pose> m_appliedPoses;
+  TreeComposition<OcTreeT> m_composition;
+  unsigned m_epoch; // incremented on reset, invalidates running recompositions
+
+  boost::thread* m_composeThread;
+  boost::mutex m_composeMutex; // guards the members below
+  boost::condition_variable m_composeCondition;
+  std::set<unsigned> m_pendingSubmaps;
+  std::vector<Recomposition*> m_recompositions;
+  bool m_shutdown;
+
+  ros::Subscriber m_keyframeSub;
+  ros::Timer m_commitTimer;
+  double m_poseTolerance;
+  double m_angleTolerance;
+};
+
+}
+
+#endif
@@ -0,0 +1,50 @@
+/**
+* TraversabilityEstimator: ground vehicle costs from the ColumnIndex floor heights
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_TRAVERSABILITYESTIMATOR_H
+#define OCTOMAP_SERVER_TRAVERSABILITYESTIMATOR_H
+
+#include <octomap_server/ColumnIndex.h>
+
+namespace octomap_server {
+
+/**
+ * Computes a cost (0..100, -1: unknown) for each map column from the floor
+ * heights (lowest occupied voxel) of the columns in a square neighborhood:
+ * step height to the direct neighbors, slope and roughness (RMS residual)
+ * of a least-squares plane fit. Cells exceeding a limit are lethal (100),
+ * all others are scaled by the largest ratio to its limit.
+ */
+class TraversabilityEstimator {
+
+public:
+  struct Params {
+    double maxStep;      ///< max. step height (m)
+    double maxSlope;     ///< max. slope (rad)
+    double maxRoughness; ///< max. RMS deviation from the local plane (m)
+    int radius;          ///< neighborhood radius (cells) for the plane fit
+
+    Params() : maxStep(0.15), maxSlope(0.4), maxRoughness(0.05), radius(2) {}
+  };
+
+  TraversabilityEstimator(const ColumnIndex& columns, double resolution, const Params& params);
+
+  /// cost of the column at (x, y)
+  int8_t cost(octomap::key_type x, octomap::key_type y) const;
+
+  int radius() const { return m_params.radius; }
+
+protected:
+  /// floor height of the column (m), false if it has no occupied voxels
+  bool floorHeight(octomap::key_type x, octomap::key_type y, double& height) const;
+
+  const ColumnIndex& m_columns;
+  double m_resolution;
+  Params m_params;
+};
+
+}
+
+#endif
@@ -0,0 +1,285 @@
+/**
+* TreeComposition: octree composed as the sum of the log-odds of several sources
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_TREECOMPOSITION_H
+#define OCTOMAP_SERVER_TREECOMPOSITION_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace octomap_server {
+
+/**
+ * Maintains a target octree as the unclamped sum of the log-odds that
+ * several sources (submaps, robots) contribute to each voxel. Contributions
+ * can be removed again exactly, e.g. to move a source to a new pose. Only the
+ * voxels changed since the last commit() are written to the tree (clamped),
+ * voxels without any contribution left are deleted.
+ *
+ * A source can contribute to a whole node at a lower depth (e.g. a pruned
+ * leaf of its map) instead of each of its voxels. The value of a voxel is the
+ * sum of the contributions of all nodes containing it; nodes without any
+ * contribution below them are written to the tree as leafs.
+ */
+template <class TreeT>
+class TreeComposition {
+
+public:
+  struct Contribution {
+    float logOdds; ///< unclamped sum over all sources
+    int count;     ///< number of source nodes contributing
+
+    Contribution() : logOdds(0.0f), count(0) {}
+  };
+
+  /// node of the tree, with the lowest key it covers
+  struct Node {
+    octomap::OcTreeKey key;
+    unsigned depth;
+  };
+
+  typedef unordered_ns::unordered_map<uint64_t, Contribution> ContributionMap;
+
+  TreeComposition(TreeT* tree = NULL) : m_tree(tree) { clear(); }
+
+  void setTree(TreeT* tree) { m_tree = tree; }
+
+  /// id of the node at depth containing key: its lowest key packed into 3x16 bits, the depth above
+  static uint64_t nodeId(const octomap::OcTreeKey& key, unsigned depth, unsigned treeDepth){
+    const octomap::key_type mask = octomap::key_type(~((1u << (treeDepth - depth)) - 1));
+    return uint64_t(key[0] & mask) | (uint64_t(key[1] & mask) << 16) | (uint64_t(key[2] & mask) << 32)
+        | (uint64_t(depth) << 48);
+  }
+
+  static Node idToNode(uint64_t id){
+    Node node;
+    node.key = octomap::OcTreeKey(octomap::key_type(id & 0xFFFF), octomap::key_type((id >> 16) & 0xFFFF),
+                                  octomap::key_type((id >> 32) & 0xFFFF));
+    node.depth = unsigned(id >> 48);
+    return node;
+  }
+
+  /**
+   * Add logOdds at key. countChange is +1 if a source voxel starts
+   * contributing to key, -1 if it stops, 0 if its value changed.
+   */
+  inline void add(const octomap::OcTreeKey& key, float logOdds, int countChange){
+    add(key, m_tree->getTreeDepth(), logOdds, countChange);
+  }
+
+  /// add logOdds to all voxels of the node at depth containing key, as add() for a voxel
+  void add(const octomap::OcTreeKey& key, unsigned depth, float logOdds, int countChange){
+    uint64_t id = nodeId(key, depth, m_tree->getTreeDepth());
+    std::pair<typename ContributionMap::iterator, bool> inserted = m_contributions.insert(std::make_pair(id, Contribution()));
+    if (inserted.second)
+      addedContribution(id, depth);
+
+    Contribution& c = inserted.first->second;
+    c.logOdds += logOdds;
+    c.count += countChange;
+    if (m_dirty.insert(id).second)
+      m_numDirtyAtDepth[depth]++;
+  }
+
+  /**
+   * Write all changed nodes into the tree and extend [min, max] by them.
+   * @param changed if not NULL, the changed voxels are appended
+   * @param changedNodes if not NULL, the changed nodes above the voxel level are appended
+   * @return the number of changed voxels and nodes
+   */
+  size_t commit(octomap::OcTreeKey& min, octomap::OcTreeKey& max, std::vector<octomap::OcTreeKey>* changed = NULL,
+                std::vector<Node>* changedNodes = NULL){
+    // contributions that ended are dropped first, their nodes are rewritten below:
+    for (typename DirtySet::const_iterator it = m_dirty.begin(); it != m_dirty.end(); ++it){
+      typename ContributionMap::iterator c = m_contributions.find(*it);
+      if (c != m_contributions.end() && c->second.count <= 0)
+        eraseContribution(c);
+    }
+
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    size_t numChanged = 0;
+    for (typename DirtySet::const_iterator it = m_dirty.begin(); it != m_dirty.end(); ++it){
+      Node node = idToNode(*it);
+
+      // the contributions of the ancestors apply to the whole node, unless one of them is rewritten anyway:
+      bool covered = false;
+      float logOdds = 0.0f;
+      int count = 0;
+      for (unsigned d = 0; d < node.depth && !covered; ++d){
+        if (m_numAtDepth[d] == 0 && m_numDirtyAtDepth[d] == 0)
+          continue;
+
+        uint64_t ancestor = nodeId(node.key, d, treeDepth);
+        covered = m_numDirtyAtDepth[d] > 0 && m_dirty.find(ancestor) != m_dirty.end();
+        typename ContributionMap::const_iterator c = m_contributions.find(ancestor);
+        if (c != m_contributions.end()){
+          logOdds += c->second.logOdds;
+          count += c->second.count;
+        }
+      }
+
+      if (!covered)
+        numChanged += writeNode(node.key, node.depth, logOdds, count, min, max, changed, changedNodes);
+    }
+    m_dirty.clear();
+    std::fill(m_numDirtyAtDepth, m_numDirtyAtDepth + MAX_DEPTH + 1, 0);
+
+    return numChanged;
+  }
+
+  void clear(){
+    m_contributions.clear();
+    m_dirty.clear();
+    m_below.clear();
+    m_belowDepth = MAX_DEPTH + 1;
+    std::fill(m_numAtDepth, m_numAtDepth + MAX_DEPTH + 1, 0);
+    std::fill(m_numDirtyAtDepth, m_numDirtyAtDepth + MAX_DEPTH + 1, 0);
+  }
+
+  size_t size() const { return m_contributions.size(); }
+
+protected:
+  static const unsigned MAX_DEPTH = 16;
+
+  typedef unordered_ns::unordered_set<uint64_t> DirtySet;
+  typedef unordered_ns::unordered_map<uint64_t, unsigned> CountMap;
+
+  void addedContribution(uint64_t id, unsigned depth){
+    m_numAtDepth[depth]++;
+    if (depth >= m_belowDepth){
+      trackBelow(id, 1);
+      return;
+    }
+
+    // the first contribution this coarse, the nodes above all others are counted from here on:
+    m_belowDepth = depth;
+    m_below.clear();
+    for (typename ContributionMap::const_iterator it = m_contributions.begin(); it != m_contributions.end(); ++it)
+      trackBelow(it->first, 1);
+  }
+
+  void eraseContribution(typename ContributionMap::iterator it){
+    m_numAtDepth[idToNode(it->first).depth]--;
+    trackBelow(it->first, -1);
+    m_contributions.erase(it);
+  }
+
+  /// counts the contribution id in m_below of its ancestors from m_belowDepth on
+  void trackBelow(uint64_t id, int change){
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    Node node = idToNode(id);
+    for (unsigned d = m_belowDepth; d < node.depth; ++d){
+      uint64_t ancestor = nodeId(node.key, d, treeDepth);
+      if (change > 0)
+        m_below[ancestor]++;
+      else{
+        typename CountMap::iterator it = m_below.find(ancestor);
+        if (--it->second == 0)
+          m_below.erase(it);
+      }
+    }
+  }
+
+  /// writes the node (lowest key key) with the contributions of its ancestors, split where nodes below contribute
+  size_t writeNode(const octomap::OcTreeKey& key, unsigned depth, float logOdds, int count,
+                   octomap::OcTreeKey& min, octomap::OcTreeKey& max,
+                   std::vector<octomap::OcTreeKey>* changed, std::vector<Node>* changedNodes){
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    uint64_t id = nodeId(key, depth, treeDepth);
+    typename ContributionMap::const_iterator c = m_contributions.find(id);
+    if (c != m_contributions.end()){
+      logOdds += c->second.logOdds;
+      count += c->second.count;
+    }
+
+    // (rewritten nodes are never above m_belowDepth, the depth of the coarsest contribution so far)
+    if (depth < treeDepth && m_below.find(id) != m_below.end()){
+      const unsigned half = 1u << (treeDepth - depth - 1);
+      size_t numChanged = 0;
+      for (unsigned i = 0; i < 8; ++i){
+        octomap::OcTreeKey childKey(key[0] + ((i & 1) ? half : 0), key[1] + ((i & 2) ? half : 0),
+                                    key[2] + ((i & 4) ? half : 0));
+        numChanged += writeNode(childKey, depth + 1, logOdds, count, min, max, changed, changedNodes);
+      }
+      return numChanged;
+    }
+
+    if (count > 0)
+      setLeaf(key, depth, logOdds);
+    else if (depth == 0)
+      m_tree->clear();
+    else
+      m_tree->deleteNode(key, depth);
+
+    const unsigned width = 1u << (treeDepth - depth);
+    for (unsigned i = 0; i < 3; ++i){
+      min[i] = std::min(min[i], key[i]);
+      max[i] = std::max(max[i], octomap::key_type(key[i] + width - 1));
+    }
+
+    if (depth == treeDepth){
+      if (changed)
+        changed->push_back(key);
+    } else if (changedNodes){
+      Node node;
+      node.key = key;
+      node.depth = depth;
+      changedNodes->push_back(node);
+    }
+    return 1;
+  }
+
+  /// makes the node at depth containing key a leaf with logOdds (clamped), non-lazy
+  void setLeaf(const octomap::OcTreeKey& key, unsigned depth, float logOdds){
+    const unsigned treeDepth = m_tree->getTreeDepth();
+    if (depth == treeDepth || !m_tree->getRoot()){
+      // the root is created by the tree itself, the path below depth is cut again:
+      m_tree->setNodeValue(key, logOdds, depth < treeDepth);
+      if (depth == treeDepth)
+        return;
+    }
+
+    logOdds = std::min(std::max(logOdds, m_tree->getClampingThresMinLog()), m_tree->getClampingThresMaxLog());
+    typename TreeT::NodeType* path[MAX_DEPTH + 1];
+    path[0] = m_tree->getRoot();
+    for (unsigned d = 0; d < depth; ++d){
+      unsigned pos = octomap::computeChildIdx(key, treeDepth - 1 - d);
+      if (!m_tree->nodeChildExists(path[d], pos)){
+        if (!m_tree->nodeHasChildren(path[d]))
+          m_tree->expandNode(path[d]); // pruned leaf, its other voxels keep their value
+        else
+          m_tree->createNodeChild(path[d], pos);
+      }
+      path[d + 1] = m_tree->getNodeChild(path[d], pos);
+    }
+
+    typename TreeT::NodeType* node = path[depth];
+    for (unsigned i = 0; i < 8; ++i){
+      if (m_tree->nodeChildExists(node, i))
+        m_tree->deleteNodeChild(node, i);
+    }
+    node->setLogOdds(logOdds);
+
+    for (int d = int(depth) - 1; d >= 0; --d)
+      path[d]->updateOccupancyChildren();
+  }
+
+  TreeT* m_tree;
+  ContributionMap m_contributions;
+  DirtySet m_dirty;
+  CountMap m_below;      // number of contributions strictly below a node, for the nodes from m_belowDepth on
+  unsigned m_belowDepth; // depth of the coarsest contribution added since clear() (MAX_DEPTH + 1: none)
+  size_t m_numAtDepth[MAX_DEPTH + 1];      // number of contributions per depth
+  size_t m_numDirtyAtDepth[MAX_DEPTH + 1]; // number of dirty nodes per depth
+};
+
+}
+
+#endif
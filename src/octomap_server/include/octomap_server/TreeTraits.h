@@ -0,0 +1,73 @@
+/**
+* TreeTraits: compile-time handling of the node payload (color) of the
+* tree types the octomap_server is instantiated with
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_TREETRAITS_H
+#define OCTOMAP_SERVER_TREETRAITS_H
+
+#include <pcl/point_types.h>
+#include <std_msgs/ColorRGBA.h>
+
+#include <octomap/octomap.h>
+#include <octomap/ColorOcTree.h>
+#include <octomap/OcTreeStamped.h>
+
+namespace octomap_server {
+
+template <class TreeT>
+struct TreeTraits {
+  static const bool hasColor = false;
+};
+
+template <>
+struct TreeTraits<octomap::ColorOcTree> {
+  static const bool hasColor = true;
+};
+
+/**
+ * Integrate the payload of an occupied scan endpoint at key into the node
+ * (nothing to do for the generic case, the occupancy is updated separately).
+ * Overloads for the specific tree / point types are picked at compile time.
+ */
+template <class TreeT, class PointT>
+inline void integrateEndpoint(TreeT& tree, const octomap::OcTreeKey& key, const PointT& point) {}
+
+inline void integrateEndpoint(octomap::ColorOcTree& tree, const octomap::OcTreeKey& key, const pcl::PointXYZRGB& point){
+  tree.averageNodeColor(key, point.r, point.g, point.b);
+}
+
+/// color of a node for visualization, false if the node has none
+template <class NodeT>
+inline bool nodeColor(const NodeT& node, std_msgs::ColorRGBA& color) { return false; }
+
+inline bool nodeColor(const octomap::ColorOcTreeNode& node, std_msgs::ColorRGBA& color){
+  const octomap::ColorOcTreeNode::Color& c = node.getColor();
+  color.r = c.r / 255.0;
+  color.g = c.g / 255.0;
+  color.b = c.b / 255.0;
+  color.a = 1.0;
+  return true;
+}
+
+/// point for a voxel center, with the node's color if both have one
+template <class NodeT, class PointT>
+inline void voxelPoint(const NodeT& node, double x, double y, double z, PointT& point){
+  point.x = x;
+  point.y = y;
+  point.z = z;
+}
+
+inline void voxelPoint(const octomap::ColorOcTreeNode& node, double x, double y, double z, pcl::PointXYZRGB& point){
+  point.x = x;
+  point.y = y;
+  point.z = z;
+  point.r = node.getColor().r;
+  point.g = node.getColor().g;
+  point.b = node.getColor().b;
+}
+
+}
+
+#endif
@@ -0,0 +1,61 @@
+/**
+* TreeUtils: helpers to build octrees from parts of other octrees
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_TREEUTILS_H
+#define OCTOMAP_SERVER_TREEUTILS_H
+
+#include <octomap/OcTreeKey.h>
+
+namespace octomap_server {
+
+/**
+ * Get the node at key and depth in tree, creating the path to it if needed.
+ * Any children of the node are deleted, so that it becomes a leaf.
+ */
+template <class TreeT>
+typename TreeT::NodeType* createLeafAtDepth(TreeT& tree, const octomap::OcTreeKey& key, unsigned depth){
+  typename TreeT::NodeType* node = tree.getRoot();
+  if (!node){
+    // there is no public way to create only the root, the path below is deleted again:
+    tree.setNodeValue(key, 0.0f, true);
+    node = tree.getRoot();
+  }
+
+  for (unsigned d = 0; d < depth; ++d){
+    unsigned pos = octomap::computeChildIdx(key, tree.getTreeDepth() - d - 1);
+    if (!tree.nodeChildExists(node, pos))
+      tree.createNodeChild(node, pos);
+
+    node = tree.getNodeChild(node, pos);
+  }
+
+  for (unsigned i = 0; i < 8; ++i){
+    if (tree.nodeChildExists(node, i))
+      tree.deleteNodeChild(node, i);
+  }
+
+  return node;
+}
+
+/**
+ * Copy all leafs of source within [minKey, maxKey] into dest, keeping their
+ * depth (pruned leafs are not expanded). dest should be empty and have the
+ * same resolution and tree depth as source.
+ */
+template <class TreeT>
+void copyLeafsBBX(const TreeT& source, const octomap::OcTreeKey& minKey, const octomap::OcTreeKey& maxKey, TreeT& dest){
+  for (typename TreeT::leaf_bbx_iterator it = source.begin_leafs_bbx(minKey, maxKey),
+       end = source.end_leafs_bbx(); it != end; ++it)
+  {
+    typename TreeT::NodeType* node = createLeafAtDepth(dest, it.getKey(), it.getDepth());
+    node->copyData(*it);
+  }
+
+  dest.updateInnerOccupancy();
+}
+
+}
+
+#endif
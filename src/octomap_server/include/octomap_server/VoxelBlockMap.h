@@ -0,0 +1,196 @@
+/**
+* VoxelBlockMap: hashed dense voxel blocks as scan integration backend of the
+* octomap_server
+* License: BSD
+*/
+
+#ifndef OCTOMAP_SERVER_VOXELBLOCKMAP_H
+#define OCTOMAP_SERVER_VOXELBLOCKMAP_H
+
+#include <octomap/octomap.h>
+#include <octomap/OcTreeKey.h>
+#include <octomap_msgs/Octomap.h>
+
+#include <stdint.h>
+
+namespace octomap_server {
+
+/**
+ * Log-odds occupancy of voxels in dense blocks of BLOCK_SIZE^3 voxels,
+ * hashed by their block coordinates (as in voxblox / VDB leaf nodes). A voxel
+ * is found with one hash lookup instead of the root-to-leaf walk of the
+ * octree, and consecutive accesses to the same block (neighboring voxels of
+ * a ray) skip even that. The sensor model and clamping are those of the
+ * octree the map is created for, so that integrating the same updates gives
+ * the same log-odds as OcTree::updateNode().
+ *
+ * Existing consumers get the map as OcTree through toOcTree() /
+ * toBinaryMsg(). Not thread-safe, also the const methods update the block
+ * cache.
+ */
+class VoxelBlockMap {
+
+public:
+  static const unsigned BLOCK_BITS = 3;
+  static const unsigned BLOCK_SIZE = 1 << BLOCK_BITS;
+  static const unsigned BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+  /// @param params tree with the resolution, sensor model and clamping to use
+  VoxelBlockMap(const octomap::AbstractOccupancyOcTree& params);
+  ~VoxelBlockMap();
+
+  /// takes over the sensor model, clamping and occupancy threshold of params (e.g. after reconfiguring it)
+  void setSensorModel(const octomap::AbstractOccupancyOcTree& params);
+
+  /**
+   * Integrates a hit (occupied) or a miss at key, the new log-odds are returned
+   * in logOdds. Returns true if the occupancy state (unknown, free, occupied)
+   * of the voxel changed.
+   */
+  bool update(const octomap::OcTreeKey& key, bool occupied, float& logOdds){
+    return update(key, occupied ? m_hitLogOdds : m_missLogOdds, logOdds);
+  }
+  bool update(const octomap::OcTreeKey& key, float logOddsChange, float& logOdds);
+
+  /// log-odds of the voxel at key, false if it is unknown
+  bool search(const octomap::OcTreeKey& key, float& logOdds) const;
+
+  bool isOccupied(float logOdds) const { return logOdds >= m_occupancyThres; }
+
+  /**
+   * Sets the known voxels in the key box [min, max] to clearLogOdds, or to
+   * unknown if toUnknown (unknown voxels stay unknown, as in the octree).
+   * Blocks without known voxels are freed.
+   */
+  void clearBox(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max, bool toUnknown, float clearLogOdds);
+
+  void clear();
+
+  /// replaces the content with the leafs of tree (pruned leafs are expanded)
+  template <class TreeT>
+  void fromOcTree(const TreeT& tree);
+
+  /// replaces the content of tree with the known voxels, with inner nodes and pruning as after updateNode()
+  template <class TreeT>
+  void toOcTree(TreeT& tree) const;
+
+  /// the map as binary octomap message (occupied / free), as a binary OcTree would give it
+  bool toBinaryMsg(octomap_msgs::Octomap& msg) const;
+
+  size_t numBlocks() const { return m_blocks.size(); }
+  size_t numVoxels() const { return m_numVoxels; }
+  size_t memoryUsage() const;
+  double getResolution() const { return m_resolution; }
+
+protected:
+  struct Block {
+    float logOdds[BLOCK_VOXELS];
+    uint64_t known[BLOCK_VOXELS / 64]; // bit set for each known voxel
+    unsigned numKnown;
+
+    Block() : numKnown(0) {
+      for (unsigned i = 0; i < BLOCK_VOXELS / 64; ++i)
+        known[i] = 0;
+    }
+
+    bool isKnown(unsigned i) const { return (known[i >> 6] >> (i & 63)) & 1; }
+  };
+
+  typedef unordered_ns::unordered_map<uint64_t, Block*> BlockMap;
+
+  /// block coordinates of key packed into 3x13 bits
+  static uint64_t blockIndex(const octomap::OcTreeKey& key){
+    const unsigned shift = 16 - BLOCK_BITS;
+    return (uint64_t(key[0] >> BLOCK_BITS))
+        | (uint64_t(key[1] >> BLOCK_BITS) << shift)
+        | (uint64_t(key[2] >> BLOCK_BITS) << (2 * shift));
+  }
+
+  /// first key of the block with index blockIndex()
+  static octomap::OcTreeKey blockKey(uint64_t index){
+    const unsigned shift = 16 - BLOCK_BITS;
+    return octomap::OcTreeKey(octomap::key_type(index << BLOCK_BITS),
+                              octomap::key_type((index >> shift) << BLOCK_BITS),
+                              octomap::key_type((index >> (2 * shift)) << BLOCK_BITS));
+  }
+
+  /// index of key within its block
+  static unsigned voxelIndex(const octomap::OcTreeKey& key){
+    const unsigned mask = BLOCK_SIZE - 1;
+    return (key[0] & mask) | ((key[1] & mask) << BLOCK_BITS) | ((key[2] & mask) << (2 * BLOCK_BITS));
+  }
+
+  /// key of voxel i in the block containing blockKey
+  static octomap::OcTreeKey voxelKey(const octomap::OcTreeKey& blockKey, unsigned i){
+    const unsigned mask = BLOCK_SIZE - 1;
+    const octomap::key_type base = ~octomap::key_type(mask);
+    return octomap::OcTreeKey((blockKey[0] & base) | (i & mask),
+                              (blockKey[1] & base) | ((i >> BLOCK_BITS) & mask),
+                              (blockKey[2] & base) | ((i >> (2 * BLOCK_BITS)) & mask));
+  }
+
+  /// block of key, created if create is set (NULL otherwise if there is none)
+  Block* findBlock(const octomap::OcTreeKey& key, bool create) const;
+
+  void setVoxel(Block* block, unsigned i, float logOdds);
+  void eraseVoxel(Block* block, unsigned i);
+
+  /// clearBox() for the existing block with index, which is deleted if it has no known voxels left
+  void clearBlock(uint64_t index, Block* block, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max,
+                  bool toUnknown, float clearLogOdds);
+
+  mutable BlockMap m_blocks;
+  mutable uint64_t m_lastIndex; // cache of the last accessed block
+  mutable Block* m_lastBlock;
+  size_t m_numVoxels;
+
+  double m_resolution;
+  float m_hitLogOdds;
+  float m_missLogOdds;
+  float m_clampingMin;
+  float m_clampingMax;
+  float m_occupancyThres;
+};
+
+template <class TreeT>
+void VoxelBlockMap::fromOcTree(const TreeT& tree){
+  clear();
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (typename TreeT::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it){
+    octomap::OcTreeKey leafKey = it.getIndexKey();
+    unsigned width = 1 << (treeDepth - it.getDepth());
+    float logOdds = it->getLogOdds();
+    octomap::OcTreeKey key;
+    for (unsigned dz = 0; dz < width; ++dz){
+      key[2] = leafKey[2] + dz;
+      for (unsigned dy = 0; dy < width; ++dy){
+        key[1] = leafKey[1] + dy;
+        for (unsigned dx = 0; dx < width; ++dx){
+          key[0] = leafKey[0] + dx;
+          setVoxel(findBlock(key, true), voxelIndex(key), logOdds);
+        }
+      }
+    }
+  }
+}
+
+template <class TreeT>
+void VoxelBlockMap::toOcTree(TreeT& tree) const{
+  tree.clear();
+  for (BlockMap::const_iterator it = m_blocks.begin(); it != m_blocks.end(); ++it){
+    const Block& block = *it->second;
+    octomap::OcTreeKey firstKey = blockKey(it->first);
+    for (unsigned i = 0; i < BLOCK_VOXELS; ++i){
+      if (block.isKnown(i))
+        tree.setNodeValue(voxelKey(firstKey, i), block.logOdds[i], true);
+    }
+  }
+
+  // lazy insertion, the inner nodes are computed once for the whole tree:
+  tree.updateInnerOccupancy();
+  tree.prune();
+}
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+* ChunkMesher: greedy-meshed occupied voxels in spatial chunks for the
+* octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/ChunkMesher.h>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+ChunkMesher::ChunkMesher(unsigned chunkSize)
+: m_chunkBits(0),
+  m_nextId(0),
+  m_minZ(-std::numeric_limits<double>::max()),
+  m_maxZ(std::numeric_limits<double>::max()),
+  m_filterSpeckles(false)
+{
+  while ((1u << m_chunkBits) < chunkSize && m_chunkBits < 16)
+    m_chunkBits++;
+  m_chunkSize = 1 << m_chunkBits;
+}
+
+void ChunkMesher::markTouched(const KeySet& keys){
+  unsigned min[3], max[3];
+  for (KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it){
+    for (unsigned i = 0; i < 3; ++i){
+      min[i] = (*it)[i];
+      max[i] = (*it)[i];
+    }
+    markRange(min, max);
+  }
+}
+
+void ChunkMesher::markTouched(const std::vector<OcTreeKey>& keys){
+  unsigned min[3], max[3];
+  for (unsigned k = 0; k < keys.size(); ++k){
+    for (unsigned i = 0; i < 3; ++i){
+      min[i] = keys[k][i];
+      max[i] = keys[k][i];
+    }
+    markRange(min, max);
+  }
+}
+
+void ChunkMesher::markBox(const OcTreeKey& min, const OcTreeKey& max){
+  unsigned boxMin[3], boxMax[3];
+  for (unsigned i = 0; i < 3; ++i){
+    boxMin[i] = min[i];
+    boxMax[i] = max[i];
+  }
+  markRange(boxMin, boxMax);
+}
+
+void ChunkMesher::markRange(const unsigned min[3], const unsigned max[3]){
+  const unsigned maxKey = std::numeric_limits<key_type>::max();
+  unsigned lo[3], hi[3];
+  for (unsigned i = 0; i < 3; ++i){
+    lo[i] = (min[i] >= unsigned(s_margin) ? min[i] - s_margin : 0) >> m_chunkBits;
+    hi[i] = std::min(max[i] + s_margin, maxKey) >> m_chunkBits;
+  }
+
+  for (unsigned z = lo[2]; z <= hi[2]; ++z){
+    for (unsigned y = lo[1]; y <= hi[1]; ++y){
+      for (unsigned x = lo[0]; x <= hi[0]; ++x)
+        m_dirty.insert(chunkIndex(x << m_chunkBits, y << m_chunkBits, z << m_chunkBits));
+    }
+  }
+}
+
+void ChunkMesher::meshChunk(const std::vector<char>& solid, const double origin[3], double resolution,
+                            std::vector<geometry_msgs::Point>& triangles) const
+{
+  const int n = m_chunkSize;
+  const int gridSize = n + 2;
+  std::vector<char> mask(n * n);
+
+  for (unsigned d = 0; d < 3; ++d){
+    const unsigned u = (d + 1) % 3;
+    const unsigned v = (d + 2) % 3;
+    int step[3] = {0, 0, 0};
+
+    for (int side = 0; side < 2; ++side){
+      step[d] = side ? 1 : -1;
+      const int offset = step[0] + gridSize * (step[1] + gridSize * step[2]);
+
+      for (int slice = 0; slice < n; ++slice){
+        // visible faces: occupied voxel with a free neighbor in the face direction
+        int p[3];
+        p[d] = slice + 1;
+        for (int j = 0; j < n; ++j){
+          p[v] = j + 1;
+          for (int i = 0; i < n; ++i){
+            p[u] = i + 1;
+            int idx = p[0] + gridSize * (p[1] + gridSize * p[2]);
+            mask[i + j * n] = solid[idx] && !solid[idx + offset];
+          }
+        }
+
+        // greedy merging: widest run along u, then as many rows along v as fit
+        for (int j = 0; j < n; ++j){
+          for (int i = 0; i < n;){
+            if (!mask[i + j * n]){
+              ++i;
+              continue;
+            }
+
+            int w = 1;
+            while (i + w < n && mask[i + w + j * n])
+              ++w;
+
+            int h = 1;
+            for (; j + h < n; ++h){
+              bool fullRow = true;
+              for (int k = 0; k < w && fullRow; ++k)
+                fullRow = mask[i + k + (j + h) * n];
+              if (!fullRow)
+                break;
+            }
+
+            addQuad(d, u, v, side != 0, slice, i, j, w, h, origin, resolution, triangles);
+
+            for (int y = j; y < j + h; ++y)
+              std::fill(mask.begin() + i + y * n, mask.begin() + i + w + y * n, 0);
+            i += w;
+          }
+        }
+      }
+    }
+  }
+}
+
+void ChunkMesher::addQuad(unsigned d, unsigned u, unsigned v, bool positive, int slice, int i, int j, int w, int h,
+                          const double origin[3], double resolution, std::vector<geometry_msgs::Point>& triangles) const
+{
+  // corners counter-clockwise around +d (u x v = d), the far face of the voxels for the positive side:
+  const int cu[4] = {i, i + w, i + w, i};
+  const int cv[4] = {j, j, j + h, j + h};
+  geometry_msgs::Point corners[4];
+  for (unsigned c = 0; c < 4; ++c){
+    double q[3];
+    q[d] = slice + (positive ? 1 : 0);
+    q[u] = cu[c];
+    q[v] = cv[c];
+    corners[c].x = origin[0] + q[0] * resolution;
+    corners[c].y = origin[1] + q[1] * resolution;
+    corners[c].z = origin[2] + q[2] * resolution;
+  }
+
+  // outward facing: keep the order for +d, reverse it for -d
+  const unsigned order[2][6] = {{0, 2, 1, 0, 3, 2}, {0, 1, 2, 0, 2, 3}};
+  for (unsigned c = 0; c < 6; ++c)
+    triangles.push_back(corners[order[positive ? 1 : 0][c]]);
+}
+
+visualization_msgs::Marker ChunkMesher::chunkMarker(const std::string& frameId, const ros::Time& stamp,
+                                                    const std_msgs::ColorRGBA& color) const
+{
+  visualization_msgs::Marker marker;
+  marker.header.frame_id = frameId;
+  marker.header.stamp = stamp;
+  marker.ns = "occupied_mesh";
+  marker.type = visualization_msgs::Marker::TRIANGLE_LIST;
+  marker.action = visualization_msgs::Marker::ADD;
+  marker.pose.orientation.w = 1.0;
+  marker.scale.x = 1.0;
+  marker.scale.y = 1.0;
+  marker.scale.z = 1.0;
+  marker.color = color;
+  return marker;
+}
+
+void ChunkMesher::getChangedMarkers(visualization_msgs::MarkerArray& markers, const std::string& frameId, const ros::Time& stamp,
+                                    const std_msgs::ColorRGBA& color)
+{
+  visualization_msgs::Marker marker = chunkMarker(frameId, stamp, color);
+  marker.action = visualization_msgs::Marker::DELETE;
+  for (unsigned i = 0; i < m_deleted.size(); ++i){
+    marker.id = m_deleted[i];
+    markers.markers.push_back(marker);
+  }
+
+  marker.action = visualization_msgs::Marker::ADD;
+  for (std::set<uint64_t>::const_iterator it = m_changed.begin(); it != m_changed.end(); ++it){
+    const Chunk& chunk = m_chunks.find(*it)->second;
+    marker.id = chunk.id;
+    markers.markers.push_back(marker);
+    markers.markers.back().points = chunk.triangles;
+  }
+
+  m_deleted.clear();
+  m_changed.clear();
+}
+
+void ChunkMesher::getAllMarkers(visualization_msgs::MarkerArray& markers, const std::string& frameId, const ros::Time& stamp,
+                                const std_msgs::ColorRGBA& color) const
+{
+  visualization_msgs::Marker marker = chunkMarker(frameId, stamp, color);
+  for (ChunkMap::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it){
+    marker.id = it->second.id;
+    markers.markers.push_back(marker);
+    markers.markers.back().points = it->second.triangles;
+  }
+}
+
+void ChunkMesher::clear(){
+  for (ChunkMap::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    m_deleted.push_back(it->second.id);
+  m_chunks.clear();
+  m_dirty.clear();
+  m_changed.clear();
+}
+
+}
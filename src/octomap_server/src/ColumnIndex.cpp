@@ -0,0 +1,73 @@
+/**
+* ColumnIndex: incremental 2.5D summary of the (x,y) columns of an octree
+* License: BSD
+*/
+
+#include <octomap_server/ColumnIndex.h>
+
+using namespace octomap;
+
+namespace {
+
+inline bool runEndLess(const octomap_server::ColumnIndex::Run& a, const octomap_server::ColumnIndex::Run& b){
+  return a.second < b.second;
+}
+
+}
+
+namespace octomap_server{
+
+ColumnIndex::Column::Column()
+: minOccupied(std::numeric_limits<key_type>::max()), maxOccupied(0),
+  minKnown(std::numeric_limits<key_type>::max()), maxKnown(0)
+{
+}
+
+void ColumnIndex::markDirty(const KeySet& keys){
+  for (KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    m_dirty.insert(columnKey((*it)[0], (*it)[1]));
+}
+
+void ColumnIndex::markDirty(const OcTreeKey& min, const OcTreeKey& max){
+  for (unsigned x = min[0]; x <= max[0]; ++x){
+    for (unsigned y = min[1]; y <= max[1]; ++y)
+      m_dirty.insert(columnKey(x, y));
+  }
+}
+
+void ColumnIndex::clear(){
+  m_columns.clear();
+  m_dirty.clear();
+  m_changed.clear();
+}
+
+void ColumnIndex::mergeRuns(std::vector<Run>& runs){
+  std::sort(runs.begin(), runs.end());
+  unsigned last = 0;
+  for (unsigned i = 1; i < runs.size(); ++i){
+    if (unsigned(runs[i].first) <= unsigned(runs[last].second) + 1)
+      runs[last].second = std::max(runs[last].second, runs[i].second);
+    else
+      runs[++last] = runs[i];
+  }
+  runs.resize(last + 1);
+}
+
+bool ColumnIndex::overlaps(const std::vector<Run>& runs, key_type lo, key_type hi){
+  // first run ending at or above lo:
+  std::vector<Run>::const_iterator it = std::lower_bound(runs.begin(), runs.end(), Run(0, lo), runEndLess);
+  return it != runs.end() && it->first <= hi;
+}
+
+int8_t ColumnIndex::classify(const Column& column, key_type lo, key_type hi){
+  if (lo > hi)
+    return -1;
+  if (overlaps(column.occupiedRuns, lo, hi))
+    return 100;
+  if (overlaps(column.knownRuns, lo, hi))
+    return 0;
+
+  return -1;
+}
+
+}
@@ -0,0 +1,74 @@
+/**
+* DecayQueue: time-bucketed expiry of occupied voxels for the octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/DecayQueue.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+DecayQueue::DecayQueue(double bucketWidth)
+: m_bucketWidth(std::max(bucketWidth, 1e-3))
+{
+}
+
+long DecayQueue::bucket(double time) const{
+  return long(std::floor(time / m_bucketWidth));
+}
+
+void DecayQueue::schedule(const KeySet& keys, double expiry){
+  long b = bucket(expiry);
+  std::vector<OcTreeKey>* entries = NULL;
+  for (KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it){
+    std::pair<ExpiryMap::iterator, bool> inserted = m_expiry.insert(std::make_pair(*it, b));
+    if (!inserted.second){
+      if (inserted.first->second == b)
+        continue; // already in this bucket
+      inserted.first->second = b;
+    }
+
+    if (!entries)
+      entries = &m_buckets[b];
+    entries->push_back(*it);
+  }
+}
+
+void DecayQueue::schedule(const OcTreeKey& key, double expiry){
+  long b = bucket(expiry);
+  std::pair<ExpiryMap::iterator, bool> inserted = m_expiry.insert(std::make_pair(key, b));
+  if (!inserted.second){
+    if (inserted.first->second == b)
+      return;
+    inserted.first->second = b;
+  }
+
+  m_buckets[b].push_back(key);
+}
+
+void DecayQueue::popExpired(double time, std::vector<OcTreeKey>& expired){
+  long due = bucket(time);
+  while (!m_buckets.empty() && m_buckets.begin()->first < due){
+    const std::vector<OcTreeKey>& entries = m_buckets.begin()->second;
+    for (unsigned i = 0; i < entries.size(); ++i){
+      // skip entries that were rescheduled to a later bucket:
+      ExpiryMap::iterator it = m_expiry.find(entries[i]);
+      if (it != m_expiry.end() && it->second == m_buckets.begin()->first){
+        expired.push_back(entries[i]);
+        m_expiry.erase(it);
+      }
+    }
+    m_buckets.erase(m_buckets.begin());
+  }
+}
+
+void DecayQueue::clear(){
+  m_expiry.clear();
+  m_buckets.clear();
+}
+
+}
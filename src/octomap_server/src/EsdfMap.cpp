@@ -0,0 +1,161 @@
+/**
+* EsdfMap: incrementally updated Euclidean distance field for the octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/EsdfMap.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+EsdfMap::EsdfMap(double resolution, double maxDistance)
+: m_resolution(resolution),
+  m_maxDistance(maxDistance),
+  m_maxDistanceVoxels(maxDistance / resolution)
+{
+}
+
+void EsdfMap::setObstacle(const OcTreeKey& key){
+  if (!m_obstacles.insert(key).second)
+    return;
+
+  Cell& cell = m_cells[key];
+  cell.obstacle = key;
+  cell.distance = 0.0f;
+  cell.raise = false;
+  m_open.push(QueueEntry(0.0f, key));
+}
+
+void EsdfMap::removeObstacle(const OcTreeKey& key){
+  if (m_obstacles.erase(key) == 0)
+    return;
+
+  Cell& cell = m_cells[key];
+  cell.distance = std::numeric_limits<float>::max();
+  cell.raise = true;
+  m_open.push(QueueEntry(0.0f, key));
+  m_cleared.push_back(key);
+}
+
+void EsdfMap::update(){
+  while (!m_open.empty()){
+    QueueEntry entry = m_open.top();
+    m_open.pop();
+
+    CellMap::iterator it = m_cells.find(entry.key);
+    if (it == m_cells.end())
+      continue;
+
+    if (it->second.raise){
+      raise(entry.key);
+    } else if (isObstacle(it->second.obstacle) && entry.distance <= it->second.distance){
+      // skip outdated queue entries, the cell was lowered in the meantime
+      lower(entry.key, it->second);
+    }
+  }
+
+  // cells that were cleared and not reached again are out of range:
+  for (unsigned i = 0; i < m_cleared.size(); ++i){
+    CellMap::iterator it = m_cells.find(m_cleared[i]);
+    if (it != m_cells.end() && it->second.distance > m_maxDistanceVoxels)
+      m_cells.erase(it);
+  }
+  m_cleared.clear();
+}
+
+void EsdfMap::raise(const OcTreeKey& key){
+  OcTreeKey nKey;
+  for (int dz = -1; dz <= 1; ++dz){
+    nKey[2] = key[2] + dz;
+    for (int dy = -1; dy <= 1; ++dy){
+      nKey[1] = key[1] + dy;
+      for (int dx = -1; dx <= 1; ++dx){
+        nKey[0] = key[0] + dx;
+        if (nKey == key)
+          continue;
+
+        CellMap::iterator it = m_cells.find(nKey);
+        if (it == m_cells.end() || it->second.raise)
+          continue;
+
+        Cell& neighbor = it->second;
+        if (!isObstacle(neighbor.obstacle)){
+          // neighbor was closest to a removed obstacle => clear it as well
+          neighbor.distance = std::numeric_limits<float>::max();
+          neighbor.raise = true;
+          m_open.push(QueueEntry(0.0f, nKey));
+          m_cleared.push_back(nKey);
+        } else {
+          // valid neighbor => propagate into the cleared area from here
+          m_open.push(QueueEntry(neighbor.distance, nKey));
+        }
+      }
+    }
+  }
+
+  m_cells[key].raise = false;
+}
+
+void EsdfMap::lower(const OcTreeKey& key, const Cell& cell){
+  const OcTreeKey obstacle = cell.obstacle;
+  OcTreeKey nKey;
+  for (int dz = -1; dz <= 1; ++dz){
+    nKey[2] = key[2] + dz;
+    for (int dy = -1; dy <= 1; ++dy){
+      nKey[1] = key[1] + dy;
+      for (int dx = -1; dx <= 1; ++dx){
+        nKey[0] = key[0] + dx;
+        if (nKey == key)
+          continue;
+
+        float distance = keyDistance(nKey, obstacle);
+        if (distance > m_maxDistanceVoxels)
+          continue;
+
+        CellMap::iterator it = m_cells.find(nKey);
+        if (it == m_cells.end()){
+          Cell& neighbor = m_cells[nKey];
+          neighbor.obstacle = obstacle;
+          neighbor.distance = distance;
+          m_open.push(QueueEntry(distance, nKey));
+        } else if (!it->second.raise && distance < it->second.distance){
+          it->second.obstacle = obstacle;
+          it->second.distance = distance;
+          m_open.push(QueueEntry(distance, nKey));
+        }
+      }
+    }
+  }
+}
+
+void EsdfMap::clear(){
+  m_cells.clear();
+  m_obstacles.clear();
+  m_cleared.clear();
+  m_open = Queue();
+}
+
+float EsdfMap::getDistance(const OcTreeKey& key) const{
+  CellMap::const_iterator it = m_cells.find(key);
+  if (it == m_cells.end() || it->second.distance > m_maxDistanceVoxels)
+    return m_maxDistance;
+
+  return it->second.distance * m_resolution;
+}
+
+float EsdfMap::getDistanceAndGradient(const OcTreeKey& key, point3d& gradient) const{
+  for (unsigned i = 0; i < 3; ++i){
+    OcTreeKey lower(key), upper(key);
+    --lower[i];
+    ++upper[i];
+    gradient(i) = (getDistance(upper) - getDistance(lower)) / (2.0 * m_resolution);
+  }
+
+  return getDistance(key);
+}
+
+}
@@ -0,0 +1,276 @@
+/**
+* FrontierTracker: incremental frontier extraction and clustering for the
+* octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/FrontierTracker.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+const int FrontierTracker::s_faceNeighbors[6][3] = {
+  {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}
+};
+
+FrontierTracker::FrontierTracker()
+: m_nextClusterId(0),
+  m_changed(false)
+{
+}
+
+void FrontierTracker::markTouched(const KeySet& keys){
+  m_touched.insert(keys.begin(), keys.end());
+}
+
+void FrontierTracker::markLeafBoundary(const OcTreeKey& indexKey, unsigned width){
+  // only voxels on the faces of a leaf can border unknown space:
+  OcTreeKey key;
+  for (unsigned dz = 0; dz < width; ++dz){
+    key[2] = indexKey[2] + dz;
+    bool zFace = (dz == 0 || dz == width - 1);
+    for (unsigned dy = 0; dy < width; ++dy){
+      key[1] = indexKey[1] + dy;
+      bool yFace = (dy == 0 || dy == width - 1);
+      for (unsigned dx = 0; dx < width; ++dx){
+        bool xFace = (dx == 0 || dx == width - 1);
+        if (!xFace && !yFace && !zFace){
+          dx = width - 2; // skip to the opposite face
+          continue;
+        }
+        key[0] = indexKey[0] + dx;
+        m_touched.insert(key);
+      }
+    }
+  }
+}
+
+void FrontierTracker::markBoxShell(const OcTreeKey& min, const OcTreeKey& max){
+  // one face layer per side and axis, unless the box touches the map bounds there:
+  for (unsigned a = 0; a < 3; ++a){
+    const unsigned b = (a + 1) % 3, c = (a + 2) % 3;
+    for (int side = 0; side < 2; ++side){
+      if (side == 0 ? min[a] == 0 : max[a] == std::numeric_limits<key_type>::max())
+        continue;
+
+      OcTreeKey key;
+      key[a] = (side == 0) ? min[a] - 1 : max[a] + 1;
+      for (unsigned i = min[b]; i <= max[b]; ++i){
+        key[b] = i;
+        for (unsigned j = min[c]; j <= max[c]; ++j){
+          key[c] = j;
+          m_touched.insert(key);
+        }
+      }
+    }
+  }
+}
+
+void FrontierTracker::clear(){
+  m_touched.clear();
+  m_frontiers.clear();
+  m_clusters.clear();
+  m_changed = true;
+}
+
+void FrontierTracker::updateClusters(const std::vector<OcTreeKey>& added, const std::vector<OcTreeKey>& removed){
+  for (unsigned i = 0; i < removed.size(); ++i){
+    KeyClusterMap::iterator it = m_frontiers.find(removed[i]);
+    m_clusters[it->second].erase(removed[i]);
+    m_frontiers.erase(it);
+  }
+
+  // clusters that lost voxels may split, only their voxels around the removed ones can be cut off:
+  std::map<unsigned, KeySet> splitSeeds;
+  OcTreeKey nKey;
+  for (unsigned i = 0; i < removed.size(); ++i){
+    for (int dz = -1; dz <= 1; ++dz){
+      nKey[2] = removed[i][2] + dz;
+      for (int dy = -1; dy <= 1; ++dy){
+        nKey[1] = removed[i][1] + dy;
+        for (int dx = -1; dx <= 1; ++dx){
+          nKey[0] = removed[i][0] + dx;
+          KeyClusterMap::const_iterator it = m_frontiers.find(nKey);
+          if (it != m_frontiers.end())
+            splitSeeds[it->second].insert(nKey);
+        }
+      }
+    }
+  }
+  for (ClusterMap::iterator it = m_clusters.begin(); it != m_clusters.end();){
+    if (it->second.empty())
+      m_clusters.erase(it++);
+    else
+      ++it;
+  }
+  for (std::map<unsigned, KeySet>::const_iterator it = splitSeeds.begin(); it != splitSeeds.end(); ++it)
+    splitCluster(it->first, it->second);
+
+  // new voxels join the clusters next to them, merging them into the largest one:
+  const unsigned unassigned = std::numeric_limits<unsigned>::max();
+  for (unsigned i = 0; i < added.size(); ++i)
+    m_frontiers[added[i]] = unassigned;
+
+  std::vector<OcTreeKey> open, component;
+  for (unsigned i = 0; i < added.size(); ++i){
+    if (m_frontiers[added[i]] != unassigned)
+      continue;
+
+    // connected new voxels and the clusters they touch:
+    std::set<unsigned> neighbors;
+    component.clear();
+    m_frontiers[added[i]] = unassigned - 1;
+    open.push_back(added[i]);
+    while (!open.empty()){
+      OcTreeKey key = open.back();
+      open.pop_back();
+      component.push_back(key);
+
+      for (int dz = -1; dz <= 1; ++dz){
+        nKey[2] = key[2] + dz;
+        for (int dy = -1; dy <= 1; ++dy){
+          nKey[1] = key[1] + dy;
+          for (int dx = -1; dx <= 1; ++dx){
+            nKey[0] = key[0] + dx;
+            KeyClusterMap::iterator it = m_frontiers.find(nKey);
+            if (it == m_frontiers.end() || it->second == unassigned - 1)
+              continue;
+
+            if (it->second == unassigned){
+              it->second = unassigned - 1;
+              open.push_back(nKey);
+            } else
+              neighbors.insert(it->second);
+          }
+        }
+      }
+    }
+
+    unsigned id = m_nextClusterId;
+    size_t largest = 0;
+    for (std::set<unsigned>::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n){
+      if (m_clusters[*n].size() > largest){
+        largest = m_clusters[*n].size();
+        id = *n;
+      }
+    }
+    if (id == m_nextClusterId)
+      m_nextClusterId++;
+
+    for (std::set<unsigned>::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n){
+      if (*n != id){
+        KeySet voxels;
+        voxels.swap(m_clusters[*n]);
+        moveVoxels(voxels, *n, id);
+      }
+    }
+
+    KeySet& cluster = m_clusters[id];
+    for (unsigned j = 0; j < component.size(); ++j){
+      m_frontiers[component[j]] = id;
+      cluster.insert(component[j]);
+    }
+  }
+
+  m_changed = true;
+}
+
+void FrontierTracker::splitCluster(unsigned id, const KeySet& seeds){
+  ClusterMap::iterator cluster = m_clusters.find(id);
+  if (cluster == m_clusters.end())
+    return;
+
+  // flood from one seed after the other; once all seeds are reached, the current part is the rest of the cluster:
+  KeySet visited;
+  std::vector<KeySet> parts;
+  size_t seedsLeft = seeds.size();
+  bool rest = false;
+  std::vector<OcTreeKey> open;
+  OcTreeKey nKey;
+  for (KeySet::const_iterator seed = seeds.begin(); seed != seeds.end() && !rest; ++seed){
+    if (!visited.insert(*seed).second)
+      continue;
+
+    parts.push_back(KeySet());
+    KeySet& part = parts.back();
+    part.insert(*seed);
+    seedsLeft--;
+    open.assign(1, *seed);
+    while (!open.empty() && !rest){
+      OcTreeKey key = open.back();
+      open.pop_back();
+
+      for (int dz = -1; dz <= 1; ++dz){
+        nKey[2] = key[2] + dz;
+        for (int dy = -1; dy <= 1; ++dy){
+          nKey[1] = key[1] + dy;
+          for (int dx = -1; dx <= 1; ++dx){
+            nKey[0] = key[0] + dx;
+            if (cluster->second.find(nKey) == cluster->second.end() || !visited.insert(nKey).second)
+              continue;
+
+            part.insert(nKey);
+            open.push_back(nKey);
+            if (seeds.find(nKey) != seeds.end())
+              seedsLeft--;
+          }
+        }
+      }
+      rest = (seedsLeft == 0 && !open.empty());
+    }
+  }
+
+  if (parts.size() < 2)
+    return; // still connected
+
+  // the largest part keeps the id (the rest is what the complete parts leave):
+  std::vector<size_t> sizes(parts.size());
+  size_t completeSize = 0;
+  for (unsigned i = 0; i < parts.size(); ++i){
+    sizes[i] = parts[i].size();
+    if (!rest || i + 1 < parts.size())
+      completeSize += sizes[i];
+  }
+  if (rest)
+    sizes.back() = cluster->second.size() - completeSize;
+
+  unsigned largest = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
+  for (unsigned i = 0; i < parts.size(); ++i){
+    if (i == largest || (rest && i + 1 == parts.size()))
+      continue;
+
+    for (KeySet::const_iterator it = parts[i].begin(); it != parts[i].end(); ++it)
+      cluster->second.erase(*it);
+    moveVoxels(parts[i], id, m_nextClusterId++);
+  }
+
+  if (rest && largest + 1 != parts.size()){
+    // the rest moves away instead of the largest complete part:
+    KeySet voxels;
+    for (KeySet::const_iterator it = cluster->second.begin(); it != cluster->second.end(); ++it){
+      if (parts[largest].find(*it) == parts[largest].end())
+        voxels.insert(*it);
+    }
+    for (KeySet::const_iterator it = voxels.begin(); it != voxels.end(); ++it)
+      cluster->second.erase(*it);
+    moveVoxels(voxels, id, m_nextClusterId++);
+  }
+}
+
+void FrontierTracker::moveVoxels(const KeySet& voxels, unsigned from, unsigned into){
+  KeySet& cluster = m_clusters[into];
+  for (KeySet::const_iterator it = voxels.begin(); it != voxels.end(); ++it){
+    m_frontiers[*it] = into;
+    cluster.insert(*it);
+  }
+  ClusterMap::iterator old = m_clusters.find(from);
+  if (old != m_clusters.end() && old->second.empty())
+    m_clusters.erase(old);
+}
+
+}
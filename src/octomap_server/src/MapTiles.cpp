@@ -0,0 +1,125 @@
+/**
+* MapTiles: multi-resolution tiles of a static octree for the
+* octomap_server_static
+* License: BSD
+*/
+
+#include <octomap_server/MapTiles.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+// tile indices are relative to the map origin, which is at the key center:
+static const int s_numKeys = int(std::numeric_limits<key_type>::max()) + 1;
+
+MapTiles::MapTiles(double resolution, unsigned tileKeys, unsigned numLevels)
+: m_tileBits(0),
+  m_resolution(resolution)
+{
+  const unsigned maxBits = 16;
+  while ((1u << m_tileBits) < tileKeys && m_tileBits < maxBits)
+    m_tileBits++;
+  m_numLevels = std::max(1u, std::min(numLevels, maxBits + 1 - m_tileBits));
+  m_tiles.resize(m_numLevels);
+}
+
+bool MapTiles::getTile(int x, int y, int z, unsigned level, octomap_msgs::Octomap& msg) const{
+  if (level >= m_numLevels)
+    return false;
+
+  const unsigned bits = tileBits(level);
+  const int index[3] = {x + (s_numKeys / 2 >> bits), y + (s_numKeys / 2 >> bits), z + (s_numKeys / 2 >> bits)};
+  uint64_t id = 0;
+  for (unsigned i = 0; i < 3; ++i){
+    if (index[i] < 0 || index[i] >= (s_numKeys >> bits))
+      return false;
+    id |= uint64_t(index[i]) << (16 * i);
+  }
+
+  TileMap::const_iterator it = m_tiles[level].find(id);
+  if (it == m_tiles[level].end())
+    return false;
+
+  msg = it->second;
+  return true;
+}
+
+void MapTiles::getTileIndices(unsigned level, std::vector<int>& x, std::vector<int>& y, std::vector<int>& z) const{
+  x.clear();
+  y.clear();
+  z.clear();
+  if (level >= m_numLevels)
+    return;
+
+  const int center = s_numKeys / 2 >> tileBits(level);
+  for (TileMap::const_iterator it = m_tiles[level].begin(); it != m_tiles[level].end(); ++it){
+    x.push_back(int(it->first & 0xFFFF) - center);
+    y.push_back(int((it->first >> 16) & 0xFFFF) - center);
+    z.push_back(int((it->first >> 32) & 0xFFFF) - center);
+  }
+}
+
+size_t MapTiles::numTiles() const{
+  size_t num = 0;
+  for (unsigned level = 0; level < m_tiles.size(); ++level)
+    num += m_tiles[level].size();
+  return num;
+}
+
+size_t MapTiles::memoryUsage() const{
+  size_t bytes = 0;
+  for (unsigned level = 0; level < m_tiles.size(); ++level){
+    for (TileMap::const_iterator it = m_tiles[level].begin(); it != m_tiles[level].end(); ++it)
+      bytes += it->second.data.size();
+  }
+  return bytes;
+}
+
+void MapTiles::clear(){
+  for (unsigned level = 0; level < m_tiles.size(); ++level)
+    m_tiles[level].clear();
+}
+
+OcTree* MapTiles::tileTree(TreeMap& trees, const OcTreeKey& key, unsigned level) const{
+  uint64_t id = tileId(key, level);
+  TreeMap::iterator it = trees.find(id);
+  if (it == trees.end())
+    it = trees.insert(std::make_pair(id, new OcTree(m_resolution))).first;
+  return it->second;
+}
+
+void MapTiles::setNode(OcTree& tree, const OcTreeKey& key, unsigned depth, float logOdds){
+  const unsigned treeDepth = tree.getTreeDepth();
+  OcTreeNode* node = tree.getRoot();
+  if (!node){
+    // the root is created by the tree itself, its path down to key is cut again:
+    tree.setNodeValue(key, logOdds, true);
+    node = tree.getRoot();
+    tree.deleteNodeChild(node, computeChildIdx(key, treeDepth - 1));
+  }
+
+  for (unsigned d = 0; d < depth; ++d){
+    unsigned pos = computeChildIdx(key, treeDepth - 1 - d);
+    if (!tree.nodeChildExists(node, pos))
+      tree.createNodeChild(node, pos);
+    node = tree.getNodeChild(node, pos);
+  }
+  node->setLogOdds(logOdds);
+}
+
+void MapTiles::storeTiles(TreeMap& trees, unsigned level){
+  for (TreeMap::iterator it = trees.begin(); it != trees.end(); ++it){
+    // the leafs are disjoint, the inner nodes are computed once per tile:
+    it->second->updateInnerOccupancy();
+    it->second->prune();
+    octomap_msgs::binaryMapToMsg(*it->second, m_tiles[level][it->first]);
+    delete it->second;
+  }
+  trees.clear();
+}
+
+}
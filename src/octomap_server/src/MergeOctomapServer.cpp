@@ -0,0 +1,468 @@
+/**
+* MergeOctomapServer: octomap_server fusing the maps of several robots
+* License: BSD
+*/
+
+#include <octomap_server/MergeOctomapServer.h>
+
+#include <cmath>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace octomap;
+
+namespace {
+
+inline int mergeMaxThreads(){
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+inline int mergeThreadNum(){
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+}
+
+namespace octomap_server{
+
+MergeOctomapServer::MergeOctomapServer(ros::NodeHandle private_nh_)
+: OctomapServer(private_nh_),
+  m_composition(m_octree),
+  m_sampleDepthOffset(2),
+  m_merged(false),
+  m_mergeSpinner(NULL)
+{
+  ros::NodeHandle private_nh(private_nh_);
+  std::vector<std::string> sources;
+  std::string topic = "octomap_binary";
+  double publishPeriod = 1.0;
+  private_nh.param("merge/sources", sources, sources);
+  private_nh.param("merge/topic", topic, topic);
+  private_nh.param("merge/publish_period", publishPeriod, publishPeriod);
+  int mergeThreads = std::max(int(sources.size()), 1);
+  private_nh.param("merge/threads", mergeThreads, mergeThreads);
+  int sampleSize = 1 << m_sampleDepthOffset;
+  private_nh.param("merge/sample_size", sampleSize, sampleSize);
+  m_sampleDepthOffset = 0;
+  while ((2 << m_sampleDepthOffset) <= sampleSize && m_sampleDepthOffset < m_treeDepth)
+    m_sampleDepthOffset++;
+
+  if (sources.empty())
+    ROS_WARN("No sources to merge, set merge/sources to the namespaces of the robots' octomap_servers");
+
+  if (topic != "octomap_binary" && topic != "octomap_full")
+    ROS_WARN("merge/topic is %s, expected octomap_binary or octomap_full", topic.c_str());
+
+  // the incremental layers are fed by OctomapServer::insertScan(), which is bypassed here:
+  if (m_esdf || m_frontiers || m_columns){
+    ROS_WARN("The distance field, frontiers, column index and traversability are not supported in merge mode, disabling them");
+    m_frontierTimer.stop();
+    m_distancesService.shutdown();
+    if (m_esdf){
+      delete m_esdf;
+      m_esdf = NULL;
+    }
+    if (m_frontiers){
+      delete m_frontiers;
+      m_frontiers = NULL;
+    }
+    if (m_traversability){
+      delete m_traversability;
+      m_traversability = NULL;
+    }
+    if (m_columns){
+      delete m_columns;
+      m_columns = NULL;
+    }
+  }
+
+  // the sources decay their own maps, expiry here would fight their next update:
+  if (m_decay){
+    ROS_WARN("Decay of occupied voxels is not supported in merge mode, disabling it");
+    m_decayTimer.stop();
+    delete m_decay;
+    m_decay = NULL;
+  }
+
+  // the map is only built from the sources, local changes would be overwritten:
+  m_pointCloudSub->unsubscribe();
+  if (m_blocks){
+    ROS_WARN("The voxel_blocks backend is not supported in merge mode, using the octree");
+    delete m_blocks;
+    m_blocks = NULL;
+  }
+  m_clearBBXService.shutdown();
+  m_resetService.shutdown();
+  m_resetService = private_nh.advertiseService("reset", &MergeOctomapServer::resetSrv, this);
+
+  m_changesPub = m_nh.advertise<sensor_msgs::PointCloud2>("merged_changes", 5);
+  m_publishTimer = m_nh.createTimer(ros::Duration(publishPeriod), &MergeOctomapServer::publishMerged, this);
+
+  for (unsigned i = 0; i < sources.size(); ++i){
+    Source* source = new Source();
+    source->name = sources[i];
+    source->numMerges = 0;
+    source->totalTime = 0.0;
+
+    ros::NodeHandle source_nh(m_nh, sources[i]);
+    source_nh.setCallbackQueue(&m_mergeQueue);
+    source->sub = source_nh.subscribe<octomap_msgs::Octomap>(topic, 1,
+                                                             boost::bind(&MergeOctomapServer::mapCallback, this, _1, i));
+    m_sources.push_back(source);
+    ROS_INFO("Merging the map of %s", source->sub.getTopic().c_str());
+  }
+
+  m_mergeSpinner = new ros::AsyncSpinner(mergeThreads, &m_mergeQueue);
+  m_mergeSpinner->start();
+}
+
+MergeOctomapServer::~MergeOctomapServer(){
+  if (m_mergeSpinner){
+    m_mergeSpinner->stop();
+    delete m_mergeSpinner;
+    m_mergeSpinner = NULL;
+  }
+
+  for (unsigned i = 0; i < m_sources.size(); ++i)
+    delete m_sources[i];
+  m_sources.clear();
+}
+
+void MergeOctomapServer::mapCallback(const octomap_msgs::Octomap::ConstPtr& msg, unsigned index){
+  // callbacks of one subscription are never run concurrently, so a source is only touched here:
+  Source& source = *m_sources[index];
+  ros::WallTime startTime = ros::WallTime::now();
+
+  AbstractOcTree* abstractTree = octomap_msgs::msgToMap(*msg);
+  OcTree* tree = dynamic_cast<OcTree*>(abstractTree);
+  if (!tree){
+    ROS_ERROR("Map of %s is of type %s, only OcTree maps can be merged", source.name.c_str(), msg->id.c_str());
+    delete abstractTree;
+    return;
+  }
+
+  tf::StampedTransform sourceToMap;
+  try{
+    m_tfListener.lookupTransform(m_worldFrameId, msg->header.frame_id, ros::Time(0), sourceToMap);
+  } catch(tf::TransformException& ex){
+    ROS_ERROR_STREAM("Transform error for the map of " << source.name << ": " << ex.what() << ", skipping it");
+    delete tree;
+    return;
+  }
+
+  ros::WallTime decodedTime = ros::WallTime::now();
+
+  NodeLogOddsMap contributions;
+  transformLeafs(*tree, sourceToMap, contributions);
+  delete tree;
+
+  // only the nodes whose contribution changed since the last map of this source:
+  std::vector<Delta> deltas;
+  Delta delta;
+  for (NodeLogOddsMap::const_iterator it = contributions.begin(); it != contributions.end(); ++it){
+    NodeLogOddsMap::iterator previous = source.contributions.find(it->first);
+    delta.node = it->first;
+    if (previous == source.contributions.end()){
+      delta.logOdds = it->second;
+      delta.countChange = 1;
+      deltas.push_back(delta);
+    } else{
+      if (previous->second != it->second){
+        delta.logOdds = it->second - previous->second;
+        delta.countChange = 0;
+        deltas.push_back(delta);
+      }
+      source.contributions.erase(previous);
+    }
+  }
+  for (NodeLogOddsMap::const_iterator it = source.contributions.begin(); it != source.contributions.end(); ++it){
+    delta.node = it->first;
+    delta.logOdds = -it->second;
+    delta.countChange = -1;
+    deltas.push_back(delta);
+  }
+  source.contributions.swap(contributions);
+
+  ros::WallTime transformedTime = ros::WallTime::now();
+
+  std::vector<OcTreeKey> changed;
+  std::vector<Composition::Node> changedNodes;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    for (unsigned i = 0; i < deltas.size(); ++i){
+      Composition::Node node = Composition::idToNode(deltas[i].node);
+      m_composition.add(node.key, node.depth, deltas[i].logOdds, deltas[i].countChange);
+    }
+
+    OcTreeKey min(std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max());
+    OcTreeKey max(0, 0, 0);
+    if (m_composition.commit(min, max, &changed, &changedNodes) > 0){
+      if (m_compressMap)
+        m_octree->prune();
+      if (m_speckles)
+        m_speckles->markTouched(changed);
+      if (m_mesher)
+        m_mesher->markTouched(changed);
+
+      // larger nodes are uniform inside, as after clearing their box:
+      for (unsigned i = 0; i < changedNodes.size(); ++i){
+        OcTreeKey nodeMax;
+        for (unsigned j = 0; j < 3; ++j)
+          nodeMax[j] = changedNodes[i].key[j] + (1 << (m_treeDepth - changedNodes[i].depth)) - 1;
+        if (m_speckles)
+          m_speckles->clearBox(*m_octree, changedNodes[i].key, nodeMax);
+        if (m_mesher)
+          m_mesher->markBox(changedNodes[i].key, nodeMax);
+      }
+
+      // the update box accumulates until the next publish:
+      boost::lock_guard<boost::mutex> mergedLock(m_mergedMutex);
+      if (m_merged){
+        updateMinKey(min, m_updateBBXMin);
+        updateMaxKey(max, m_updateBBXMax);
+      } else{
+        m_updateBBXMin = min;
+        m_updateBBXMax = max;
+      }
+      m_merged = true;
+    }
+
+    if ((!changed.empty() || !changedNodes.empty()) && m_changesPub.getNumSubscribers() > 0)
+      publishChanges(changed, changedNodes, msg->header.stamp);
+  }
+
+  ros::WallTime endTime = ros::WallTime::now();
+  source.numMerges++;
+  source.totalTime += (endTime - startTime).toSec();
+  ROS_INFO("Merged map %u of %s (%zu nodes, %zu changed): decode %.1f ms, transform %.1f ms, fuse %.1f ms, mean total %.1f ms",
+           source.numMerges, source.name.c_str(), source.contributions.size(), changed.size() + changedNodes.size(),
+           (decodedTime - startTime).toSec() * 1000.0, (transformedTime - decodedTime).toSec() * 1000.0,
+           (endTime - transformedTime).toSec() * 1000.0, source.totalTime / source.numMerges * 1000.0);
+}
+
+bool MergeOctomapServer::isGridAligned(const OcTree& tree, const tf::Transform& sourceToMap,
+                                       int axis[3], int sign[3], int offset[3]) const{
+  const double eps = 1e-4;
+  if (std::fabs(tree.getResolution() - m_res) > eps * m_res || tree.getTreeDepth() != m_treeDepth)
+    return false;
+
+  // the rotation has to permute and / or flip the axes:
+  const tf::Matrix3x3& rotation = sourceToMap.getBasis();
+  for (unsigned a = 0; a < 3; ++a){
+    axis[a] = -1;
+    for (unsigned b = 0; b < 3; ++b){
+      double r = rotation[a][b];
+      if (std::fabs(std::fabs(r) - 1.0) < eps){
+        axis[a] = b;
+        sign[a] = (r > 0.0) ? 1 : -1;
+      } else if (std::fabs(r) > eps)
+        return false;
+    }
+    if (axis[a] < 0)
+      return false;
+  }
+
+  // by a whole number of voxels, key = floor(coord / res) + center:
+  const int center = m_octree->coordToKey(0.0);
+  for (unsigned a = 0; a < 3; ++a){
+    double voxels = sourceToMap.getOrigin()[a] / m_res;
+    int shift = int(std::floor(voxels + 0.5));
+    if (std::fabs(voxels - shift) > eps)
+      return false;
+
+    offset[a] = (sign[a] > 0) ? shift : 2 * center - 1 + shift;
+  }
+  return true;
+}
+
+void MergeOctomapServer::transformLeafs(const OcTree& tree, const tf::Transform& sourceToMap, NodeLogOddsMap& contributions) const{
+  std::vector<OcTreeKey> leafKeys;
+  std::vector<unsigned> leafDepths;
+  std::vector<float> leafLogOdds;
+  for (OcTree::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it){
+    leafKeys.push_back(it.getIndexKey());
+    leafDepths.push_back(it.getDepth());
+    leafLogOdds.push_back(it->getLogOdds());
+  }
+
+  int axis[3], sign[3], offset[3];
+  const bool aligned = isGridAligned(tree, sourceToMap, axis, sign, offset);
+  // without a common grid, pruned leafs are sampled in cubes of at most 2^m_sampleDepthOffset voxels
+  // (or voxel by voxel at a different resolution):
+  const bool sameGrid = std::fabs(tree.getResolution() - m_res) <= 1e-4 * m_res && tree.getTreeDepth() == m_treeDepth;
+  const unsigned sourceDepth = tree.getTreeDepth();
+  const unsigned minSampleDepth = sameGrid ? m_treeDepth - m_sampleDepthOffset : sourceDepth;
+
+  std::vector<std::vector<std::pair<uint64_t, float> > > threadNodes(mergeMaxThreads());
+  int numLeafs = leafKeys.size();
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < numLeafs; ++i){
+    std::vector<std::pair<uint64_t, float> >& nodes = threadNodes[mergeThreadNum()];
+    if (aligned){
+      // the leaf maps onto one map node, unless it straddles the nodes of its size there:
+      std::vector<std::pair<OcTreeKey, unsigned> > stack(1, std::make_pair(leafKeys[i], leafDepths[i]));
+      while (!stack.empty()){
+        OcTreeKey key = stack.back().first;
+        unsigned depth = stack.back().second;
+        stack.pop_back();
+
+        const int width = 1 << (m_treeDepth - depth);
+        OcTreeKey mapKey;
+        bool inside = true, nodeAligned = true;
+        for (unsigned a = 0; a < 3; ++a){
+          int lo = (sign[a] > 0) ? key[axis[a]] + offset[a] : offset[a] - (key[axis[a]] + width - 1);
+          inside = inside && lo >= 0 && lo + width - 1 <= int(std::numeric_limits<key_type>::max());
+          nodeAligned = nodeAligned && (lo % width) == 0;
+          mapKey[a] = key_type(lo);
+        }
+
+        if (inside && nodeAligned){
+          nodes.push_back(std::make_pair(Composition::nodeId(mapKey, depth, m_treeDepth), leafLogOdds[i]));
+        } else if (depth < m_treeDepth){
+          const int half = width / 2;
+          for (unsigned c = 0; c < 8; ++c){
+            OcTreeKey childKey(key[0] + ((c & 1) ? half : 0), key[1] + ((c & 2) ? half : 0), key[2] + ((c & 4) ? half : 0));
+            stack.push_back(std::make_pair(childKey, depth + 1));
+          }
+        }
+        // else: voxel outside of the map
+      }
+      continue;
+    }
+
+    const unsigned sampleDepth = std::max(leafDepths[i], minSampleDepth);
+    const unsigned sampleWidth = 1 << (sourceDepth - sampleDepth);
+    const unsigned leafWidth = 1 << (sourceDepth - leafDepths[i]);
+    // center of a sample cube relative to the center of its lowest voxel:
+    const double centerOffset = 0.5 * (sampleWidth - 1) * tree.getResolution();
+    const unsigned mapDepth = sameGrid ? sampleDepth : m_treeDepth;
+    OcTreeKey sampleKey, mapKey;
+    for (unsigned dz = 0; dz < leafWidth; dz += sampleWidth){
+      sampleKey[2] = leafKeys[i][2] + dz;
+      for (unsigned dy = 0; dy < leafWidth; dy += sampleWidth){
+        sampleKey[1] = leafKeys[i][1] + dy;
+        for (unsigned dx = 0; dx < leafWidth; dx += sampleWidth){
+          sampleKey[0] = leafKeys[i][0] + dx;
+          point3d p = tree.keyToCoord(sampleKey);
+          tf::Point mapPoint = sourceToMap * tf::Point(p.x() + centerOffset, p.y() + centerOffset, p.z() + centerOffset);
+          if (m_octree->coordToKeyChecked(pointTfToOctomap(mapPoint), mapKey))
+            nodes.push_back(std::make_pair(Composition::nodeId(mapKey, mapDepth, m_treeDepth), leafLogOdds[i]));
+        }
+      }
+    }
+  }
+
+  // samples landing in the same map node are one observation of this source, so they are averaged
+  // (only the composition sums over sources):
+  unordered_ns::unordered_map<uint64_t, unsigned> numSamples;
+  for (unsigned t = 0; t < threadNodes.size(); ++t){
+    for (unsigned i = 0; i < threadNodes[t].size(); ++i){
+      contributions[threadNodes[t][i].first] += threadNodes[t][i].second;
+      numSamples[threadNodes[t][i].first]++;
+    }
+  }
+  for (NodeLogOddsMap::iterator it = contributions.begin(); it != contributions.end(); ++it)
+    it->second /= numSamples[it->first];
+}
+
+void MergeOctomapServer::publishMerged(const ros::TimerEvent& event){
+  // no merge can change the update box until the publish is done:
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+  {
+    boost::lock_guard<boost::mutex> mergedLock(m_mergedMutex);
+    if (!m_merged)
+      return;
+    m_merged = false;
+  }
+
+  OctomapServer::publishAll(ros::Time::now());
+}
+
+void MergeOctomapServer::publishAll(const ros::Time& rostime){
+  // the sources are merged concurrently:
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+  OctomapServer::publishAll(rostime);
+}
+
+void MergeOctomapServer::publishChanges(const std::vector<OcTreeKey>& changed, const std::vector<Composition::Node>& changedNodes,
+                                        const ros::Time& rostime) const{
+  // as in TrackingOctomapServer, the intensity is the log-odds update to apply:
+  pcl::PointCloud<pcl::PointXYZI> cells;
+  pcl::PointXYZI point;
+  for (unsigned i = 0; i < changed.size(); ++i){
+    OcTreeNode* node = m_octree->search(changed[i]);
+    if (!node)
+      continue;
+
+    point3d center = m_octree->keyToCoord(changed[i]);
+    point.x = center.x();
+    point.y = center.y();
+    point.z = center.z();
+    point.intensity = m_octree->isNodeOccupied(node) ? 1000 : -1000;
+    cells.push_back(point);
+  }
+
+  // subscribers expect voxels, the nodes are uniform:
+  for (unsigned i = 0; i < changedNodes.size(); ++i){
+    OcTreeNode* node = m_octree->search(changedNodes[i].key);
+    if (!node)
+      continue;
+
+    point.intensity = m_octree->isNodeOccupied(node) ? 1000 : -1000;
+    const unsigned width = 1 << (m_treeDepth - changedNodes[i].depth);
+    OcTreeKey key;
+    for (unsigned dz = 0; dz < width; ++dz){
+      key[2] = changedNodes[i].key[2] + dz;
+      for (unsigned dy = 0; dy < width; ++dy){
+        key[1] = changedNodes[i].key[1] + dy;
+        for (unsigned dx = 0; dx < width; ++dx){
+          key[0] = changedNodes[i].key[0] + dx;
+          point3d center = m_octree->keyToCoord(key);
+          point.x = center.x();
+          point.y = center.y();
+          point.z = center.z();
+          cells.push_back(point);
+        }
+      }
+    }
+  }
+
+  sensor_msgs::PointCloud2 cloud;
+  pcl::toROSMsg(cells, cloud);
+  cloud.header.frame_id = m_worldFrameId;
+  cloud.header.stamp = rostime;
+  m_changesPub.publish(cloud);
+}
+
+bool MergeOctomapServer::openFile(const std::string& filename){
+  ROS_ERROR("Loading %s: maps cannot be loaded into the merge server", filename.c_str());
+  return false;
+}
+
+bool MergeOctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp){
+  // sources contribute again with their next map, no merge may land before the tree is cleared too:
+  m_mergeSpinner->stop();
+  for (unsigned i = 0; i < m_sources.size(); ++i)
+    m_sources[i]->contributions.clear();
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    m_composition.clear();
+  }
+
+  bool ok = OctomapServer::resetSrv(req, resp);
+  m_mergeSpinner->start();
+  return ok;
+}
+
+}
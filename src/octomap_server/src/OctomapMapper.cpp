@@ -0,0 +1,205 @@
+/**
+* OctomapMapper: scan integration part of the octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/OctomapMapper.h>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+template <class TreeT, class PointT>
+OctomapMapperT<TreeT, PointT>::OctomapMapperT()
+: m_octree(NULL),
+  m_blocks(NULL),
+  m_useNodeCache(true),
+  m_pruneTree(true),
+  m_maxRange(-1.0),
+  m_res(0.05),
+  m_treeDepth(0),
+  m_maxTreeDepth(0),
+  m_compressMap(true)
+{
+}
+
+template <class TreeT, class PointT>
+OctomapMapperT<TreeT, PointT>::~OctomapMapperT(){
+  if (m_octree){
+    delete m_octree;
+    m_octree = NULL;
+  }
+
+  if (m_blocks){
+    delete m_blocks;
+    m_blocks = NULL;
+  }
+}
+
+template <class TreeT, class PointT>
+void OctomapMapperT<TreeT, PointT>::insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  computeScanUpdate(sensorOrigin, ground, nonground);
+  applyScanUpdate();
+}
+
+template <class TreeT, class PointT>
+void OctomapMapperT<TreeT, PointT>::computeScanUpdate(const tf::Point& sensorOriginTf, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  point3d sensorOrigin = pointTfToOctomap(sensorOriginTf);
+
+  if (!m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMin)
+    || !m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMax))
+  {
+    ROS_ERROR_STREAM("Could not generate Key for origin "<<sensorOrigin);
+  }
+
+  // instead of direct scan insertion, compute update to filter ground:
+  KeySet& free_cells = m_freeCells;
+  KeySet& occupied_cells = m_occupiedCells;
+  free_cells.clear();
+  occupied_cells.clear();
+  // insert ground points only as free:
+  for (typename PCLPointCloud::const_iterator it = ground.begin(); it != ground.end(); ++it){
+    point3d point(it->x, it->y, it->z);
+    // maxrange check
+    if ((m_maxRange > 0.0) && ((point - sensorOrigin).norm() > m_maxRange) ) {
+      point = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+    }
+
+    // only clear space (ground points)
+    if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
+      free_cells.insert(m_keyRay.begin(), m_keyRay.end());
+    }
+
+    octomap::OcTreeKey endKey;
+    if (m_octree->coordToKeyChecked(point, endKey)){
+      updateMinKey(endKey, m_updateBBXMin);
+      updateMaxKey(endKey, m_updateBBXMax);
+    } else{
+      ROS_ERROR_STREAM("Could not generate Key for endpoint "<<point);
+    }
+  }
+
+  // all other points: free on ray, occupied on endpoint:
+  for (typename PCLPointCloud::const_iterator it = nonground.begin(); it != nonground.end(); ++it){
+    point3d point(it->x, it->y, it->z);
+    // maxrange check
+    if ((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange) ) {
+
+      // free cells
+      if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
+        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
+      }
+      // occupied endpoint
+      OcTreeKey key;
+      if (m_octree->coordToKeyChecked(point, key)){
+        occupied_cells.insert(key);
+
+        updateMinKey(key, m_updateBBXMin);
+        updateMaxKey(key, m_updateBBXMax);
+
+        // color etc. of occupied endpoints only (no-op for plain trees):
+        integrateEndpoint(*m_octree, key, *it);
+      }
+    } else {// ray longer than maxrange:;
+      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+      if (m_octree->computeRayKeys(sensorOrigin, new_end, m_keyRay)){
+        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
+
+        octomap::OcTreeKey endKey;
+        if (m_octree->coordToKeyChecked(new_end, endKey)){
+          free_cells.insert(endKey);
+          updateMinKey(endKey, m_updateBBXMin);
+          updateMaxKey(endKey, m_updateBBXMax);
+        } else{
+          ROS_ERROR_STREAM("Could not generate Key for endpoint "<<new_end);
+        }
+
+
+      }
+    }
+  }
+}
+
+template <class TreeT, class PointT>
+void OctomapMapperT<TreeT, PointT>::applyScanUpdate(){
+  if (m_blocks){
+    applyBlockUpdate();
+  } else if ((m_useNodeCache || !m_pruneTree) && !m_octree->isChangeDetectionEnabled()){
+    // same updates, each starting below the common ancestor with the previous key
+    // (the cache also keeps the inner nodes of an unpruned tree up to date):
+    m_nodeCache.setTree(m_octree);
+    m_nodeCache.setPruning(m_pruneTree);
+    m_nodeCache.resetStatistics();
+    for(KeySet::iterator it = m_freeCells.begin(), end=m_freeCells.end(); it!= end; ++it){
+      if (m_occupiedCells.find(*it) == m_occupiedCells.end())
+        m_nodeCache.updateNode(*it, false);
+    }
+    for (KeySet::iterator it = m_occupiedCells.begin(), end=m_occupiedCells.end(); it!= end; it++)
+      m_nodeCache.updateNode(*it, true);
+    m_nodeCache.flush();
+  } else{
+    // an unpruned tree is updated lazily here, its inner nodes are not kept up to date
+    const bool lazy = !m_pruneTree;
+
+    // mark free cells only if not seen occupied in this cloud
+    for(KeySet::iterator it = m_freeCells.begin(), end=m_freeCells.end(); it!= end; ++it){
+      if (m_occupiedCells.find(*it) == m_occupiedCells.end()){
+        m_octree->updateNode(*it, false, lazy);
+      }
+    }
+
+    // now mark all occupied cells:
+    for (KeySet::iterator it = m_occupiedCells.begin(), end=m_occupiedCells.end(); it!= end; it++) {
+      m_octree->updateNode(*it, true, lazy);
+    }
+  }
+
+  // TODO: eval lazy+updateInner vs. proper insertion
+  // non-lazy by default (updateInnerOccupancy() too slow for large maps)
+  //m_octree->updateInnerOccupancy();
+  octomap::point3d minPt, maxPt;
+  ROS_DEBUG_STREAM("Bounding box keys (before): " << m_updateBBXMin[0] << " " <<m_updateBBXMin[1] << " " << m_updateBBXMin[2] << " / " <<m_updateBBXMax[0] << " "<<m_updateBBXMax[1] << " "<< m_updateBBXMax[2]);
+
+  // TODO: snap max / min keys to larger voxels by m_maxTreeDepth
+//   if (m_maxTreeDepth < 16)
+//   {
+//      OcTreeKey tmpMin = getIndexKey(m_updateBBXMin, m_maxTreeDepth); // this should give us the first key at depth m_maxTreeDepth that is smaller or equal to m_updateBBXMin (i.e. lower left in 2D grid coordinates)
+//      OcTreeKey tmpMax = getIndexKey(m_updateBBXMax, m_maxTreeDepth); // see above, now add something to find upper right
+//      tmpMax[0]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
+//      tmpMax[1]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
+//      tmpMax[2]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
+//      m_updateBBXMin = tmpMin;
+//      m_updateBBXMax = tmpMax;
+//   }
+
+  // TODO: we could also limit the bbx to be within the map bounds here (see publishing check)
+  minPt = m_octree->keyToCoord(m_updateBBXMin);
+  maxPt = m_octree->keyToCoord(m_updateBBXMax);
+  ROS_DEBUG_STREAM("Updated area bounding box: "<< minPt << " - "<<maxPt);
+  ROS_DEBUG_STREAM("Bounding box keys (after): " << m_updateBBXMin[0] << " " <<m_updateBBXMin[1] << " " << m_updateBBXMin[2] << " / " <<m_updateBBXMax[0] << " "<<m_updateBBXMax[1] << " "<< m_updateBBXMax[2]);
+
+  if (m_compressMap)
+    m_octree->prune();
+}
+
+template <class TreeT, class PointT>
+void OctomapMapperT<TreeT, PointT>::applyBlockUpdate(){
+  // most updates of a scan only move the log-odds of a known voxel within its
+  // state (or are clamped), these never walk the octree:
+  float logOdds;
+  for(KeySet::iterator it = m_freeCells.begin(), end=m_freeCells.end(); it!= end; ++it){
+    if (m_occupiedCells.find(*it) == m_occupiedCells.end() && m_blocks->update(*it, false, logOdds))
+      m_octree->setNodeValue(*it, logOdds);
+  }
+
+  for (KeySet::iterator it = m_occupiedCells.begin(), end=m_occupiedCells.end(); it!= end; it++) {
+    if (m_blocks->update(*it, true, logOdds))
+      m_octree->setNodeValue(*it, logOdds);
+  }
+}
+
+template class OctomapMapperT<octomap::OcTree, pcl::PointXYZ>;
+template class OctomapMapperT<octomap::ColorOcTree, pcl::PointXYZRGB>;
+template class OctomapMapperT<octomap::OcTreeStamped, pcl::PointXYZ>;
+
+}
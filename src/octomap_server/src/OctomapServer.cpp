@@ -28,10 +28,34 @@
  */
 
 #include <octomap_server/OctomapServer.h>
+#include <octomap_server/TreeUtils.h>
+
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace octomap;
 using octomap_msgs::Octomap;
 
+/// number of threads the batch queries are evaluated with
+inline int queryMaxThreads(){
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+inline int queryThreadNum(){
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
 bool is_equal (double a, double b, double epsilon = 1.0e-7)
 {
     return std::abs(a - b) < epsilon;
@@ -39,22 +63,20 @@ bool is_equal (double a, double b, double epsilon = 1.0e-7)
 
 namespace octomap_server{
 
-OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
-: m_nh(),
+template <class TreeT, class PointT>
+OctomapServerT<TreeT, PointT>::OctomapServerT(ros::NodeHandle private_nh_)
+: Mapper(),
+  m_nh(),
+  m_querySpinner(NULL),
   m_pointCloudSub(NULL),
   m_tfPointCloudSub(NULL),
   m_reconfigureServer(m_config_mutex),
-  m_octree(NULL),
-  m_maxRange(-1.0),
   m_worldFrameId("/map"), m_baseFrameId("base_footprint"),
   m_useHeightMap(true),
   m_useColoredMap(false),
   m_colorFactor(0.8),
   m_latchedTopics(true),
   m_publishFreeSpace(false),
-  m_res(0.05),
-  m_treeDepth(0),
-  m_maxTreeDepth(0),
   m_pointcloudMinX(-std::numeric_limits<double>::max()),
   m_pointcloudMaxX(std::numeric_limits<double>::max()),
   m_pointcloudMinY(-std::numeric_limits<double>::max()),
@@ -64,11 +86,32 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_occupancyMinZ(-std::numeric_limits<double>::max()),
   m_occupancyMaxZ(std::numeric_limits<double>::max()),
   m_minSizeX(0.0), m_minSizeY(0.0),
-  m_filterSpeckles(false), m_filterGroundPlane(false),
+  m_filterSpeckles(false), m_speckles(NULL), m_clearBBXToUnknown(false), m_filterGroundPlane(false),
   m_groundFilterDistance(0.04), m_groundFilterAngle(0.15), m_groundFilterPlaneDistance(0.07),
-  m_compressMap(true),
   m_incrementalUpdate(false),
-  m_initConfig(true)
+  m_initConfig(true),
+  m_partialMapUpdates(false),
+  m_mapChunkSize(64),
+  m_mapResized(false),
+  m_columns(NULL),
+  m_columnProjection(false),
+  m_traversability(NULL),
+  m_publishTraversability(false),
+  m_esdf(NULL),
+  m_esdfMaxDistance(2.0),
+  m_publishEsdfSlice(false),
+  m_esdfSliceZ(0.0),
+  m_frontiers(NULL),
+  m_frontierMinClusterSize(1),
+  m_decay(NULL),
+  m_decayTime(10.0),
+  m_decayPeriod(1.0),
+  m_decayLogOdds(0.2),
+  m_mesher(NULL),
+  m_lodEnabled(false),
+  m_lodFrameId("base_footprint"),
+  m_lodRadius(10.0),
+  m_lodMinDepth(12)
 {
   double probHit, probMiss, thresMin, thresMax;
 
@@ -91,6 +134,8 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("min_y_size", m_minSizeY,m_minSizeY);
 
   private_nh.param("filter_speckles", m_filterSpeckles, m_filterSpeckles);
+  if (m_filterSpeckles)
+    m_speckles = new SpeckleFilter();
   private_nh.param("filter_ground", m_filterGroundPlane, m_filterGroundPlane);
   // distance of points from plane for RANSAC
   private_nh.param("ground_filter/distance", m_groundFilterDistance, m_groundFilterDistance);
@@ -107,7 +152,15 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("sensor_model/min", thresMin, 0.12);
   private_nh.param("sensor_model/max", thresMax, 0.97);
   private_nh.param("compress_map", m_compressMap, m_compressMap);
+  private_nh.param("node_cache", m_useNodeCache, m_useNodeCache);
   private_nh.param("incremental_2D_projection", m_incrementalUpdate, m_incrementalUpdate);
+  private_nh.param("clear_bbx_to_unknown", m_clearBBXToUnknown, m_clearBBXToUnknown);
+  private_nh.param("projected_map/partial_updates", m_partialMapUpdates, m_partialMapUpdates);
+  private_nh.param("projected_map/chunk_size", m_mapChunkSize, m_mapChunkSize);
+  if (m_partialMapUpdates && !m_incrementalUpdate){
+    ROS_WARN("Partial 2D map updates need incremental_2D_projection, publishing the full map instead");
+    m_partialMapUpdates = false;
+  }
 
   if (m_filterGroundPlane && (m_pointcloudMinZ > 0.0 || m_pointcloudMaxZ < 0.0)){
     ROS_WARN_STREAM("You enabled ground filtering but incoming pointclouds will be pre-filtered in ["
@@ -121,11 +174,12 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   }
 
   if (m_useColoredMap) {
-#ifdef COLOR_OCTOMAP_SERVER
-    ROS_INFO_STREAM("Using RGB color registration (if information available)");
-#else
-    ROS_ERROR_STREAM("Colored map requested in launch file - node not running/compiled to support colors, please define COLOR_OCTOMAP_SERVER and recompile or launch the octomap_color_server node");
-#endif
+    if (TreeTraits<OcTreeT>::hasColor)
+      ROS_INFO_STREAM("Using RGB color registration (if information available)");
+    else{
+      ROS_ERROR_STREAM("Colored map requested in launch file - this server has no colors, please run the ColorOctomapServerNodelet instead");
+      m_useColoredMap = false;
+    }
   }
 
 
@@ -139,6 +193,15 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_maxTreeDepth = m_treeDepth;
   m_gridmap.info.resolution = m_res;
 
+  // "voxel_blocks": scans are integrated into hashed voxel blocks, m_octree
+  // only follows the occupancy state changes (for publishing and queries)
+  std::string backend("octree");
+  private_nh.param("backend", backend, backend);
+  if (backend == "voxel_blocks")
+    m_blocks = new VoxelBlockMap(*m_octree);
+  else if (backend != "octree")
+    ROS_ERROR("Unknown backend %s (octree or voxel_blocks), using the octree", backend.c_str());
+
   double r, g, b, a;
   private_nh.param("color/r", r, 0.0);
   private_nh.param("color/g", g, 0.0);
@@ -158,6 +221,72 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_colorFree.b = b;
   m_colorFree.a = a;
 
+  bool frontiersEnabled = false;
+  double frontierRate = 1.0;
+  private_nh.param("frontiers/enable", frontiersEnabled, frontiersEnabled);
+  private_nh.param("frontiers/publish_rate", frontierRate, frontierRate);
+  private_nh.param("frontiers/min_cluster_size", m_frontierMinClusterSize, m_frontierMinClusterSize);
+  if (frontiersEnabled)
+    m_frontiers = new FrontierTracker();
+
+  bool decayEnabled = false;
+  private_nh.param("decay/enable", decayEnabled, decayEnabled);
+  private_nh.param("decay/time", m_decayTime, m_decayTime);
+  private_nh.param("decay/period", m_decayPeriod, m_decayPeriod);
+  private_nh.param("decay/log_odds", m_decayLogOdds, m_decayLogOdds);
+  if (decayEnabled){
+    if (m_decayPeriod > 0.0)
+      m_decay = new DecayQueue(m_decayPeriod);
+    else
+      ROS_ERROR("decay/period must be positive, occupied voxels will not decay");
+  }
+
+  bool meshEnabled = false;
+  int meshChunkSize = 16;
+  private_nh.param("mesh/enable", meshEnabled, meshEnabled);
+  private_nh.param("mesh/chunk_size", meshChunkSize, meshChunkSize);
+  if (meshEnabled){
+    if (meshChunkSize > 0)
+      m_mesher = new ChunkMesher(meshChunkSize);
+    else
+      ROS_ERROR("mesh/chunk_size must be positive, the occupied mesh will not be published");
+  }
+
+  int lodMinDepth = m_lodMinDepth;
+  private_nh.param("lod/enable", m_lodEnabled, m_lodEnabled);
+  private_nh.param("lod/frame_id", m_lodFrameId, m_lodFrameId);
+  private_nh.param("lod/radius", m_lodRadius, m_lodRadius);
+  private_nh.param("lod/min_depth", lodMinDepth, lodMinDepth);
+  m_lodMinDepth = std::max(1, std::min(lodMinDepth, int(m_treeDepth)));
+  if (m_lodEnabled && m_lodRadius <= 0.0){
+    ROS_ERROR("lod/radius must be positive, publishing at full depth");
+    m_lodEnabled = false;
+  }
+
+  bool esdfEnabled = false;
+  private_nh.param("esdf/enable", esdfEnabled, esdfEnabled);
+  private_nh.param("esdf/max_distance", m_esdfMaxDistance, m_esdfMaxDistance);
+  private_nh.param("esdf/publish_slice", m_publishEsdfSlice, m_publishEsdfSlice);
+  private_nh.param("esdf/slice_z", m_esdfSliceZ, m_esdfSliceZ);
+  if (esdfEnabled)
+    m_esdf = new EsdfMap(m_res, m_esdfMaxDistance);
+
+  bool columnsEnabled = false;
+  private_nh.param("column_index/enable", columnsEnabled, columnsEnabled);
+  bool traversabilityEnabled = false;
+  TraversabilityEstimator::Params traversabilityParams;
+  private_nh.param("traversability/enable", traversabilityEnabled, traversabilityEnabled);
+  private_nh.param("traversability/max_step", traversabilityParams.maxStep, traversabilityParams.maxStep);
+  private_nh.param("traversability/max_slope", traversabilityParams.maxSlope, traversabilityParams.maxSlope);
+  private_nh.param("traversability/max_roughness", traversabilityParams.maxRoughness, traversabilityParams.maxRoughness);
+  private_nh.param("traversability/radius", traversabilityParams.radius, traversabilityParams.radius);
+
+  // the traversability costs are computed from the column index:
+  if (columnsEnabled || traversabilityEnabled)
+    m_columns = new ColumnIndex();
+  if (traversabilityEnabled)
+    m_traversability = new TraversabilityEstimator(*m_columns, m_res, traversabilityParams);
+
   private_nh.param("publish_free_space", m_publishFreeSpace, m_publishFreeSpace);
 
   private_nh.param("latch", m_latchedTopics, m_latchedTopics);
@@ -170,24 +299,76 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_binaryMapPub = m_nh.advertise<Octomap>("octomap_binary", 1, m_latchedTopics);
   m_fullMapPub = m_nh.advertise<Octomap>("octomap_full", 1, m_latchedTopics);
   m_pointCloudPub = m_nh.advertise<sensor_msgs::PointCloud2>("octomap_point_cloud_centers", 1, m_latchedTopics);
-  m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5, m_latchedTopics);
+  if (m_partialMapUpdates){
+    m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5,
+                                                      boost::bind(&OctomapServerT::mapConnectCallback, this, _1, &m_gridmap),
+                                                      ros::SubscriberStatusCallback(), ros::VoidConstPtr(), m_latchedTopics);
+    m_mapUpdatesPub = m_nh.advertise<map_msgs::OccupancyGridUpdate>("projected_map_updates", 5);
+  } else
+    m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5, m_latchedTopics);
+
+  if (m_traversability){
+    if (m_partialMapUpdates){
+      m_traversabilityPub = m_nh.advertise<nav_msgs::OccupancyGrid>("traversability_map", 5,
+                                                                    boost::bind(&OctomapServerT::mapConnectCallback, this, _1, &m_traversabilityMap),
+                                                                    ros::SubscriberStatusCallback(), ros::VoidConstPtr(), m_latchedTopics);
+      m_traversabilityUpdatesPub = m_nh.advertise<map_msgs::OccupancyGridUpdate>("traversability_map_updates", 5);
+    } else
+      m_traversabilityPub = m_nh.advertise<nav_msgs::OccupancyGrid>("traversability_map", 5, m_latchedTopics);
+  }
   m_fmarkerPub = m_nh.advertise<visualization_msgs::MarkerArray>("free_cells_vis_array", 1, m_latchedTopics);
+  // only changed chunks are published, new subscribers get all of them on connection instead of latching:
+  if (m_mesher)
+    m_meshPub = m_nh.advertise<visualization_msgs::MarkerArray>("occupied_cells_mesh", 5,
+                                                                boost::bind(&OctomapServerT::meshConnectCallback, this, _1),
+                                                                ros::SubscriberStatusCallback(), ros::VoidConstPtr(), false);
+  if (m_esdf && m_publishEsdfSlice)
+    m_esdfSlicePub = m_nh.advertise<sensor_msgs::PointCloud2>("esdf_slice", 1, m_latchedTopics);
+  if (m_frontiers){
+    m_frontierPub = m_nh.advertise<sensor_msgs::PointCloud2>("frontier_cells", 1, m_latchedTopics);
+    if (frontierRate > 0.0)
+      m_frontierTimer = m_nh.createTimer(ros::Duration(1.0 / frontierRate), &OctomapServerT::publishFrontiers, this);
+    else
+      ROS_ERROR("frontiers/publish_rate must be positive, frontiers will not be published");
+  }
+  if (m_decay)
+    m_decayTimer = m_nh.createTimer(ros::Duration(m_decayPeriod), &OctomapServerT::decayCallback, this);
 
   m_pointCloudSub = new message_filters::Subscriber<sensor_msgs::PointCloud2> (m_nh, "cloud_in", 5);
   m_tfPointCloudSub = new tf::MessageFilter<sensor_msgs::PointCloud2> (*m_pointCloudSub, m_tfListener, m_worldFrameId, 5);
-  m_tfPointCloudSub->registerCallback(boost::bind(&OctomapServer::insertCloudCallback, this, _1));
-
-  m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServer::octomapBinarySrv, this);
-  m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServer::octomapFullSrv, this);
-  m_clearBBXService = private_nh.advertiseService("clear_bbx", &OctomapServer::clearBBXSrv, this);
-  m_resetService = private_nh.advertiseService("reset", &OctomapServer::resetSrv, this);
+  m_tfPointCloudSub->registerCallback(boost::bind(&OctomapServerT::insertCloudCallback, this, _1));
+
+  m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerT::octomapBinarySrv, this);
+  m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerT::octomapFullSrv, this);
+  m_clearBBXService = private_nh.advertiseService("clear_bbx", &OctomapServerT::clearBBXSrv, this);
+  m_resetService = private_nh.advertiseService("reset", &OctomapServerT::resetSrv, this);
+  m_registerRegionService = private_nh.advertiseService("register_region", &OctomapServerT::registerRegionSrv, this);
+  if (m_esdf)
+    m_distancesService = m_nh.advertiseService("esdf_distances", &OctomapServerT::getDistancesSrv, this);
+
+  int queryThreads = 2;
+  private_nh.param("query_threads", queryThreads, queryThreads);
+  ros::NodeHandle query_nh(m_nh);
+  query_nh.setCallbackQueue(&m_queryQueue);
+  m_occupancyQueryService = query_nh.advertiseService("query_occupancy", &OctomapServerT::queryOccupancySrv, this);
+  m_segmentQueryService = query_nh.advertiseService("check_segments", &OctomapServerT::checkSegmentsSrv, this);
+  m_rayQueryService = query_nh.advertiseService("cast_rays", &OctomapServerT::castRaysSrv, this);
+  m_querySpinner = new ros::AsyncSpinner(queryThreads, &m_queryQueue);
+  m_querySpinner->start();
 
   dynamic_reconfigure::Server<OctomapServerConfig>::CallbackType f;
-  f = boost::bind(&OctomapServer::reconfigureCallback, this, _1, _2);
+  f = boost::bind(&OctomapServerT::reconfigureCallback, this, _1, _2);
   m_reconfigureServer.setCallback(f);
 }
 
-OctomapServer::~OctomapServer(){
+template <class TreeT, class PointT>
+OctomapServerT<TreeT, PointT>::~OctomapServerT(){
+  if (m_querySpinner){
+    m_querySpinner->stop();
+    delete m_querySpinner;
+    m_querySpinner = NULL;
+  }
+
   if (m_tfPointCloudSub){
     delete m_tfPointCloudSub;
     m_tfPointCloudSub = NULL;
@@ -198,18 +379,49 @@ OctomapServer::~OctomapServer(){
     m_pointCloudSub = NULL;
   }
 
+  if (m_esdf){
+    delete m_esdf;
+    m_esdf = NULL;
+  }
+
+  if (m_frontiers){
+    delete m_frontiers;
+    m_frontiers = NULL;
+  }
 
-  if (m_octree){
-    delete m_octree;
-    m_octree = NULL;
+  if (m_decay){
+    delete m_decay;
+    m_decay = NULL;
+  }
+
+  if (m_speckles){
+    delete m_speckles;
+    m_speckles = NULL;
+  }
+
+  if (m_mesher){
+    delete m_mesher;
+    m_mesher = NULL;
+  }
+
+  if (m_traversability){
+    delete m_traversability;
+    m_traversability = NULL;
+  }
+
+  if (m_columns){
+    delete m_columns;
+    m_columns = NULL;
   }
 
 }
 
-bool OctomapServer::openFile(const std::string& filename){
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::openFile(const std::string& filename){
   if (filename.length() <= 3)
     return false;
 
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
   std::string suffix = filename.substr(filename.length()-3, 3);
   if (suffix== ".bt"){
     if (!m_octree->readBinary(filename)){
@@ -253,13 +465,47 @@ bool OctomapServer::openFile(const std::string& filename){
   m_updateBBXMax[1] = m_octree->coordToKey(maxY);
   m_updateBBXMax[2] = m_octree->coordToKey(maxZ);
 
+  if (m_esdf){
+    delete m_esdf;
+    m_esdf = new EsdfMap(m_res, m_esdfMaxDistance);
+    resetEsdf();
+  }
+
+  if (m_frontiers)
+    resetFrontiers();
+
+  if (m_columns)
+    resetColumns();
+
+  if (m_speckles){
+    m_speckles->clear();
+    m_speckles->markOccupied(*m_octree);
+  }
+
+  if (m_mesher){
+    m_mesher->clear();
+    m_mesher->markOccupied(*m_octree);
+  }
+
+  if (m_blocks){
+    delete m_blocks;
+    m_blocks = new VoxelBlockMap(*m_octree);
+    m_blocks->fromOcTree(*m_octree);
+  }
+
+  // loaded voxels are static until observed again:
+  if (m_decay)
+    m_decay->clear();
+
+  lock.unlock();
   publishAll();
 
   return true;
 
 }
 
-void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud){
   ros::WallTime startTime = ros::WallTime::now();
 
 
@@ -345,148 +591,83 @@ void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr
   }
 
 
-  insertScan(sensorToWorldTf.getOrigin(), pc_ground, pc_nonground);
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    insertScan(sensorToWorldTf.getOrigin(), pc_ground, pc_nonground);
+  }
 
   double total_elapsed = (ros::WallTime::now() - startTime).toSec();
   ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", pc_ground.size(), pc_nonground.size(), total_elapsed);
+  if (m_nodeCache.numLookups() > 0){
+    ROS_DEBUG("Node cache: %.1f%% of %zu updates started below the root, %.1f levels skipped on average",
+              m_nodeCache.hitRate() * 100.0, m_nodeCache.numLookups(), double(m_nodeCache.levelsSkipped()) / m_nodeCache.numLookups());
+  }
 
   publishAll(cloud->header.stamp);
 }
 
-void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCloud& ground, const PCLPointCloud& nonground){
-  point3d sensorOrigin = pointTfToOctomap(sensorOriginTf);
-
-  if (!m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMin)
-    || !m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMax))
-  {
-    ROS_ERROR_STREAM("Could not generate Key for origin "<<sensorOrigin);
-  }
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  Mapper::computeScanUpdate(sensorOrigin, ground, nonground);
 
-#ifdef COLOR_OCTOMAP_SERVER
-  unsigned char* colors = new unsigned char[3];
-#endif
+  // a free cell can only create or remove a speckle if it was occupied before:
+  m_freedCells.clear();
+  if (m_speckles){
+    for (KeySet::const_iterator it = m_freeCells.begin(); it != m_freeCells.end(); ++it){
+      if (m_occupiedCells.find(*it) != m_occupiedCells.end())
+        continue;
 
-  // instead of direct scan insertion, compute update to filter ground:
-  KeySet free_cells, occupied_cells;
-  // insert ground points only as free:
-  for (PCLPointCloud::const_iterator it = ground.begin(); it != ground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange > 0.0) && ((point - sensorOrigin).norm() > m_maxRange) ) {
-      point = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
-    }
-
-    // only clear space (ground points)
-    if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-      free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-    }
-
-    octomap::OcTreeKey endKey;
-    if (m_octree->coordToKeyChecked(point, endKey)){
-      updateMinKey(endKey, m_updateBBXMin);
-      updateMaxKey(endKey, m_updateBBXMax);
-    } else{
-      ROS_ERROR_STREAM("Could not generate Key for endpoint "<<point);
+      OcTreeNode* node = m_octree->search(*it);
+      if (node && m_octree->isNodeOccupied(node))
+        m_freedCells.push_back(*it);
     }
   }
 
-  // all other points: free on ray, occupied on endpoint:
-  for (PCLPointCloud::const_iterator it = nonground.begin(); it != nonground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange) ) {
+  Mapper::applyScanUpdate();
 
-      // free cells
-      if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-      }
-      // occupied endpoint
-      OcTreeKey key;
-      if (m_octree->coordToKeyChecked(point, key)){
-        occupied_cells.insert(key);
-
-        updateMinKey(key, m_updateBBXMin);
-        updateMaxKey(key, m_updateBBXMax);
-
-#ifdef COLOR_OCTOMAP_SERVER // NB: Only read and interpret color if it's an occupied node
-        const int rgb = *reinterpret_cast<const int*>(&(it->rgb)); // TODO: there are other ways to encode color than this one
-        colors[0] = ((rgb >> 16) & 0xff);
-        colors[1] = ((rgb >> 8) & 0xff);
-        colors[2] = (rgb & 0xff);
-        m_octree->averageNodeColor(it->x, it->y, it->z, colors[0], colors[1], colors[2]);
-#endif
-      }
-    } else {// ray longer than maxrange:;
-      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
-      if (m_octree->computeRayKeys(sensorOrigin, new_end, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-
-        octomap::OcTreeKey endKey;
-        if (m_octree->coordToKeyChecked(new_end, endKey)){
-          free_cells.insert(endKey);
-          updateMinKey(endKey, m_updateBBXMin);
-          updateMaxKey(endKey, m_updateBBXMax);
-        } else{
-          ROS_ERROR_STREAM("Could not generate Key for endpoint "<<new_end);
-        }
+  // occupied voxels start to decay if they are not observed again:
+  if (m_decay)
+    m_decay->schedule(m_occupiedCells, ros::Time::now().toSec() + m_decayTime);
+
+  updateIncrementalLayers();
+}
 
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::updateIncrementalLayers(){
+  if (m_esdf)
+    updateEsdf();
 
-      }
-    }
+  if (m_speckles){
+    m_speckles->markTouched(m_freedCells);
+    m_speckles->markTouched(m_occupiedCells);
   }
+  m_freedCells.clear();
 
-  // mark free cells only if not seen occupied in this cloud
-  for(KeySet::iterator it = free_cells.begin(), end=free_cells.end(); it!= end; ++it){
-    if (occupied_cells.find(*it) == occupied_cells.end()){
-      m_octree->updateNode(*it, false);
-    }
+  if (m_mesher){
+    m_mesher->markTouched(m_freeCells);
+    m_mesher->markTouched(m_occupiedCells);
   }
 
-  // now mark all occupied cells:
-  for (KeySet::iterator it = occupied_cells.begin(), end=occupied_cells.end(); it!= end; it++) {
-    m_octree->updateNode(*it, true);
+  if (m_frontiers){
+    m_frontiers->markTouched(m_freeCells);
+    m_frontiers->markTouched(m_occupiedCells);
+    m_frontiers->update(*m_octree);
   }
 
-  // TODO: eval lazy+updateInner vs. proper insertion
-  // non-lazy by default (updateInnerOccupancy() too slow for large maps)
-  //m_octree->updateInnerOccupancy();
-  octomap::point3d minPt, maxPt;
-  ROS_DEBUG_STREAM("Bounding box keys (before): " << m_updateBBXMin[0] << " " <<m_updateBBXMin[1] << " " << m_updateBBXMin[2] << " / " <<m_updateBBXMax[0] << " "<<m_updateBBXMax[1] << " "<< m_updateBBXMax[2]);
-
-  // TODO: snap max / min keys to larger voxels by m_maxTreeDepth
-//   if (m_maxTreeDepth < 16)
-//   {
-//      OcTreeKey tmpMin = getIndexKey(m_updateBBXMin, m_maxTreeDepth); // this should give us the first key at depth m_maxTreeDepth that is smaller or equal to m_updateBBXMin (i.e. lower left in 2D grid coordinates)
-//      OcTreeKey tmpMax = getIndexKey(m_updateBBXMax, m_maxTreeDepth); // see above, now add something to find upper right
-//      tmpMax[0]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
-//      tmpMax[1]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
-//      tmpMax[2]+= m_octree->getNodeSize( m_maxTreeDepth ) - 1;
-//      m_updateBBXMin = tmpMin;
-//      m_updateBBXMax = tmpMax;
-//   }
-
-  // TODO: we could also limit the bbx to be within the map bounds here (see publishing check)
-  minPt = m_octree->keyToCoord(m_updateBBXMin);
-  maxPt = m_octree->keyToCoord(m_updateBBXMax);
-  ROS_DEBUG_STREAM("Updated area bounding box: "<< minPt << " - "<<maxPt);
-  ROS_DEBUG_STREAM("Bounding box keys (after): " << m_updateBBXMin[0] << " " <<m_updateBBXMin[1] << " " << m_updateBBXMin[2] << " / " <<m_updateBBXMax[0] << " "<<m_updateBBXMax[1] << " "<< m_updateBBXMax[2]);
-
-  if (m_compressMap)
-    m_octree->prune();
-
-#ifdef COLOR_OCTOMAP_SERVER
-  if (colors)
-  {
-    delete[] colors;
-    colors = NULL;
+  if (m_columns){
+    m_columns->markDirty(m_freeCells);
+    m_columns->markDirty(m_occupiedCells);
+    m_columns->update(*m_octree);
   }
-#endif
 }
 
 
-
-void OctomapServer::publishAll(const ros::Time& rostime){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishAll(const ros::Time& rostime){
   ros::WallTime startTime = ros::WallTime::now();
+  if (!m_regions.empty())
+    markRegionsDirty(m_octree->keyToCoord(m_updateBBXMin), m_octree->keyToCoord(m_updateBBXMax));
+
   size_t octomapSize = m_octree->size();
   // TODO: estimate num occ. voxels for size of arrays (reserve)
   if (octomapSize <= 1){
@@ -499,7 +680,11 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   bool publishPointCloud = (m_latchedTopics || m_pointCloudPub.getNumSubscribers() > 0);
   bool publishBinaryMap = (m_latchedTopics || m_binaryMapPub.getNumSubscribers() > 0);
   bool publishFullMap = (m_latchedTopics || m_fullMapPub.getNumSubscribers() > 0);
-  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0);
+  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0 || m_mapUpdatesPub.getNumSubscribers() > 0);
+  // the traversability map shares the geometry of the 2D map:
+  m_publishTraversability = m_traversability && (m_latchedTopics || m_traversabilityPub.getNumSubscribers() > 0
+                                                 || m_traversabilityUpdatesPub.getNumSubscribers() > 0);
+  m_publish2DMap = m_publish2DMap || m_publishTraversability;
 
   // init markers for free space:
   visualization_msgs::MarkerArray freeNodesVis;
@@ -517,11 +702,30 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   // init pointcloud:
   pcl::PointCloud<PCLPoint> pclCloud;
 
+  // far from the LOD center, the coarse node of a leaf is published once for
+  // all its leafs (the hooks and the 2D map still get all leafs):
+  bool lod = m_lodEnabled && updateLODCenter();
+  OcTreeKey lodOccupiedKey, lodFreeKey;
+  unsigned lodOccupiedDepth = 0, lodFreeDepth = 0; // depth of the last coarse node published (0: none)
+
+  // only the neighborhoods of the voxels changed since the last publish are re-evaluated:
+  if (m_speckles)
+    m_speckles->update(*m_octree);
+
+  // the mesh follows the speckles, only the touched chunks are meshed again:
+  if (m_mesher && m_meshPub.getNumSubscribers() > 0){
+    m_mesher->update(*m_octree, m_occupancyMinZ, m_occupancyMaxZ, m_speckles);
+    visualization_msgs::MarkerArray meshVis;
+    m_mesher->getChangedMarkers(meshVis, m_worldFrameId, rostime, m_color);
+    if (!meshVis.markers.empty())
+      m_meshPub.publish(meshVis);
+  }
+
   // call pre-traversal hook:
   handlePreNodeTraversal(rostime);
 
   // now, traverse all leafs in the tree:
-  for (OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
+  for (typename OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
       end = m_octree->end(); it != end; ++it)
   {
     bool inUpdateBBX = isInUpdateBBX(it);
@@ -538,14 +742,8 @@ void OctomapServer::publishAll(const ros::Time& rostime){
         double size = it.getSize();
         double x = it.getX();
         double y = it.getY();
-#ifdef COLOR_OCTOMAP_SERVER
-        int r = it->getColor().r;
-        int g = it->getColor().g;
-        int b = it->getColor().b;
-#endif
-
         // Ignore speckles in the map:
-        if (m_filterSpeckles && (it.getDepth() == m_treeDepth +1) && isSpeckleNode(it.getKey())){
+        if (m_speckles && it.getDepth() == m_treeDepth && m_speckles->isSpeckle(it.getKey())){
           ROS_DEBUG("Ignoring single speckle at (%f,%f,%f)", x, y, z);
           continue;
         } // else: current octree node is no speckle, send it out
@@ -554,10 +752,30 @@ void OctomapServer::publishAll(const ros::Time& rostime){
         if (inUpdateBBX)
           handleOccupiedNodeInBBX(it);
 
+        const typename OcTreeT::NodeType* node = &(*it);
+        unsigned depth = it.getDepth();
+        if (lod){
+          unsigned coarseDepth = lodDepth(it.getKey());
+          if (coarseDepth < depth){
+            OcTreeKey coarseKey = m_octree->adjustKeyAtDepth(it.getKey(), coarseDepth);
+            if (coarseDepth == lodOccupiedDepth && coarseKey == lodOccupiedKey)
+              continue;
+
+            // occupied, as the max. of its children:
+            lodOccupiedKey = coarseKey;
+            lodOccupiedDepth = coarseDepth;
+            node = m_octree->search(coarseKey, coarseDepth);
+            depth = coarseDepth;
+            point3d center = m_octree->keyToCoord(coarseKey, coarseDepth);
+            x = center.x();
+            y = center.y();
+            z = center.z();
+          }
+        }
 
         //create marker:
         if (publishMarkerArray){
-          unsigned idx = it.getDepth();
+          unsigned idx = depth;
           assert(idx < occupiedNodesVis.markers.size());
 
           geometry_msgs::Point cubeCenter;
@@ -575,24 +793,16 @@ void OctomapServer::publishAll(const ros::Time& rostime){
             occupiedNodesVis.markers[idx].colors.push_back(heightMapColor(h));
           }
 
-#ifdef COLOR_OCTOMAP_SERVER
-          if (m_useColoredMap) {
-            std_msgs::ColorRGBA _color; _color.r = (r / 255.); _color.g = (g / 255.); _color.b = (b / 255.); _color.a = 1.0; // TODO/EVALUATE: potentially use occupancy as measure for alpha channel?
+          std_msgs::ColorRGBA _color; // TODO/EVALUATE: potentially use occupancy as measure for alpha channel?
+          if (m_useColoredMap && nodeColor(*node, _color))
             occupiedNodesVis.markers[idx].colors.push_back(_color);
-          }
-#endif
         }
 
         // insert into pointcloud:
         if (publishPointCloud) {
-#ifdef COLOR_OCTOMAP_SERVER
           PCLPoint _point = PCLPoint();
-          _point.x = x; _point.y = y; _point.z = z;
-          _point.r = r; _point.g = g; _point.b = b;
+          voxelPoint(*node, x, y, z, _point);
           pclCloud.push_back(_point);
-#else
-          pclCloud.push_back(PCLPoint(x, y, z));
-#endif
         }
 
       }
@@ -607,10 +817,31 @@ void OctomapServer::publishAll(const ros::Time& rostime){
         if (m_publishFreeSpace){
           double x = it.getX();
           double y = it.getY();
+          unsigned depth = it.getDepth();
+          if (lod){
+            unsigned coarseDepth = lodDepth(it.getKey());
+            if (coarseDepth < depth){
+              OcTreeKey coarseKey = m_octree->adjustKeyAtDepth(it.getKey(), coarseDepth);
+              if (coarseDepth == lodFreeDepth && coarseKey == lodFreeKey)
+                continue;
+
+              // free only if none of its children is occupied:
+              lodFreeKey = coarseKey;
+              lodFreeDepth = coarseDepth;
+              if (m_octree->isNodeOccupied(m_octree->search(coarseKey, coarseDepth)))
+                continue;
+
+              depth = coarseDepth;
+              point3d center = m_octree->keyToCoord(coarseKey, coarseDepth);
+              x = center.x();
+              y = center.y();
+              z = center.z();
+            }
+          }
 
           //create marker for free space:
           if (publishFreeMarkerArray){
-            unsigned idx = it.getDepth();
+            unsigned idx = depth;
             assert(idx < freeNodesVis.markers.size());
 
             geometry_msgs::Point cubeCenter;
@@ -691,11 +922,15 @@ void OctomapServer::publishAll(const ros::Time& rostime){
     m_pointCloudPub.publish(cloud);
   }
 
+  // far areas of the maps are truncated to their LOD depth while serializing, the stored tree stays unchanged:
   if (publishBinaryMap)
-    publishBinaryOctoMap(rostime);
+    publishBinaryOctoMap(rostime, lod);
 
   if (publishFullMap)
-    publishFullOctoMap(rostime);
+    publishFullOctoMap(rostime, lod);
+
+  if (m_esdf && m_publishEsdfSlice && (m_latchedTopics || m_esdfSlicePub.getNumSubscribers() > 0))
+    publishEsdfSlice(rostime);
 
 
   double total_elapsed = (ros::WallTime::now() - startTime).toSec();
@@ -704,13 +939,15 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 }
 
 
-bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::octomapBinarySrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
   ros::WallTime startTime = ros::WallTime::now();
   ROS_INFO("Sending binary map data on service request");
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
   if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
     return false;
 
@@ -719,44 +956,178 @@ bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
   return true;
 }
 
-bool OctomapServer::octomapFullSrv(OctomapSrv::Request  &req,
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::octomapFullSrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
   ROS_INFO("Sending full map data on service request");
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
 
-
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
   if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
     return false;
 
   return true;
 }
 
-bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
   point3d min = pointMsgToOctomap(req.min);
   point3d max = pointMsgToOctomap(req.max);
 
-  double thresMin = m_octree->getClampingThresMin();
-  for(OcTreeT::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(min,max),
-      end=m_octree->end_leafs_bbx(); it!= end; ++it){
+  OcTreeKey minKey, maxKey;
+  if (!m_octree->coordToKeyChecked(min, minKey) || !m_octree->coordToKeyChecked(max, maxKey)){
+    ROS_ERROR_STREAM("Could not clear bounding box "<< min << " - " << max << ", it is out of the map bounds");
+    return false;
+  }
+  for (unsigned i = 0; i < 3; ++i){
+    if (minKey[i] > maxKey[i])
+      std::swap(minKey[i], maxKey[i]);
+  }
+
+  ros::WallTime startTime = ros::WallTime::now();
+  boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+
+  // the incremental layers need to know the leafs that change:
+  if (m_esdf || m_frontiers){
+    for(typename OcTreeT::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(minKey,maxKey),
+        end=m_octree->end_leafs_bbx(); it!= end; ++it){
+      bool occupied = m_octree->isNodeOccupied(*it);
+      if (m_esdf && occupied)
+        updateEsdfLeaf(it.getIndexKey(), it.getDepth(), false);
+      if (m_frontiers && (occupied || m_clearBBXToUnknown))
+        m_frontiers->markLeafBoundary(it.getIndexKey(), 1 << (m_treeDepth - it.getDepth()));
+    }
+    // known voxels next to the box border unknown space afterwards, also inside leafs reaching out of it:
+    if (m_frontiers && m_clearBBXToUnknown)
+      m_frontiers->markBoxShell(minKey, maxKey);
+  }
+
+  // overwrite leafs / delete whole subtrees inside the box, only the nodes
+  // intersecting the box boundary are expanded and updated:
+  typename OcTreeT::NodeType* root = m_octree->getRoot();
+  if (root){
+    OcTreeKey rootKey(m_octree->coordToKey(0.0), m_octree->coordToKey(0.0), m_octree->coordToKey(0.0));
+    float clearLogOdds = octomap::logodds(m_octree->getClampingThresMin());
+    if (clearBBXRecurs(root, 0, rootKey, minKey, maxKey, clearLogOdds))
+      m_octree->clear();
+    if (m_blocks)
+      m_blocks->clearBox(minKey, maxKey, m_clearBBXToUnknown, clearLogOdds);
+  }
 
-    it->setLogOdds(octomap::logodds(thresMin));
-    //			m_octree->updateNode(it.getKey(), -6.0f);
+  if (m_speckles)
+    m_speckles->clearBox(*m_octree, minKey, maxKey);
+  if (m_mesher)
+    m_mesher->markBox(minKey, maxKey);
+
+  if (m_esdf)
+    m_esdf->update();
+  if (m_frontiers)
+    m_frontiers->update(*m_octree);
+  if (m_columns){
+    m_columns->markDirty(minKey, maxKey);
+    m_columns->update(*m_octree);
   }
-  // TODO: eval which is faster (setLogOdds+updateInner or updateNode)
-  m_octree->updateInnerOccupancy();
 
+  lock.unlock();
+  double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+  ROS_DEBUG_STREAM("Cleared bounding box " << min << " - " << max << " in " << total_elapsed << " sec");
+
+  // only the cleared area needs to be updated in the 2D map:
+  m_updateBBXMin = minKey;
+  m_updateBBXMax = maxKey;
   publishAll(ros::Time::now());
 
   return true;
 }
 
-bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp) {
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::clearBBXRecurs(typename OcTreeT::NodeType* node, unsigned depth, const OcTreeKey& nodeKey,
+                                   const OcTreeKey& minKey, const OcTreeKey& maxKey, float clearLogOdds)
+{
+  // key range covered by the node, 2^(tree_depth-depth) voxels wide:
+  unsigned halfWidth = (depth < m_treeDepth) ? (1 << (m_treeDepth - depth - 1)) : 0;
+  bool inside = true;
+  for (unsigned i = 0; i < 3; ++i){
+    unsigned lo = nodeKey[i] - halfWidth;
+    unsigned hi = (halfWidth > 0) ? nodeKey[i] + halfWidth - 1 : nodeKey[i];
+    if (hi < minKey[i] || lo > maxKey[i])
+      return false; // no overlap
+
+    inside = inside && lo >= minKey[i] && hi <= maxKey[i];
+  }
+
+  if (inside){
+    if (m_clearBBXToUnknown)
+      return true; // parent deletes the whole subtree
+
+    if (!m_octree->nodeHasChildren(node)){
+      node->setLogOdds(clearLogOdds);
+      return false;
+    }
+    // unknown space below the node stays unknown, only its leafs are overwritten:
+  } else if (!m_octree->nodeHasChildren(node)){
+    // partial overlap (depth < tree depth here): descend into the children
+    m_octree->expandNode(node);
+  }
+
+  // center key of the root (tree_max_val) halved for each level:
+  octomap::key_type centerOffset = m_octree->coordToKey(0.0) >> (depth + 1);
+  bool hasChildren = false;
+  for (unsigned i = 0; i < 8; ++i){
+    if (!m_octree->nodeChildExists(node, i))
+      continue;
+
+    OcTreeKey childKey;
+    octomap::computeChildKey(i, centerOffset, nodeKey, childKey);
+    if (clearBBXRecurs(m_octree->getNodeChild(node, i), depth + 1, childKey, minKey, maxKey, clearLogOdds))
+      m_octree->deleteNodeChild(node, i);
+    else
+      hasChildren = true;
+  }
+
+  if (!hasChildren)
+    return true; // all children unknown now
+
+  node->updateOccupancyChildren();
+  if (m_compressMap)
+    m_octree->pruneNode(node);
+
+  return false;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp) {
   visualization_msgs::MarkerArray occupiedNodesVis;
   occupiedNodesVis.markers.resize(m_treeDepth +1);
   ros::Time rostime = ros::Time::now();
-  m_octree->clear();
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    m_octree->clear();
+    if (m_blocks)
+      m_blocks->clear();
+  }
+  if (m_esdf)
+    m_esdf->clear();
+  if (m_frontiers)
+    m_frontiers->clear();
+  if (m_columns)
+    m_columns->clear();
+  if (m_decay)
+    m_decay->clear();
+  if (m_speckles)
+    m_speckles->clear();
+  if (m_mesher){
+    m_mesher->clear();
+    // publishAll() returns early on the empty tree:
+    visualization_msgs::MarkerArray meshVis;
+    m_mesher->getChangedMarkers(meshVis, m_worldFrameId, rostime, m_color);
+    if (!meshVis.markers.empty())
+      m_meshPub.publish(meshVis);
+  }
+  for (std::map<std::string, RegionSubscription>::iterator it = m_regions.begin(); it != m_regions.end(); ++it)
+    it->second.dirty = true;
   // clear 2D map:
   m_gridmap.data.clear();
   m_gridmap.info.height = 0.0;
@@ -798,25 +1169,398 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
   return true;
 }
 
-void OctomapServer::publishBinaryOctoMap(const ros::Time& rostime) const{
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::getDistancesSrv(DistancesSrv::Request& req, DistancesSrv::Response& resp){
+  if (!m_esdf)
+    return false;
+
+  resp.distances.resize(req.points.size());
+  if (req.compute_gradients)
+    resp.gradients.resize(req.points.size());
+
+  for (unsigned i = 0; i < req.points.size(); ++i){
+    OcTreeKey key;
+    if (!m_octree->coordToKeyChecked(pointMsgToOctomap(req.points[i]), key)){
+      // outside of the map bounds, nothing to avoid there:
+      resp.distances[i] = m_esdf->getMaxDistance();
+      continue;
+    }
+
+    if (req.compute_gradients){
+      point3d gradient;
+      resp.distances[i] = m_esdf->getDistanceAndGradient(key, gradient);
+      resp.gradients[i].x = gradient.x();
+      resp.gradients[i].y = gradient.y();
+      resp.gradients[i].z = gradient.z();
+    } else{
+      resp.distances[i] = m_esdf->getDistance(key);
+    }
+  }
+
+  return true;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::queryOccupancySrv(OccupancySrv::Request& req, OccupancySrv::Response& resp){
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+
+  const int numPoints = int(req.points.size());
+  resp.states.resize(numPoints);
+
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < numPoints; ++i){
+    typename OcTreeT::NodeType* node = m_octree->search(pointMsgToOctomap(req.points[i]));
+    if (!node)
+      resp.states[i] = OccupancySrv::Response::UNKNOWN;
+    else if (m_octree->isNodeOccupied(node))
+      resp.states[i] = OccupancySrv::Response::OCCUPIED;
+    else
+      resp.states[i] = OccupancySrv::Response::FREE;
+  }
+
+  return true;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::checkSegmentsSrv(SegmentsSrv::Request& req, SegmentsSrv::Response& resp){
+  if (req.starts.size() != req.ends.size()){
+    ROS_ERROR("Segment query needs the same number of start and end points (%zu / %zu)", req.starts.size(), req.ends.size());
+    return false;
+  }
+
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+
+  const int numSegments = int(req.starts.size());
+  resp.collisions.resize(numSegments);
+
+  // one KeyRay per thread, they are expensive to allocate:
+  std::vector<KeyRay> keyRays(queryMaxThreads());
+
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int i = 0; i < numSegments; ++i){
+    bool free = isSegmentFree(pointMsgToOctomap(req.starts[i]), pointMsgToOctomap(req.ends[i]),
+                              req.unknown_is_occupied, keyRays[queryThreadNum()]);
+    resp.collisions[i] = free ? 0 : 1;
+  }
+
+  return true;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::castRaysSrv(RaysSrv::Request& req, RaysSrv::Response& resp){
+  if (req.origins.size() != req.directions.size()){
+    ROS_ERROR("Ray query needs the same number of origins and directions (%zu / %zu)", req.origins.size(), req.directions.size());
+    return false;
+  }
+
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+
+  const int numRays = int(req.origins.size());
+  resp.ranges.resize(numRays);
+
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int i = 0; i < numRays; ++i){
+    point3d origin = pointMsgToOctomap(req.origins[i]);
+    point3d direction(req.directions[i].x, req.directions[i].y, req.directions[i].z);
+    point3d end;
+    if (direction.norm() > 0.0 && m_octree->castRay(origin, direction, end, req.ignore_unknown, req.max_range))
+      resp.ranges[i] = (end - origin).norm();
+    else
+      resp.ranges[i] = -1.0f;
+  }
+
+  return true;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::registerRegionSrv(RegionSrv::Request& req, RegionSrv::Response& resp){
+  if (req.name.empty()){
+    ROS_ERROR("Region of interest needs a name");
+    return false;
+  }
+
+  if (req.rate <= 0.0){
+    if (m_regions.erase(req.name) > 0)
+      ROS_INFO("Removed region of interest \"%s\"", req.name.c_str());
+    return true;
+  }
+
+  RegionSubscription& region = m_regions[req.name];
+  region.min = pointMsgToOctomap(req.min);
+  region.max = pointMsgToOctomap(req.max);
+  for (unsigned i = 0; i < 3; ++i){
+    if (region.min(i) > region.max(i))
+      std::swap(region.min(i), region.max(i));
+  }
+  region.frameId = req.frame_id;
+  region.full = req.full;
+  region.dirty = true;
+  region.published = false;
+
+  resp.topic = "octomap_region/" + req.name;
+  if (!region.pub)
+    region.pub = m_nh.advertise<Octomap>(resp.topic, 1, true);
+  resp.topic = region.pub.getTopic();
+
+  region.timer = m_nh.createTimer(ros::Duration(1.0 / req.rate),
+                                  boost::bind(&OctomapServerT::publishRegion, this, _1, req.name));
+
+  ROS_INFO("Registered region of interest \"%s\" on %s", req.name.c_str(), resp.topic.c_str());
+  return true;
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishRegion(const ros::TimerEvent& event, const std::string& name){
+  std::map<std::string, RegionSubscription>::iterator regionIt = m_regions.find(name);
+  if (regionIt == m_regions.end())
+    return;
+
+  RegionSubscription& region = regionIt->second;
+  point3d min(region.min), max(region.max);
+  if (!region.frameId.empty()){
+    tf::StampedTransform regionToWorldTf;
+    try {
+      m_tfListener.lookupTransform(m_worldFrameId, region.frameId, ros::Time(0), regionToWorldTf);
+    } catch(tf::TransformException& ex){
+      ROS_WARN_STREAM_THROTTLE(5.0, "Cannot update region of interest \"" << name << "\": " << ex.what());
+      return;
+    }
+
+    // axis-aligned bounds of the transformed box:
+    for (unsigned c = 0; c < 8; ++c){
+      tf::Point corner((c & 1) ? region.max.x() : region.min.x(),
+                       (c & 2) ? region.max.y() : region.min.y(),
+                       (c & 4) ? region.max.z() : region.min.z());
+      point3d p = pointTfToOctomap(regionToWorldTf * corner);
+      for (unsigned i = 0; i < 3; ++i){
+        min(i) = (c == 0) ? p(i) : std::min(min(i), p(i));
+        max(i) = (c == 0) ? p(i) : std::max(max(i), p(i));
+      }
+    }
+  }
+
+  if (!region.published || !(min == region.lastMin) || !(max == region.lastMax))
+    region.dirty = true;
+
+  if (!region.dirty || region.pub.getNumSubscribers() == 0)
+    return;
+
+  OcTreeKey minKey, maxKey;
+  if (!m_octree->coordToKeyChecked(min, minKey) || !m_octree->coordToKeyChecked(max, maxKey)){
+    ROS_WARN_STREAM_THROTTLE(5.0, "Region of interest \"" << name << "\" is out of the map bounds");
+    return;
+  }
+
+  OcTreeT regionTree(m_res);
+  regionTree.setProbHit(m_octree->getProbHit());
+  regionTree.setProbMiss(m_octree->getProbMiss());
+  regionTree.setClampingThresMin(m_octree->getClampingThresMin());
+  regionTree.setClampingThresMax(m_octree->getClampingThresMax());
+  {
+    boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+    copyLeafsBBX(*m_octree, minKey, maxKey, regionTree);
+  }
+
+  Octomap map;
+  map.header.frame_id = m_worldFrameId;
+  map.header.stamp = event.current_real;
+  bool ok = region.full ? octomap_msgs::fullMapToMsg(regionTree, map) : octomap_msgs::binaryMapToMsg(regionTree, map);
+  if (!ok){
+    ROS_ERROR("Error serializing region of interest \"%s\"", name.c_str());
+    return;
+  }
+
+  region.pub.publish(map);
+  region.dirty = false;
+  region.published = true;
+  region.lastMin = min;
+  region.lastMax = max;
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::markRegionsDirty(const point3d& min, const point3d& max){
+  for (std::map<std::string, RegionSubscription>::iterator it = m_regions.begin(); it != m_regions.end(); ++it){
+    RegionSubscription& region = it->second;
+    if (!region.published || region.dirty)
+      continue;
+
+    bool overlap = true;
+    for (unsigned i = 0; i < 3; ++i)
+      overlap = overlap && min(i) <= region.lastMax(i) && max(i) >= region.lastMin(i);
+
+    if (overlap)
+      region.dirty = true;
+  }
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::isSegmentFree(const point3d& start, const point3d& end, bool unknownIsOccupied, KeyRay& keyRay) const{
+  OcTreeKey endKey;
+  if (!m_octree->computeRayKeys(start, end, keyRay) || !m_octree->coordToKeyChecked(end, endKey))
+    return false; // leaves the map bounds
+
+  keyRay.addKey(endKey);
+  for (KeyRay::const_iterator it = keyRay.begin(); it != keyRay.end(); ++it){
+    typename OcTreeT::NodeType* node = m_octree->search(*it);
+    if (node ? m_octree->isNodeOccupied(node) : unknownIsOccupied)
+      return false;
+  }
+
+  return true;
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::updateLODCenter(){
+  tf::StampedTransform lodToWorldTf;
+  try {
+    m_tfListener.lookupTransform(m_worldFrameId, m_lodFrameId, ros::Time(0), lodToWorldTf);
+  } catch(tf::TransformException& ex){
+    ROS_WARN_STREAM_THROTTLE(5.0, "Cannot look up the LOD center, publishing at full depth: " << ex.what());
+    return false;
+  }
+
+  m_lodCenter = pointTfToOctomap(lodToWorldTf.getOrigin());
+  return true;
+}
+
+template <class TreeT, class PointT>
+unsigned OctomapServerT<TreeT, PointT>::lodDepth(const OcTreeKey& key) const{
+  // min. distance of the node at m_lodMinDepth around key:
+  point3d cellCenter = m_octree->keyToCoord(m_octree->adjustKeyAtDepth(key, m_lodMinDepth), m_lodMinDepth);
+  double halfSize = 0.5 * m_octree->getNodeSize(m_lodMinDepth);
+  double dist2 = 0.0;
+  for (unsigned i = 0; i < 3; ++i){
+    double d = std::max(std::fabs(cellCenter(i) - m_lodCenter(i)) - halfSize, 0.0);
+    dist2 += d * d;
+  }
+
+  double dist = std::sqrt(dist2);
+  if (dist < m_lodRadius)
+    return m_maxTreeDepth;
+
+  int levels = 1 + int(std::floor(std::log(dist / m_lodRadius) / std::log(2.0)));
+  return unsigned(std::max(int(std::min(m_lodMinDepth, m_maxTreeDepth)), int(m_maxTreeDepth) - levels));
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::isLODLeaf(const typename OcTreeT::NodeType* node, unsigned depth,
+                                              const OcTreeKey& nodeKey) const
+{
+  return !m_octree->nodeHasChildren(node)
+      || (depth >= std::min(m_lodMinDepth, m_maxTreeDepth) && depth >= lodDepth(nodeKey));
+}
+
+template <class TreeT, class PointT>
+bool OctomapServerT<TreeT, PointT>::lodMapToMsg(bool binary, Octomap& map) const{
+  map.resolution = m_octree->getResolution();
+  map.id = m_octree->getTreeType();
+  map.binary = binary;
+
+  std::stringstream datastream;
+  const typename OcTreeT::NodeType* root = m_octree->getRoot();
+  if (root){
+    OcTreeKey rootKey(m_octree->coordToKey(0.0), m_octree->coordToKey(0.0), m_octree->coordToKey(0.0));
+    if (binary)
+      writeLODBinaryRecurs(datastream, root, 0, rootKey);
+    else
+      writeLODFullRecurs(datastream, root, 0, rootKey);
+  }
+  if (!datastream)
+    return false;
+
+  std::string datastring = datastream.str();
+  map.data = std::vector<int8_t>(datastring.begin(), datastring.end());
+  return true;
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::writeLODBinaryRecurs(std::ostream& s, const typename OcTreeT::NodeType* node,
+                                                         unsigned depth, const OcTreeKey& nodeKey) const
+{
+  // 2 bits per child: 00 unknown, 10 free leaf, 01 occupied leaf, 11 inner node
+  octomap::key_type centerOffset = m_octree->coordToKey(0.0) >> (depth + 1);
+  OcTreeKey childKeys[8];
+  bool inner[8];
+  unsigned bits = 0;
+  for (unsigned i = 0; i < 8; ++i){
+    inner[i] = false;
+    if (!m_octree->nodeChildExists(node, i))
+      continue;
+
+    const typename OcTreeT::NodeType* child = m_octree->getNodeChild(node, i);
+    octomap::computeChildKey(i, centerOffset, nodeKey, childKeys[i]);
+    inner[i] = !isLODLeaf(child, depth + 1, childKeys[i]);
+    if (inner[i])
+      bits |= 3u << (2 * i);
+    else if (m_octree->isNodeOccupied(child))
+      bits |= 2u << (2 * i);
+    else
+      bits |= 1u << (2 * i);
+  }
+
+  char child1to4 = char(bits & 0xFF);
+  char child5to8 = char(bits >> 8);
+  s.write(&child1to4, sizeof(char));
+  s.write(&child5to8, sizeof(char));
+
+  for (unsigned i = 0; i < 8; ++i){
+    if (inner[i])
+      writeLODBinaryRecurs(s, m_octree->getNodeChild(node, i), depth + 1, childKeys[i]);
+  }
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::writeLODFullRecurs(std::ostream& s, const typename OcTreeT::NodeType* node,
+                                                       unsigned depth, const OcTreeKey& nodeKey) const
+{
+  // node data, then 1 bit per allocated child (none for a truncated node)
+  node->writeData(s);
+  if (isLODLeaf(node, depth, nodeKey)){
+    char children = 0;
+    s.write(&children, sizeof(char));
+    return;
+  }
+
+  unsigned bits = 0;
+  for (unsigned i = 0; i < 8; ++i){
+    if (m_octree->nodeChildExists(node, i))
+      bits |= 1u << i;
+  }
+  char children = char(bits);
+  s.write(&children, sizeof(char));
+
+  octomap::key_type centerOffset = m_octree->coordToKey(0.0) >> (depth + 1);
+  for (unsigned i = 0; i < 8; ++i){
+    if (!m_octree->nodeChildExists(node, i))
+      continue;
+
+    OcTreeKey childKey;
+    octomap::computeChildKey(i, centerOffset, nodeKey, childKey);
+    writeLODFullRecurs(s, m_octree->getNodeChild(node, i), depth + 1, childKey);
+  }
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishBinaryOctoMap(const ros::Time& rostime, bool lod) const{
 
   Octomap map;
   map.header.frame_id = m_worldFrameId;
   map.header.stamp = rostime;
 
-  if (octomap_msgs::binaryMapToMsg(*m_octree, map))
+  if (lod ? lodMapToMsg(true, map) : octomap_msgs::binaryMapToMsg(*m_octree, map))
     m_binaryMapPub.publish(map);
   else
     ROS_ERROR("Error serializing OctoMap");
 }
 
-void OctomapServer::publishFullOctoMap(const ros::Time& rostime) const{
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishFullOctoMap(const ros::Time& rostime, bool lod) const{
 
   Octomap map;
   map.header.frame_id = m_worldFrameId;
   map.header.stamp = rostime;
 
-  if (octomap_msgs::fullMapToMsg(*m_octree, map))
+  if (lod ? lodMapToMsg(false, map) : octomap_msgs::fullMapToMsg(*m_octree, map))
     m_fullMapPub.publish(map);
   else
     ROS_ERROR("Error serializing OctoMap");
@@ -824,7 +1568,195 @@ void OctomapServer::publishFullOctoMap(const ros::Time& rostime) const{
 }
 
 
-void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishEsdfSlice(const ros::Time& rostime) const{
+  OcTreeKey sliceKey;
+  if (!m_octree->coordToKeyChecked(point3d(0.0, 0.0, m_esdfSliceZ), sliceKey)){
+    ROS_ERROR("Distance field slice height %f is outside of the map bounds", m_esdfSliceZ);
+    return;
+  }
+
+  pcl::PointCloud<pcl::PointXYZI> slice;
+  const EsdfMap::CellMap& cells = m_esdf->getCells();
+  for (EsdfMap::CellMap::const_iterator it = cells.begin(); it != cells.end(); ++it){
+    if (it->first[2] != sliceKey[2])
+      continue;
+
+    point3d p = m_octree->keyToCoord(it->first);
+    pcl::PointXYZI point;
+    point.x = p.x();
+    point.y = p.y();
+    point.z = p.z();
+    point.intensity = m_esdf->getDistance(it->first);
+    slice.push_back(point);
+  }
+
+  sensor_msgs::PointCloud2 cloud;
+  pcl::toROSMsg(slice, cloud);
+  cloud.header.frame_id = m_worldFrameId;
+  cloud.header.stamp = rostime;
+  m_esdfSlicePub.publish(cloud);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishFrontiers(const ros::TimerEvent& event){
+  if (!m_frontiers->changed() || !(m_latchedTopics || m_frontierPub.getNumSubscribers() > 0))
+    return;
+
+  // intensity holds the cluster id:
+  pcl::PointCloud<pcl::PointXYZI> frontierCloud;
+  frontierCloud.reserve(m_frontiers->size());
+  const FrontierTracker::ClusterMap& clusters = m_frontiers->getClusters();
+  for (FrontierTracker::ClusterMap::const_iterator cluster = clusters.begin(); cluster != clusters.end(); ++cluster){
+    if (int(cluster->second.size()) < m_frontierMinClusterSize)
+      continue;
+
+    for (KeySet::const_iterator it = cluster->second.begin(); it != cluster->second.end(); ++it){
+      point3d p = m_octree->keyToCoord(*it);
+      pcl::PointXYZI point;
+      point.x = p.x();
+      point.y = p.y();
+      point.z = p.z();
+      point.intensity = cluster->first;
+      frontierCloud.push_back(point);
+    }
+  }
+
+  sensor_msgs::PointCloud2 cloud;
+  pcl::toROSMsg(frontierCloud, cloud);
+  cloud.header.frame_id = m_worldFrameId;
+  cloud.header.stamp = ros::Time::now();
+  m_frontierPub.publish(cloud);
+  m_frontiers->resetChanged();
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::decayCallback(const ros::TimerEvent& event){
+  double now = ros::Time::now().toSec();
+  std::vector<OcTreeKey> expired;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    m_decay->popExpired(now, expired);
+
+    m_freeCells.clear();
+    m_occupiedCells.clear();
+    for (unsigned i = 0; i < expired.size(); ++i){
+      bool occupied;
+      if (m_blocks){
+        float logOdds;
+        if (!m_blocks->search(expired[i], logOdds) || !m_blocks->isOccupied(logOdds))
+          continue; // cleared by an observation in the meantime
+
+        if (m_blocks->update(expired[i], float(-m_decayLogOdds), logOdds))
+          m_octree->setNodeValue(expired[i], logOdds);
+        occupied = m_blocks->isOccupied(logOdds);
+      } else{
+        OcTreeNode* node = m_octree->search(expired[i]);
+        if (!node || !m_octree->isNodeOccupied(node))
+          continue; // cleared by an observation in the meantime
+
+        node = m_octree->updateNode(expired[i], float(-m_decayLogOdds));
+        occupied = m_octree->isNodeOccupied(node);
+      }
+      m_occupiedCells.insert(expired[i]);
+
+      // keep decaying until free or observed again:
+      if (occupied)
+        m_decay->schedule(expired[i], now + m_decayPeriod);
+    }
+
+    if (m_occupiedCells.empty())
+      return;
+
+    m_updateBBXMin = *m_occupiedCells.begin();
+    m_updateBBXMax = m_updateBBXMin;
+    for (KeySet::const_iterator it = m_occupiedCells.begin(); it != m_occupiedCells.end(); ++it){
+      updateMinKey(*it, m_updateBBXMin);
+      updateMaxKey(*it, m_updateBBXMax);
+    }
+
+    if (m_compressMap)
+      m_octree->prune();
+
+    updateIncrementalLayers();
+  }
+
+  ROS_DEBUG("Decayed %zu voxels (%zu scheduled)", m_occupiedCells.size(), m_decay->size());
+  publishAll(ros::Time::now());
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::resetFrontiers(){
+  m_frontiers->clear();
+
+  for (typename OcTreeT::leaf_iterator it = m_octree->begin_leafs(), end = m_octree->end_leafs(); it != end; ++it){
+    if (!m_octree->isNodeOccupied(*it))
+      m_frontiers->markLeafBoundary(it.getIndexKey(), 1 << (m_treeDepth - it.getDepth()));
+  }
+  m_frontiers->update(*m_octree);
+  ROS_INFO("Found %zu frontier voxels in %zu clusters", m_frontiers->size(), m_frontiers->getClusters().size());
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::updateEsdf(){
+  // only the cells touched by the scan can have changed their occupancy:
+  for (KeySet::const_iterator it = m_occupiedCells.begin(); it != m_occupiedCells.end(); ++it){
+    OcTreeNode* node = m_octree->search(*it);
+    if (node && m_octree->isNodeOccupied(node))
+      m_esdf->setObstacle(*it);
+    else
+      m_esdf->removeObstacle(*it);
+  }
+
+  for (KeySet::const_iterator it = m_freeCells.begin(); it != m_freeCells.end(); ++it){
+    if (!m_esdf->isObstacle(*it))
+      continue; // can only turn from occupied to free
+
+    OcTreeNode* node = m_octree->search(*it);
+    if (!node || !m_octree->isNodeOccupied(node))
+      m_esdf->removeObstacle(*it);
+  }
+
+  m_esdf->update();
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::updateEsdfLeaf(const OcTreeKey& indexKey, unsigned depth, bool occupied){
+  // 2^(tree_depth-depth) voxels wide:
+  unsigned voxelWidth = (1 << (m_treeDepth - depth));
+  OcTreeKey key;
+  for (unsigned dz = 0; dz < voxelWidth; ++dz){
+    key[2] = indexKey[2] + dz;
+    for (unsigned dy = 0; dy < voxelWidth; ++dy){
+      key[1] = indexKey[1] + dy;
+      for (unsigned dx = 0; dx < voxelWidth; ++dx){
+        key[0] = indexKey[0] + dx;
+        if (occupied)
+          m_esdf->setObstacle(key);
+        else
+          m_esdf->removeObstacle(key);
+      }
+    }
+  }
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::resetEsdf(){
+  ros::WallTime startTime = ros::WallTime::now();
+  m_esdf->clear();
+
+  for (typename OcTreeT::leaf_iterator it = m_octree->begin_leafs(), end = m_octree->end_leafs(); it != end; ++it){
+    if (m_octree->isNodeOccupied(*it))
+      updateEsdfLeaf(it.getIndexKey(), it.getDepth(), true);
+  }
+  m_esdf->update();
+
+  double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+  ROS_INFO("Distance field built from %zu obstacles in %f sec", m_esdf->getObstacles().size(), total_elapsed);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
   ground.header = pc.header;
   nonground.header = pc.header;
 
@@ -933,7 +1865,8 @@ void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& gr
 
 }
 
-void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handlePreNodeTraversal(const ros::Time& rostime){
   if (m_publish2DMap){
     // init projected 2D map:
     m_gridmap.header.frame_id = m_worldFrameId;
@@ -972,10 +1905,21 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
       return;
     }
 
+    m_multires2DScale = 1 << (m_treeDepth - m_maxTreeDepth);
+
+    // grow the map in whole chunks, so that it only rarely needs to be resized:
+    if (m_mapChunkSize > 1){
+      unsigned chunkKeys = m_mapChunkSize * m_multires2DScale;
+      for (unsigned i = 0; i < 2; ++i){
+        m_paddedMinKey[i] = (m_paddedMinKey[i] / chunkKeys) * chunkKeys;
+        paddedMaxKey[i] = std::min(unsigned(std::numeric_limits<key_type>::max()),
+                                   (paddedMaxKey[i] / chunkKeys + 1) * chunkKeys - 1);
+      }
+    }
+
     ROS_DEBUG("Padded MinKey: %d %d %d / padded MaxKey: %d %d %d", m_paddedMinKey[0], m_paddedMinKey[1], m_paddedMinKey[2], paddedMaxKey[0], paddedMaxKey[1], paddedMaxKey[2]);
     assert(paddedMaxKey[0] >= maxKey[0] && paddedMaxKey[1] >= maxKey[1]);
 
-    m_multires2DScale = 1 << (m_treeDepth - m_maxTreeDepth);
     m_gridmap.info.width = (paddedMaxKey[0] - m_paddedMinKey[0])/m_multires2DScale +1;
     m_gridmap.info.height = (paddedMaxKey[1] - m_paddedMinKey[1])/m_multires2DScale +1;
 
@@ -1000,6 +1944,14 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
     if (m_maxTreeDepth < m_treeDepth)
       m_projectCompleteMap = true;
 
+    // nothing to adjust yet:
+    if (m_gridmap.data.empty())
+      m_projectCompleteMap = true;
+
+    // the column index only covers the max. tree depth:
+    m_columnProjection = (m_columns && m_maxTreeDepth == m_treeDepth);
+
+    m_mapResized = false;
 
     if(m_projectCompleteMap){
       ROS_DEBUG("Rebuilding complete 2D map");
@@ -1012,6 +1964,7 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
        if (mapChanged(oldMapInfo, m_gridmap.info)){
           ROS_DEBUG("2D grid map size changed to %dx%d", m_gridmap.info.width, m_gridmap.info.height);
           adjustMapData(m_gridmap, oldMapInfo);
+          m_mapResized = true;
        }
        nav_msgs::OccupancyGrid::_data_type::iterator startIt;
        size_t mapUpdateBBXMinX = std::max(0, (int(m_updateBBXMin[0]) - int(m_paddedMinKey[0]))/int(m_multires2DScale));
@@ -1029,12 +1982,19 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
        if (max_idx  >= m_gridmap.data.size())
          ROS_ERROR("BBX index not valid: %d (max index %zu for size %d x %d) update-BBX is: [%zu %zu]-[%zu %zu]", max_idx, m_gridmap.data.size(), m_gridmap.info.width, m_gridmap.info.height, mapUpdateBBXMinX, mapUpdateBBXMinY, mapUpdateBBXMaxX, mapUpdateBBXMaxY);
 
-       // reset proj. 2D map in bounding box:
-       for (unsigned int j = mapUpdateBBXMinY; j <= mapUpdateBBXMaxY; ++j){
-          std::fill_n(m_gridmap.data.begin() + m_gridmap.info.width*j+mapUpdateBBXMinX,
-                      numCols, -1);
+       // reset proj. 2D map in bounding box (changed columns overwrite their cells):
+       if (!m_columnProjection){
+         for (unsigned int j = mapUpdateBBXMinY; j <= mapUpdateBBXMaxY; ++j){
+            std::fill_n(m_gridmap.data.begin() + m_gridmap.info.width*j+mapUpdateBBXMinX,
+                        numCols, -1);
+         }
        }
 
+       m_mapUpdateMinX = mapUpdateBBXMinX;
+       m_mapUpdateMinY = mapUpdateBBXMinY;
+       m_mapUpdateMaxX = mapUpdateBBXMaxX;
+       m_mapUpdateMaxY = mapUpdateBBXMaxY;
+
     }
 
 
@@ -1043,41 +2003,161 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
 
 }
 
-void OctomapServer::handlePostNodeTraversal(const ros::Time& rostime){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handlePostNodeTraversal(const ros::Time& rostime){
+
+  if (m_publish2DMap && m_columnProjection)
+    projectColumns();
+  if (m_publishTraversability)
+    updateTraversabilityMap();
+  if (m_columns)
+    m_columns->clearChanged();
+
+  if (!m_publish2DMap)
+    return;
 
-  if (m_publish2DMap)
+  if (!m_partialMapUpdates || m_projectCompleteMap || m_mapResized)
     m_mapPub.publish(m_gridmap);
+  else // only send the re-projected area:
+    publishGridUpdate(m_mapUpdatesPub, m_gridmap, m_mapUpdateMinX, m_mapUpdateMinY, m_mapUpdateMaxX, m_mapUpdateMaxY);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::publishGridUpdate(const ros::Publisher& pub, const nav_msgs::OccupancyGrid& map,
+                                      unsigned minX, unsigned minY, unsigned maxX, unsigned maxY) const
+{
+  map_msgs::OccupancyGridUpdate update;
+  update.header = map.header;
+  update.x = minX;
+  update.y = minY;
+  update.width = maxX - minX + 1;
+  update.height = maxY - minY + 1;
+  update.data.reserve(update.width * update.height);
+  for (unsigned j = minY; j <= maxY; ++j){
+    nav_msgs::OccupancyGrid::_data_type::const_iterator rowStart = map.data.begin() + map.info.width * j + minX;
+    update.data.insert(update.data.end(), rowStart, rowStart + update.width);
+  }
+
+  pub.publish(update);
 }
 
-void OctomapServer::handleOccupiedNode(const OcTreeT::iterator& it){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::updateTraversabilityMap(){
+  if (m_maxTreeDepth != m_treeDepth){
+    ROS_WARN_THROTTLE(10.0, "Traversability map is only available at the full tree depth");
+    return;
+  }
+
+  bool complete = m_projectCompleteMap || m_traversabilityMap.data.empty();
+  bool resized = false;
+  if (!complete && mapChanged(m_traversabilityMap.info, m_gridmap.info)){
+    nav_msgs::MapMetaData oldMapInfo = m_traversabilityMap.info;
+    m_traversabilityMap.info = m_gridmap.info;
+    adjustMapData(m_traversabilityMap, oldMapInfo);
+    resized = true;
+  }
+  m_traversabilityMap.header = m_gridmap.header;
+  m_traversabilityMap.info = m_gridmap.info;
+
+  const int width = m_traversabilityMap.info.width;
+  const int height = m_traversabilityMap.info.height;
+  int minX = width, minY = height, maxX = -1, maxY = -1;
+
+  if (complete){
+    m_traversabilityMap.data.assign(width * height, -1);
+    const ColumnIndex::ColumnMap& columns = m_columns->getColumns();
+    for (ColumnIndex::ColumnMap::const_iterator it = columns.begin(); it != columns.end(); ++it){
+      int i = int(ColumnIndex::columnX(it->first)) - int(m_paddedMinKey[0]);
+      int j = int(ColumnIndex::columnY(it->first)) - int(m_paddedMinKey[1]);
+      if (i >= 0 && j >= 0 && i < width && j < height)
+        m_traversabilityMap.data[mapIdx(i, j)] = m_traversability->cost(ColumnIndex::columnX(it->first), ColumnIndex::columnY(it->first));
+    }
+  } else{
+    // costs depend on the neighborhood, so re-evaluate around each changed column:
+    ColumnIndex::ColumnSet cells;
+    const std::vector<uint32_t>& changed = m_columns->getChanged();
+    const int r = m_traversability->radius();
+    const int maxKey = std::numeric_limits<key_type>::max();
+    for (unsigned c = 0; c < changed.size(); ++c){
+      const int x = ColumnIndex::columnX(changed[c]);
+      const int y = ColumnIndex::columnY(changed[c]);
+      // the neighborhood ends at the map bounds, the keys would wrap around:
+      for (int ny = std::max(y - r, 0); ny <= std::min(y + r, maxKey); ++ny){
+        for (int nx = std::max(x - r, 0); nx <= std::min(x + r, maxKey); ++nx)
+          cells.insert(ColumnIndex::columnKey(nx, ny));
+      }
+    }
+
+    for (ColumnIndex::ColumnSet::const_iterator it = cells.begin(); it != cells.end(); ++it){
+      int i = int(ColumnIndex::columnX(*it)) - int(m_paddedMinKey[0]);
+      int j = int(ColumnIndex::columnY(*it)) - int(m_paddedMinKey[1]);
+      if (i < 0 || j < 0 || i >= width || j >= height)
+        continue;
+
+      m_traversabilityMap.data[mapIdx(i, j)] = m_traversability->cost(ColumnIndex::columnX(*it), ColumnIndex::columnY(*it));
+      minX = std::min(minX, i);
+      minY = std::min(minY, j);
+      maxX = std::max(maxX, i);
+      maxY = std::max(maxY, j);
+    }
+  }
 
-  if (m_publish2DMap && m_projectCompleteMap){
+  if (!m_partialMapUpdates || complete || resized)
+    m_traversabilityPub.publish(m_traversabilityMap);
+  else if (maxX >= 0)
+    publishGridUpdate(m_traversabilityUpdatesPub, m_traversabilityMap, minX, minY, maxX, maxY);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::mapConnectCallback(const ros::SingleSubscriberPublisher& pub, const nav_msgs::OccupancyGrid* map){
+  // late subscribers need the full map to apply the updates to:
+  if (!map->data.empty())
+    pub.publish(*map);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::meshConnectCallback(const ros::SingleSubscriberPublisher& pub){
+  boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+  visualization_msgs::MarkerArray meshVis;
+  m_mesher->getAllMarkers(meshVis, m_worldFrameId, ros::Time::now(), m_color);
+  if (!meshVis.markers.empty())
+    pub.publish(meshVis);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handleOccupiedNode(const typename OcTreeT::iterator& it){
+
+  if (m_publish2DMap && m_projectCompleteMap && !m_columnProjection){
     update2DMap(it, true);
   }
 }
 
-void OctomapServer::handleFreeNode(const OcTreeT::iterator& it){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handleFreeNode(const typename OcTreeT::iterator& it){
 
-  if (m_publish2DMap && m_projectCompleteMap){
+  if (m_publish2DMap && m_projectCompleteMap && !m_columnProjection){
     update2DMap(it, false);
   }
 }
 
-void OctomapServer::handleOccupiedNodeInBBX(const OcTreeT::iterator& it){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handleOccupiedNodeInBBX(const typename OcTreeT::iterator& it){
 
-  if (m_publish2DMap && !m_projectCompleteMap){
+  if (m_publish2DMap && !m_projectCompleteMap && !m_columnProjection){
     update2DMap(it, true);
   }
 }
 
-void OctomapServer::handleFreeNodeInBBX(const OcTreeT::iterator& it){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::handleFreeNodeInBBX(const typename OcTreeT::iterator& it){
 
-  if (m_publish2DMap && !m_projectCompleteMap){
+  if (m_publish2DMap && !m_projectCompleteMap && !m_columnProjection){
     update2DMap(it, false);
   }
 }
 
-void OctomapServer::update2DMap(const OcTreeT::iterator& it, bool occupied){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::update2DMap(const typename OcTreeT::iterator& it, bool occupied){
 
   // update 2D map (occupied always overrides):
 
@@ -1110,34 +2190,104 @@ void OctomapServer::update2DMap(const OcTreeT::iterator& it, bool occupied){
 
 
 
-bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) const {
-  OcTreeKey key;
-  bool neighborFound = false;
-  for (key[2] = nKey[2] - 1; !neighborFound && key[2] <= nKey[2] + 1; ++key[2]){
-    for (key[1] = nKey[1] - 1; !neighborFound && key[1] <= nKey[1] + 1; ++key[1]){
-      for (key[0] = nKey[0] - 1; !neighborFound && key[0] <= nKey[0] + 1; ++key[0]){
-        if (key != nKey){
-          OcTreeNode* node = m_octree->search(key);
-          if (node && m_octree->isNodeOccupied(node)){
-            // we have a neighbor => break!
-            neighborFound = true;
-          }
-        }
-      }
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::update2DMapColumn(unsigned idx, const ColumnIndex::Column& column){
+  // as in update2DMap(), the voxel centers have to be inside (m_occupancyMinZ, m_occupancyMaxZ):
+  key_type lo, hi;
+  zKeyRange(m_occupancyMinZ, m_occupancyMaxZ, lo, hi, true);
+  m_gridmap.data[idx] = ColumnIndex::classify(column, lo, hi);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::projectColumns(){
+  const ColumnIndex::ColumnMap& columns = m_columns->getColumns();
+  const ColumnIndex::Column unknownColumn;
+
+  if (m_projectCompleteMap){
+    for (ColumnIndex::ColumnMap::const_iterator it = columns.begin(); it != columns.end(); ++it){
+      int i = int(ColumnIndex::columnX(it->first)) - int(m_paddedMinKey[0]);
+      int j = int(ColumnIndex::columnY(it->first)) - int(m_paddedMinKey[1]);
+      if (i >= 0 && j >= 0 && unsigned(i) < m_gridmap.info.width && unsigned(j) < m_gridmap.info.height)
+        update2DMapColumn(mapIdx(i, j), it->second);
+    }
+  } else{
+    const std::vector<uint32_t>& changed = m_columns->getChanged();
+    for (unsigned c = 0; c < changed.size(); ++c){
+      int i = int(ColumnIndex::columnX(changed[c])) - int(m_paddedMinKey[0]);
+      int j = int(ColumnIndex::columnY(changed[c])) - int(m_paddedMinKey[1]);
+      if (i < 0 || j < 0 || unsigned(i) >= m_gridmap.info.width || unsigned(j) >= m_gridmap.info.height)
+        continue;
+
+      ColumnIndex::ColumnMap::const_iterator it = columns.find(changed[c]);
+      update2DMapColumn(mapIdx(i, j), (it != columns.end()) ? it->second : unknownColumn);
     }
   }
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::resetColumns(){
+  m_columns->clear();
+
+  for (typename OcTreeT::leaf_iterator it = m_octree->begin_leafs(), end = m_octree->end_leafs(); it != end; ++it){
+    OcTreeKey minKey = it.getIndexKey();
+    OcTreeKey maxKey = minKey;
+    unsigned voxelWidth = 1 << (m_treeDepth - it.getDepth());
+    maxKey[0] += voxelWidth - 1;
+    maxKey[1] += voxelWidth - 1;
+    m_columns->markDirty(minKey, maxKey);
+  }
+  m_columns->update(*m_octree);
+}
+
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::zKeyRange(double minZ, double maxZ, key_type& lo, key_type& hi, bool centers) const{
+  // voxels touching the range, -1 / max + 1 beyond the map bounds:
+  const int maxKey = std::numeric_limits<key_type>::max();
+  OcTreeKey key;
+  int first = m_octree->coordToKeyChecked(point3d(0.0, 0.0, minZ), key) ? key[2] : ((minZ > 0.0) ? maxKey + 1 : 0);
+  int last = m_octree->coordToKeyChecked(point3d(0.0, 0.0, maxZ), key) ? key[2] : ((maxZ < 0.0) ? -1 : maxKey);
+  if (centers){
+    if (first <= maxKey && m_octree->keyToCoord(key_type(first)) <= minZ)
+      first++;
+    if (last >= 0 && m_octree->keyToCoord(key_type(last)) >= maxZ)
+      last--;
+  }
 
-  return neighborFound;
+  first = std::max(first, 0);
+  last = std::min(last, maxKey);
+  if (first > last){
+    lo = 1;
+    hi = 0;
+  } else{
+    lo = key_type(first);
+    hi = key_type(last);
+  }
 }
 
-void OctomapServer::reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level){
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level){
   if (m_maxTreeDepth != unsigned(config.max_depth))
     m_maxTreeDepth = unsigned(config.max_depth);
   else{
     m_pointcloudMinZ            = config.pointcloud_min_z;
     m_pointcloudMaxZ            = config.pointcloud_max_z;
+    if (!is_equal(m_occupancyMinZ, config.occupancy_min_z) || !is_equal(m_occupancyMaxZ, config.occupancy_max_z)){
+      // every column is classified against the new range, the incremental projection only visits changed ones:
+      boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+      m_gridmap.data.clear();
+    }
     m_occupancyMinZ             = config.occupancy_min_z;
     m_occupancyMaxZ             = config.occupancy_max_z;
+    if (config.filter_speckles != m_filterSpeckles){
+      boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+      if (config.filter_speckles){
+        m_speckles = new SpeckleFilter();
+        m_speckles->markOccupied(*m_octree);
+      } else{
+        delete m_speckles;
+        m_speckles = NULL;
+      }
+    }
     m_filterSpeckles            = config.filter_speckles;
     m_filterGroundPlane         = config.filter_ground;
     m_compressMap               = config.compress_map;
@@ -1183,12 +2333,15 @@ void OctomapServer::reconfigureCallback(octomap_server::OctomapServerConfig& con
 	  if (is_equal(config.sensor_model_miss, 0.0))
 		config.sensor_model_miss += 1.0e-6;
       m_octree->setProbMiss(config.sensor_model_miss);
+      if (m_blocks)
+        m_blocks->setSensorModel(*m_octree);
 	}
   }
   publishAll();
 }
 
-void OctomapServer::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::MapMetaData& oldMapInfo) const{
+template <class TreeT, class PointT>
+void OctomapServerT<TreeT, PointT>::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::MapMetaData& oldMapInfo) const{
   if (map.info.resolution != oldMapInfo.resolution){
     ROS_ERROR("Resolution of map changed, cannot be adjusted");
     return;
@@ -1205,9 +2358,15 @@ void OctomapServer::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::
     return;
   }
 
-  nav_msgs::OccupancyGrid::_data_type oldMapData = map.data;
+  // map only grew at the end (same origin and width), no need to move the rows:
+  if (i_off == 0 && j_off == 0 && oldMapInfo.width == map.info.width){
+    map.data.resize(map.info.width * map.info.height, -1);
+    return;
+  }
+
+  nav_msgs::OccupancyGrid::_data_type oldMapData;
+  oldMapData.swap(map.data);
 
-  map.data.clear();
   // init to unknown:
   map.data.resize(map.info.width * map.info.height, -1);
 
@@ -1229,7 +2388,8 @@ void OctomapServer::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::
 }
 
 
-std_msgs::ColorRGBA OctomapServer::heightMapColor(double h) {
+template <class TreeT, class PointT>
+std_msgs::ColorRGBA OctomapServerT<TreeT, PointT>::heightMapColor(double h) {
 
   std_msgs::ColorRGBA color;
   color.a = 1.0;
@@ -1277,7 +2437,10 @@ std_msgs::ColorRGBA OctomapServer::heightMapColor(double h) {
 
   return color;
 }
-}
-
 
+// the supported tree / point types:
+template class OctomapServerT<octomap::OcTree, pcl::PointXYZ>;
+template class OctomapServerT<octomap::ColorOcTree, pcl::PointXYZRGB>;
+template class OctomapServerT<octomap::OcTreeStamped, pcl::PointXYZ>;
 
+}
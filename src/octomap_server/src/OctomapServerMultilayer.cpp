@@ -209,14 +209,6 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
   double z = it.getZ();
   double s2 = it.getSize()/2.0;
 
-  // create a mask on which maps to update:
-  std::vector<bool> inMapLevel(m_multiGridmap.size(), false);
-  for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
-    if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ){
-      inMapLevel[i] = true;
-    }
-  }
-
   if (it.getDepth() == m_maxTreeDepth){
     unsigned idx = mapIdx(it.getKey());
     if (occupied)
@@ -225,8 +217,8 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
       m_gridmap.data[idx] = 0;
     }
 
-    for (unsigned i = 0; i < inMapLevel.size(); ++i){
-      if (inMapLevel[i]){
+    for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
+      if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ){
         if (occupied)
           m_multiGridmap[i].map.data[idx] = 100;
         else if (m_multiGridmap[i].map.data[idx] == -1)
@@ -247,8 +239,8 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
           m_gridmap.data[idx] = 0;
         }
 
-        for (unsigned i = 0; i < inMapLevel.size(); ++i){
-          if (inMapLevel[i]){
+        for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
+          if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ){
             if (occupied)
               m_multiGridmap[i].map.data[idx] = 100;
             else if (m_multiGridmap[i].map.data[idx] == -1)
@@ -262,7 +254,14 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
 
 }
 
-}
-
+void OctomapServerMultilayer::update2DMapColumn(unsigned idx, const ColumnIndex::Column& column){
+  OctomapServer::update2DMapColumn(idx, column);
 
+  for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
+    octomap::key_type lo, hi;
+    zKeyRange(m_multiGridmap[i].minZ, m_multiGridmap[i].maxZ, lo, hi);
+    m_multiGridmap[i].map.data[idx] = ColumnIndex::classify(column, lo, hi);
+  }
+}
 
+}
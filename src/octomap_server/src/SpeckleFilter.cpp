@@ -0,0 +1,30 @@
+/**
+* SpeckleFilter: incremental detection of isolated occupied voxels for the
+* octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/SpeckleFilter.h>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+SpeckleFilter::SpeckleFilter()
+{
+}
+
+void SpeckleFilter::markTouched(const KeySet& keys){
+  m_touched.insert(keys.begin(), keys.end());
+}
+
+void SpeckleFilter::markTouched(const std::vector<OcTreeKey>& keys){
+  m_touched.insert(keys.begin(), keys.end());
+}
+
+void SpeckleFilter::clear(){
+  m_touched.clear();
+  m_speckles.clear();
+}
+
+}
@@ -0,0 +1,60 @@
+/**
+* Submap: local octree of one keyframe for the SubmapOctomapServer
+* License: BSD
+*/
+
+#include <octomap_server/Submap.h>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+Submap::Submap(const OcTreeT& params, double maxRange)
+: OctomapMapper()
+{
+  m_octree = new OcTreeT(params.getResolution());
+  m_octree->setProbHit(params.getProbHit());
+  m_octree->setProbMiss(params.getProbMiss());
+  m_octree->setClampingThresMin(params.getClampingThresMin());
+  m_octree->setClampingThresMax(params.getClampingThresMax());
+  m_res = m_octree->getResolution();
+  m_treeDepth = m_octree->getTreeDepth();
+  m_maxTreeDepth = m_treeDepth;
+  m_maxRange = maxRange;
+  m_compressMap = false;
+  m_pruneTree = false;
+}
+
+void Submap::insertLocalScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground,
+                             std::vector<Delta>& deltas){
+  computeScanUpdate(sensorOrigin, ground, nonground);
+
+  // same selection as applyScanUpdate(): free cells only if not seen occupied
+  deltas.clear();
+  deltas.reserve(m_freeCells.size() + m_occupiedCells.size());
+  Delta delta;
+  for (KeySet::const_iterator it = m_freeCells.begin(); it != m_freeCells.end(); ++it){
+    if (m_occupiedCells.find(*it) == m_occupiedCells.end()){
+      delta.key = *it;
+      deltas.push_back(delta);
+    }
+  }
+  for (KeySet::const_iterator it = m_occupiedCells.begin(); it != m_occupiedCells.end(); ++it){
+    delta.key = *it;
+    deltas.push_back(delta);
+  }
+
+  for (unsigned i = 0; i < deltas.size(); ++i){
+    OcTreeT::NodeType* node = m_octree->search(deltas[i].key);
+    deltas[i].added = (node == NULL);
+    deltas[i].logOdds = node ? -node->getLogOdds() : 0.0f;
+  }
+
+  applyScanUpdate();
+
+  // the tree is not pruned, all updated voxels exist as leafs now:
+  for (unsigned i = 0; i < deltas.size(); ++i)
+    deltas[i].logOdds += m_octree->search(deltas[i].key)->getLogOdds();
+}
+
+}
@@ -0,0 +1,341 @@
+/**
+* SubmapOctomapServer: octomap_server composing the map from keyframe submaps
+* License: BSD
+*/
+
+#include <octomap_server/SubmapOctomapServer.h>
+
+#include <limits>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+SubmapOctomapServer::SubmapOctomapServer(ros::NodeHandle private_nh_)
+: OctomapServer(private_nh_),
+  m_composition(m_octree),
+  m_epoch(0),
+  m_composeThread(NULL),
+  m_shutdown(false),
+  m_poseTolerance(0.05),
+  m_angleTolerance(0.02)
+{
+  ros::NodeHandle private_nh(private_nh_);
+  double commitPeriod = 0.5;
+  private_nh.param("submap/pose_tolerance", m_poseTolerance, m_poseTolerance);
+  private_nh.param("submap/angle_tolerance", m_angleTolerance, m_angleTolerance);
+  private_nh.param("submap/commit_period", commitPeriod, commitPeriod);
+
+  // the incremental layers are fed by OctomapServer::insertScan(), which is bypassed here:
+  if (m_esdf || m_frontiers || m_columns){
+    ROS_WARN("The distance field, frontiers, column index and traversability are not supported in submap mode, disabling them");
+    m_frontierTimer.stop();
+    m_distancesService.shutdown();
+    if (m_esdf){
+      delete m_esdf;
+      m_esdf = NULL;
+    }
+    if (m_frontiers){
+      delete m_frontiers;
+      m_frontiers = NULL;
+    }
+    if (m_traversability){
+      delete m_traversability;
+      m_traversability = NULL;
+    }
+    if (m_columns){
+      delete m_columns;
+      m_columns = NULL;
+    }
+  }
+
+  // expiry needs the cells of each scan in map coordinates, which only the submaps see:
+  if (m_decay){
+    ROS_WARN("Decay of occupied voxels is not supported in submap mode, disabling it");
+    m_decayTimer.stop();
+    delete m_decay;
+    m_decay = NULL;
+  }
+
+  // the map is composed directly in m_octree:
+  if (m_blocks){
+    ROS_WARN("The voxel_blocks backend is not supported in submap mode, using the octree");
+    delete m_blocks;
+    m_blocks = NULL;
+  }
+
+  // clearing would be overwritten by the next composition:
+  m_clearBBXService.shutdown();
+  m_resetService.shutdown();
+  m_resetService = private_nh.advertiseService("reset", &SubmapOctomapServer::resetSrv, this);
+
+  m_keyframeSub = m_nh.subscribe("keyframe_poses", 5, &SubmapOctomapServer::keyframeCallback, this);
+  m_commitTimer = m_nh.createTimer(ros::Duration(commitPeriod), &SubmapOctomapServer::commitRecompositions, this);
+  m_composeThread = new boost::thread(boost::bind(&SubmapOctomapServer::composeThread, this));
+}
+
+SubmapOctomapServer::~SubmapOctomapServer(){
+  if (m_composeThread){
+    {
+      boost::lock_guard<boost::mutex> lock(m_composeMutex);
+      m_shutdown = true;
+    }
+    m_composeCondition.notify_all();
+    m_composeThread->join();
+    delete m_composeThread;
+    m_composeThread = NULL;
+  }
+
+  for (unsigned i = 0; i < m_recompositions.size(); ++i)
+    delete m_recompositions[i];
+  m_recompositions.clear();
+
+  for (unsigned i = 0; i < m_submaps.size(); ++i)
+    delete m_submaps[i];
+  m_submaps.clear();
+}
+
+void SubmapOctomapServer::keyframeCallback(const nav_msgs::Path::ConstPtr& path){
+  if (!path->header.frame_id.empty() && path->header.frame_id != m_worldFrameId)
+    ROS_WARN_THROTTLE(5.0, "Keyframe poses are in frame %s, expected %s", path->header.frame_id.c_str(), m_worldFrameId.c_str());
+
+  std::vector<unsigned> changed;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    if (path->poses.size() < m_submaps.size())
+      ROS_WARN("Received %zu keyframe poses for %zu submaps, keeping the others", path->poses.size(), m_submaps.size());
+
+    for (unsigned i = 0; i < path->poses.size(); ++i){
+      tf::Pose pose;
+      tf::poseMsgToTF(path->poses[i].pose, pose);
+
+      if (i >= m_submaps.size()){
+        m_submaps.push_back(new Submap(*m_octree, m_maxRange));
+        m_targetPoses.push_back(pose);
+        m_appliedPoses.push_back(pose);
+        ROS_DEBUG("Created submap %u", i);
+      } else if (poseChanged(m_targetPoses[i], pose)){
+        m_targetPoses[i] = pose;
+        changed.push_back(i);
+      }
+    }
+  }
+
+  if (!changed.empty()){
+    ROS_DEBUG("%zu submap poses changed, recomposing", changed.size());
+    {
+      boost::lock_guard<boost::mutex> lock(m_composeMutex);
+      m_pendingSubmaps.insert(changed.begin(), changed.end());
+    }
+    m_composeCondition.notify_one();
+  }
+}
+
+void SubmapOctomapServer::insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  OcTreeKey originKey = m_octree->coordToKey(pointTfToOctomap(sensorOrigin));
+  m_updateBBXMin = originKey;
+  m_updateBBXMax = originKey;
+
+  if (m_submaps.empty()){
+    ROS_WARN_THROTTLE(5.0, "No keyframe received on keyframe_poses yet, dropping scan");
+    return;
+  }
+
+  // scans go into the current submap, in its frame:
+  unsigned current = m_submaps.size() - 1;
+  tf::Transform worldToSubmap = m_targetPoses[current].inverse();
+  Eigen::Matrix4f worldToSubmapMatrix;
+  pcl_ros::transformAsMatrix(worldToSubmap, worldToSubmapMatrix);
+
+  PCLPointCloud localGround, localNonground;
+  pcl::transformPointCloud(ground, localGround, worldToSubmapMatrix);
+  pcl::transformPointCloud(nonground, localNonground, worldToSubmapMatrix);
+
+  std::vector<Submap::Delta> deltas;
+  m_submaps[current]->insertLocalScan(worldToSubmap * sensorOrigin, localGround, localNonground, deltas);
+
+  // the composition contains the submap at its applied pose:
+  const tf::Pose& pose = m_appliedPoses[current];
+  OcTreeKey key;
+  for (unsigned i = 0; i < deltas.size(); ++i){
+    if (worldKey(deltas[i].key, pose, key))
+      m_composition.add(key, deltas[i].logOdds, deltas[i].added ? 1 : 0);
+  }
+
+  OcTreeKey min(std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max());
+  OcTreeKey max(0, 0, 0);
+  std::vector<OcTreeKey> changed;
+  if (m_composition.commit(min, max, &changed) > 0){
+    m_updateBBXMin = min;
+    m_updateBBXMax = max;
+    if (m_speckles)
+      m_speckles->markTouched(changed);
+    if (m_mesher)
+      m_mesher->markTouched(changed);
+  }
+
+  if (m_compressMap)
+    m_octree->prune();
+}
+
+bool SubmapOctomapServer::openFile(const std::string& filename){
+  ROS_ERROR("Loading %s: maps cannot be loaded in submap mode", filename.c_str());
+  return false;
+}
+
+bool SubmapOctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp){
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    for (unsigned i = 0; i < m_submaps.size(); ++i)
+      delete m_submaps[i];
+    m_submaps.clear();
+    m_targetPoses.clear();
+    m_appliedPoses.clear();
+    m_composition.clear();
+    ++m_epoch;
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(m_composeMutex);
+    m_pendingSubmaps.clear();
+    for (unsigned i = 0; i < m_recompositions.size(); ++i)
+      delete m_recompositions[i];
+    m_recompositions.clear();
+  }
+
+  return OctomapServer::resetSrv(req, resp);
+}
+
+void SubmapOctomapServer::composeThread(){
+  while (true){
+    unsigned id;
+    {
+      boost::unique_lock<boost::mutex> lock(m_composeMutex);
+      while (m_pendingSubmaps.empty() && !m_shutdown)
+        m_composeCondition.wait(lock);
+
+      if (m_shutdown)
+        return;
+
+      id = *m_pendingSubmaps.begin();
+      m_pendingSubmaps.erase(m_pendingSubmaps.begin());
+    }
+
+    ros::WallTime startTime = ros::WallTime::now();
+    Recomposition* recomposition = new Recomposition();
+    std::vector<OcTreeKey> localKeys;
+    tf::Pose oldPose, newPose;
+    {
+      // scans are only inserted under the exclusive lock, so the submap is stable here:
+      boost::shared_lock<boost::shared_mutex> lock(m_octreeMutex);
+      if (id >= m_submaps.size()){
+        delete recomposition;
+        continue;
+      }
+
+      recomposition->epoch = m_epoch;
+      oldPose = m_appliedPoses[id];
+      newPose = m_targetPoses[id];
+      // from now on, new scans of this submap are added at the new pose (only this thread
+      // writes m_appliedPoses without holding the exclusive lock):
+      m_appliedPoses[id] = newPose;
+
+      const OcTreeT& tree = m_submaps[id]->getTree();
+      localKeys.reserve(tree.getNumLeafNodes());
+      recomposition->logOdds.reserve(tree.getNumLeafNodes());
+      for (OcTreeT::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it){
+        localKeys.push_back(it.getKey());
+        recomposition->logOdds.push_back(it->getLogOdds());
+      }
+    }
+
+    int numVoxels = localKeys.size();
+    recomposition->oldKeys.resize(numVoxels);
+    recomposition->newKeys.resize(numVoxels);
+    recomposition->oldValid.resize(numVoxels);
+    recomposition->newValid.resize(numVoxels);
+
+    #pragma omp parallel for
+    for (int i = 0; i < numVoxels; ++i){
+      recomposition->oldValid[i] = worldKey(localKeys[i], oldPose, recomposition->oldKeys[i]);
+      recomposition->newValid[i] = worldKey(localKeys[i], newPose, recomposition->newKeys[i]);
+    }
+
+    ROS_DEBUG("Recomposed submap %u (%d voxels) in %f sec", id, numVoxels, (ros::WallTime::now() - startTime).toSec());
+
+    boost::lock_guard<boost::mutex> lock(m_composeMutex);
+    m_recompositions.push_back(recomposition);
+  }
+}
+
+void SubmapOctomapServer::commitRecompositions(const ros::TimerEvent& event){
+  std::vector<Recomposition*> recompositions;
+  {
+    boost::lock_guard<boost::mutex> lock(m_composeMutex);
+    recompositions.swap(m_recompositions);
+  }
+
+  if (recompositions.empty())
+    return;
+
+  size_t numChanged = 0;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(m_octreeMutex);
+    // in the order computed, a submap may have moved more than once:
+    for (unsigned r = 0; r < recompositions.size(); ++r){
+      const Recomposition& recomposition = *recompositions[r];
+      if (recomposition.epoch != m_epoch)
+        continue;
+
+      for (unsigned i = 0; i < recomposition.logOdds.size(); ++i){
+        if (recomposition.oldValid[i])
+          m_composition.add(recomposition.oldKeys[i], -recomposition.logOdds[i], -1);
+        if (recomposition.newValid[i])
+          m_composition.add(recomposition.newKeys[i], recomposition.logOdds[i], 1);
+      }
+    }
+
+    OcTreeKey min(std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max(), std::numeric_limits<key_type>::max());
+    OcTreeKey max(0, 0, 0);
+    std::vector<OcTreeKey> changed;
+    numChanged = m_composition.commit(min, max, &changed);
+    if (numChanged > 0){
+      m_updateBBXMin = min;
+      m_updateBBXMax = max;
+      if (m_speckles)
+        m_speckles->markTouched(changed);
+      if (m_mesher)
+        m_mesher->markTouched(changed);
+      if (m_compressMap)
+        m_octree->prune();
+    }
+  }
+
+  for (unsigned r = 0; r < recompositions.size(); ++r)
+    delete recompositions[r];
+
+  if (numChanged > 0){
+    ROS_INFO("Moved %zu submaps, %zu voxels changed", recompositions.size(), numChanged);
+    publishAll(ros::Time::now());
+  }
+}
+
+bool SubmapOctomapServer::worldKey(const OcTreeKey& localKey, const tf::Pose& pose, OcTreeKey& key) const{
+  // only uses the (constant) resolution of m_octree, safe without lock:
+  point3d local = m_octree->keyToCoord(localKey);
+  tf::Point world = pose * tf::Point(local.x(), local.y(), local.z());
+  return m_octree->coordToKeyChecked(pointTfToOctomap(world), key);
+}
+
+bool SubmapOctomapServer::poseChanged(const tf::Pose& a, const tf::Pose& b) const{
+  if ((a.getOrigin() - b.getOrigin()).length() > m_poseTolerance)
+    return true;
+
+  double angle = (a.getRotation().inverse() * b.getRotation()).getAngle();
+  if (angle > M_PI)
+    angle = 2.0 * M_PI - angle;
+
+  return angle > m_angleTolerance;
+}
+
+}
@@ -0,0 +1,91 @@
+/**
+* TraversabilityEstimator: ground vehicle costs from the ColumnIndex floor heights
+* License: BSD
+*/
+
+#include <octomap_server/TraversabilityEstimator.h>
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <limits>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+TraversabilityEstimator::TraversabilityEstimator(const ColumnIndex& columns, double resolution, const Params& params)
+: m_columns(columns),
+  m_resolution(resolution),
+  m_params(params)
+{
+}
+
+bool TraversabilityEstimator::floorHeight(key_type x, key_type y, double& height) const{
+  ColumnIndex::ColumnMap::const_iterator it = m_columns.getColumns().find(ColumnIndex::columnKey(x, y));
+  if (it == m_columns.getColumns().end() || !it->second.hasOccupied())
+    return false;
+
+  // relative to the key origin, only differences matter:
+  height = (double(it->second.minOccupied) + 0.5) * m_resolution;
+  return true;
+}
+
+int8_t TraversabilityEstimator::cost(key_type x, key_type y) const{
+  double h0;
+  if (!floorHeight(x, y, h0))
+    return -1;
+
+  // least-squares plane z = a*dx + b*dy + c over the neighborhood:
+  Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d rhs = Eigen::Vector3d::Zero();
+  double maxStep = 0.0;
+  unsigned numPoints = 0;
+  const int r = m_params.radius;
+  const int maxKey = std::numeric_limits<key_type>::max();
+  for (int dy = -r; dy <= r; ++dy){
+    for (int dx = -r; dx <= r; ++dx){
+      double h;
+      if (int(x) + dx < 0 || int(x) + dx > maxKey || int(y) + dy < 0 || int(y) + dy > maxKey
+          || !floorHeight(x + dx, y + dy, h))
+        continue;
+
+      if (std::abs(dx) <= 1 && std::abs(dy) <= 1)
+        maxStep = std::max(maxStep, std::abs(h - h0));
+
+      Eigen::Vector3d p(dx * m_resolution, dy * m_resolution, 1.0);
+      A += p * p.transpose();
+      rhs += p * (h - h0);
+      ++numPoints;
+    }
+  }
+
+  double slope = 0.0, roughness = 0.0;
+  if (numPoints >= 3 && std::abs(A.determinant()) > 1e-12){
+    Eigen::Vector3d plane = A.ldlt().solve(rhs);
+    slope = std::atan(std::sqrt(plane(0)*plane(0) + plane(1)*plane(1)));
+
+    double sqResiduals = 0.0;
+    for (int dy = -r; dy <= r; ++dy){
+      for (int dx = -r; dx <= r; ++dx){
+        double h;
+        if (!floorHeight(x + dx, y + dy, h))
+          continue;
+
+        double residual = (h - h0) - (plane(0) * dx * m_resolution + plane(1) * dy * m_resolution + plane(2));
+        sqResiduals += residual * residual;
+      }
+    }
+    roughness = std::sqrt(sqResiduals / numPoints);
+  }
+
+  double ratio = std::max(maxStep / m_params.maxStep,
+                          std::max(slope / m_params.maxSlope, roughness / m_params.maxRoughness));
+  if (ratio >= 1.0)
+    return 100;
+
+  // keep 100 for lethal cells:
+  return int8_t(ratio * 99.0);
+}
+
+}
@@ -0,0 +1,185 @@
+/**
+* VoxelBlockMap: hashed dense voxel blocks as scan integration backend of the
+* octomap_server
+* License: BSD
+*/
+
+#include <octomap_server/VoxelBlockMap.h>
+
+#include <octomap_msgs/conversions.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace octomap;
+
+namespace octomap_server{
+
+VoxelBlockMap::VoxelBlockMap(const AbstractOccupancyOcTree& params)
+: m_lastIndex(0),
+  m_lastBlock(NULL),
+  m_numVoxels(0),
+  m_resolution(params.getResolution())
+{
+  setSensorModel(params);
+}
+
+VoxelBlockMap::~VoxelBlockMap(){
+  clear();
+}
+
+void VoxelBlockMap::setSensorModel(const AbstractOccupancyOcTree& params){
+  m_hitLogOdds = params.getProbHitLog();
+  m_missLogOdds = params.getProbMissLog();
+  m_clampingMin = params.getClampingThresMinLog();
+  m_clampingMax = params.getClampingThresMaxLog();
+  m_occupancyThres = params.getOccupancyThresLog();
+}
+
+bool VoxelBlockMap::update(const OcTreeKey& key, float logOddsChange, float& logOdds){
+  Block* block = findBlock(key, true);
+  unsigned i = voxelIndex(key);
+
+  // same arithmetic as OccupancyOcTreeBase::updateNodeLogOdds(), new voxels start at 0:
+  bool known = block->isKnown(i);
+  float previous = known ? block->logOdds[i] : 0.0f;
+  logOdds = std::min(std::max(previous + logOddsChange, m_clampingMin), m_clampingMax);
+  setVoxel(block, i, logOdds);
+
+  return !known || isOccupied(previous) != isOccupied(logOdds);
+}
+
+bool VoxelBlockMap::search(const OcTreeKey& key, float& logOdds) const{
+  Block* block = findBlock(key, false);
+  if (!block)
+    return false;
+
+  unsigned i = voxelIndex(key);
+  if (!block->isKnown(i))
+    return false;
+
+  logOdds = block->logOdds[i];
+  return true;
+}
+
+void VoxelBlockMap::clearBox(const OcTreeKey& min, const OcTreeKey& max, bool toUnknown, float clearLogOdds){
+  // only existing blocks hold known voxels, they are looked up or scanned, whichever is fewer:
+  size_t numBoxBlocks = 1;
+  for (unsigned i = 0; i < 3; ++i)
+    numBoxBlocks *= (max[i] >> BLOCK_BITS) - (min[i] >> BLOCK_BITS) + 1;
+
+  std::vector<std::pair<uint64_t, Block*> > blocks;
+  if (numBoxBlocks <= m_blocks.size()){
+    OcTreeKey key;
+    for (unsigned bz = min[2] >> BLOCK_BITS; bz <= unsigned(max[2] >> BLOCK_BITS); ++bz){
+      for (unsigned by = min[1] >> BLOCK_BITS; by <= unsigned(max[1] >> BLOCK_BITS); ++by){
+        for (unsigned bx = min[0] >> BLOCK_BITS; bx <= unsigned(max[0] >> BLOCK_BITS); ++bx){
+          key[0] = bx << BLOCK_BITS;
+          key[1] = by << BLOCK_BITS;
+          key[2] = bz << BLOCK_BITS;
+          if (Block* block = findBlock(key, false))
+            blocks.push_back(std::make_pair(blockIndex(key), block));
+        }
+      }
+    }
+  } else{
+    for (BlockMap::const_iterator it = m_blocks.begin(); it != m_blocks.end(); ++it){
+      OcTreeKey key = blockKey(it->first);
+      bool overlaps = true;
+      for (unsigned i = 0; i < 3; ++i)
+        overlaps = overlaps && (key[i] >> BLOCK_BITS) >= (min[i] >> BLOCK_BITS) && (key[i] >> BLOCK_BITS) <= (max[i] >> BLOCK_BITS);
+      if (overlaps)
+        blocks.push_back(*it);
+    }
+  }
+
+  for (unsigned i = 0; i < blocks.size(); ++i)
+    clearBlock(blocks[i].first, blocks[i].second, min, max, toUnknown, clearLogOdds);
+}
+
+void VoxelBlockMap::clearBlock(uint64_t index, Block* block, const OcTreeKey& min, const OcTreeKey& max,
+                               bool toUnknown, float clearLogOdds){
+  OcTreeKey firstKey = blockKey(index);
+  for (unsigned i = 0; i < BLOCK_VOXELS; ++i){
+    if (!block->isKnown(i))
+      continue;
+
+    OcTreeKey key = voxelKey(firstKey, i);
+    if (key[0] < min[0] || key[0] > max[0] || key[1] < min[1] || key[1] > max[1]
+        || key[2] < min[2] || key[2] > max[2])
+      continue;
+
+    if (toUnknown)
+      eraseVoxel(block, i);
+    else
+      setVoxel(block, i, clearLogOdds);
+  }
+
+  if (block->numKnown == 0){
+    m_blocks.erase(index);
+    if (m_lastBlock == block)
+      m_lastBlock = NULL;
+    delete block;
+  }
+}
+
+void VoxelBlockMap::clear(){
+  for (BlockMap::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+    delete it->second;
+  m_blocks.clear();
+  m_lastBlock = NULL;
+  m_numVoxels = 0;
+}
+
+bool VoxelBlockMap::toBinaryMsg(octomap_msgs::Octomap& msg) const{
+  OcTree tree(m_resolution);
+  tree.setOccupancyThres(probability(m_occupancyThres));
+  toOcTree(tree);
+  return octomap_msgs::binaryMapToMsg(tree, msg);
+}
+
+size_t VoxelBlockMap::memoryUsage() const{
+  // blocks plus an estimate of the hash map nodes and buckets:
+  return sizeof(VoxelBlockMap) + m_blocks.size() * (sizeof(Block) + sizeof(BlockMap::value_type) + 2 * sizeof(void*))
+      + m_blocks.bucket_count() * sizeof(void*);
+}
+
+VoxelBlockMap::Block* VoxelBlockMap::findBlock(const OcTreeKey& key, bool create) const{
+  uint64_t index = blockIndex(key);
+  if (m_lastBlock && m_lastIndex == index)
+    return m_lastBlock;
+
+  BlockMap::iterator it = m_blocks.find(index);
+  Block* block = NULL;
+  if (it != m_blocks.end())
+    block = it->second;
+  else if (create){
+    block = new Block();
+    m_blocks.insert(std::make_pair(index, block));
+  } else
+    return NULL;
+
+  m_lastIndex = index;
+  m_lastBlock = block;
+  return block;
+}
+
+void VoxelBlockMap::setVoxel(Block* block, unsigned i, float logOdds){
+  if (!block->isKnown(i)){
+    block->known[i >> 6] |= uint64_t(1) << (i & 63);
+    block->numKnown++;
+    m_numVoxels++;
+  }
+  block->logOdds[i] = logOdds;
+}
+
+void VoxelBlockMap::eraseVoxel(Block* block, unsigned i){
+  if (block->isKnown(i)){
+    block->known[i >> 6] &= ~(uint64_t(1) << (i & 63));
+    block->numKnown--;
+    m_numVoxels--;
+  }
+}
+
+}
@@ -0,0 +1,31 @@
+/**
+* octomap_merge_server: octomap_server fusing the maps of several robots
+* License: BSD
+*/
+
+#include <ros/ros.h>
+#include <octomap_server/MergeOctomapServer.h>
+
+#define USAGE "\nUSAGE: octomap_merge_server\n" \
+              "  the robots to merge are set with the merge/sources parameter\n"
+
+using namespace octomap_server;
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "octomap_merge_server");
+
+  if (argc > 1){
+    ROS_ERROR("%s", USAGE);
+    exit(-1);
+  }
+
+  try{
+    MergeOctomapServer server;
+    ros::spin();
+  }catch(std::runtime_error& e){
+    ROS_ERROR("octomap_server exception: %s", e.what());
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,325 @@
+/**
+* octomap_server_bench: Offline replay benchmark for the octomap_server
+* scan insertion. Reads PCD files and sensor poses from disk and drives
+* OctomapMapper::insertScan without a ROS master, then reports the timings
+* as JSON on stdout.
+* License: BSD
+*/
+
+#include <octomap_server/OctomapMapper.h>
+
+#include <octomap_msgs/conversions.h>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/filter.h>
+#include <pcl/common/transforms.h>
+
+#include <ros/time.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define USAGE "\nUSAGE: octomap_server_bench [options] <pcd_dir> <poses.txt>\n" \
+        "  pcd_dir:   directory containing the PCD files (sensor frame)\n" \
+        "  poses.txt: one line per scan: <file.pcd> x y z qx qy qz qw\n" \
+        "             (sensor pose in the map frame, '#' starts a comment)\n" \
+        "  options:\n" \
+        "    --resolution <m>     voxel size (default 0.05)\n" \
+        "    --max_range <m>      sensor max. range, <0: unlimited (default -1)\n" \
+        "    --hit <p> --miss <p> sensor model (default 0.7 / 0.4)\n" \
+        "    --min <p> --max <p>  clamping thresholds (default 0.12 / 0.97)\n" \
+        "    --no_compress        do not prune the tree after each scan\n" \
+        "    --backend <name>     octree or voxel_blocks (default octree)\n" \
+        "    --no_node_cache      update the octree from the root for each voxel\n"
+
+using namespace octomap;
+using namespace octomap_server;
+
+namespace {
+
+struct BenchParams {
+  double resolution;
+  double maxRange;
+  double probHit;
+  double probMiss;
+  double thresMin;
+  double thresMax;
+  bool compressMap;
+  std::string backend;
+  bool nodeCache;
+
+  BenchParams()
+  : resolution(0.05), maxRange(-1.0),
+    probHit(0.7), probMiss(0.4), thresMin(0.12), thresMax(0.97),
+    compressMap(true), backend("octree"), nodeCache(true)
+  {}
+};
+
+struct ScanEntry {
+  std::string filename;
+  float pose[7]; // x y z qx qy qz qw, kept unaligned to be stored in std::vector
+
+  Eigen::Affine3f sensorToWorld() const {
+    return Eigen::Translation3f(pose[0], pose[1], pose[2])
+        * Eigen::Quaternionf(pose[6], pose[3], pose[4], pose[5]).normalized();
+  }
+};
+
+struct ScanResult {
+  std::string filename;
+  size_t numPoints;
+  double insertTime;
+};
+
+/// OctomapMapper set up from the command line instead of the parameter server
+class ReplayMapper : public OctomapMapper {
+public:
+  ReplayMapper(const BenchParams& params) {
+    m_res = params.resolution;
+    m_maxRange = params.maxRange;
+    m_compressMap = params.compressMap;
+    m_useNodeCache = params.nodeCache;
+
+    m_octree = new OcTreeT(m_res);
+    m_octree->setProbHit(params.probHit);
+    m_octree->setProbMiss(params.probMiss);
+    m_octree->setClampingThresMin(params.thresMin);
+    m_octree->setClampingThresMax(params.thresMax);
+    m_treeDepth = m_octree->getTreeDepth();
+    m_maxTreeDepth = m_treeDepth;
+
+    if (params.backend == "voxel_blocks")
+      m_blocks = new VoxelBlockMap(*m_octree);
+  }
+
+  const OcTreeT& octree() const { return *m_octree; }
+  const VoxelBlockMap* blocks() const { return m_blocks; }
+  const NodePathCache<OcTreeT>& nodeCache() const { return m_nodeCache; }
+
+  /// the map as published to the octomap_binary consumers
+  bool binaryMsg(octomap_msgs::Octomap& msg) const {
+    if (m_blocks)
+      return m_blocks->toBinaryMsg(msg);
+    return octomap_msgs::binaryMapToMsg(*m_octree, msg);
+  }
+};
+
+bool readPoses(const std::string& filename, std::vector<ScanEntry>& scans){
+  std::ifstream file(filename.c_str());
+  if (!file.is_open())
+    return false;
+
+  std::string line;
+  while (std::getline(file, line)){
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    std::istringstream ss(line);
+    ScanEntry scan;
+    if (!(ss >> scan.filename))
+      continue; // empty line
+
+    for (unsigned j = 0; j < 7; ++j){
+      if (!(ss >> scan.pose[j])){
+        std::cerr << "Malformed pose line: " << line << std::endl;
+        return false;
+      }
+    }
+
+    scans.push_back(scan);
+  }
+
+  return true;
+}
+
+long peakMemoryKB(){
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+
+  return usage.ru_maxrss; // kilobytes on Linux
+}
+
+double percentile(std::vector<double> values, double p){
+  if (values.empty())
+    return 0.0;
+
+  std::sort(values.begin(), values.end());
+  size_t idx = std::min(values.size() - 1, size_t(p * (values.size() - 1) + 0.5));
+  return values[idx];
+}
+
+std::string jsonEscape(const std::string& in){
+  std::string out;
+  for (size_t i = 0; i < in.size(); ++i){
+    if (in[i] == '"' || in[i] == '\\')
+      out += '\\';
+    out += in[i];
+  }
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+  BenchParams params;
+  std::vector<std::string> positional;
+
+  for (int i = 1; i < argc; ++i){
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "-h" || arg == "--help"){
+      std::cerr << USAGE;
+      return 0;
+    } else if (arg == "--resolution" && hasValue){
+      params.resolution = atof(argv[++i]);
+    } else if (arg == "--max_range" && hasValue){
+      params.maxRange = atof(argv[++i]);
+    } else if (arg == "--hit" && hasValue){
+      params.probHit = atof(argv[++i]);
+    } else if (arg == "--miss" && hasValue){
+      params.probMiss = atof(argv[++i]);
+    } else if (arg == "--min" && hasValue){
+      params.thresMin = atof(argv[++i]);
+    } else if (arg == "--max" && hasValue){
+      params.thresMax = atof(argv[++i]);
+    } else if (arg == "--no_compress"){
+      params.compressMap = false;
+    } else if (arg == "--no_node_cache"){
+      params.nodeCache = false;
+    } else if (arg == "--backend" && hasValue){
+      params.backend = argv[++i];
+      if (params.backend != "octree" && params.backend != "voxel_blocks"){
+        std::cerr << "Unknown backend " << params.backend << USAGE;
+        return 1;
+      }
+    } else if (arg.compare(0, 2, "--") == 0){
+      std::cerr << "Unknown or incomplete option " << arg << USAGE;
+      return 1;
+    } else{
+      positional.push_back(arg);
+    }
+  }
+
+  if (positional.size() != 2){
+    std::cerr << USAGE;
+    return 1;
+  }
+
+  const std::string pcdDir = positional[0];
+  std::vector<ScanEntry> scans;
+  if (!readPoses(positional[1], scans) || scans.empty()){
+    std::cerr << "Could not read any scan poses from " << positional[1] << std::endl;
+    return 1;
+  }
+
+  ReplayMapper mapper(params);
+  std::vector<ScanResult> results;
+  results.reserve(scans.size());
+
+  size_t totalPoints = 0;
+  double totalTime = 0.0;
+  size_t cacheLookups = 0, cacheHits = 0, cacheLevelsSkipped = 0;
+
+  for (size_t i = 0; i < scans.size(); ++i){
+    OctomapMapper::PCLPointCloud pc, ground;
+    std::string path = pcdDir + "/" + scans[i].filename;
+    if (pcl::io::loadPCDFile<OctomapMapper::PCLPoint>(path, pc) != 0){
+      std::cerr << "Could not read " << path << std::endl;
+      return 1;
+    }
+
+    std::vector<int> validIndices;
+    pcl::removeNaNFromPointCloud(pc, pc, validIndices);
+    pcl::transformPointCloud(pc, pc, scans[i].sensorToWorld());
+
+    tf::Point sensorOrigin(scans[i].pose[0], scans[i].pose[1], scans[i].pose[2]);
+
+    // only the insertion itself is timed, not the file IO
+    ros::WallTime startTime = ros::WallTime::now();
+    mapper.insertScan(sensorOrigin, ground, pc);
+    double elapsed = (ros::WallTime::now() - startTime).toSec();
+
+    ScanResult result;
+    result.filename = scans[i].filename;
+    result.numPoints = pc.size();
+    result.insertTime = elapsed;
+    results.push_back(result);
+
+    totalPoints += pc.size();
+    totalTime += elapsed;
+    cacheLookups += mapper.nodeCache().numLookups();
+    cacheHits += mapper.nodeCache().numHits();
+    cacheLevelsSkipped += mapper.nodeCache().levelsSkipped();
+  }
+
+  std::vector<double> latencies;
+  for (size_t i = 0; i < results.size(); ++i)
+    latencies.push_back(results[i].insertTime);
+
+  const OctomapMapper::OcTreeT& octree = mapper.octree();
+
+  // conversion for the existing consumers, from the blocks or the octree:
+  octomap_msgs::Octomap binaryMsg;
+  ros::WallTime convertStart = ros::WallTime::now();
+  mapper.binaryMsg(binaryMsg);
+  double convertTime = (ros::WallTime::now() - convertStart).toSec();
+
+  std::cout.precision(9);
+  std::cout << "{\n  \"params\": {"
+            << "\"resolution\": " << params.resolution
+            << ", \"max_range\": " << params.maxRange
+            << ", \"hit\": " << params.probHit
+            << ", \"miss\": " << params.probMiss
+            << ", \"min\": " << params.thresMin
+            << ", \"max\": " << params.thresMax
+            << ", \"compress_map\": " << (params.compressMap ? "true" : "false")
+            << ", \"backend\": \"" << params.backend << "\""
+            << ", \"node_cache\": " << (params.nodeCache ? "true" : "false")
+            << "},\n  \"scans\": [\n";
+
+  for (size_t i = 0; i < results.size(); ++i){
+    std::cout << "    {\"file\": \"" << jsonEscape(results[i].filename) << "\""
+              << ", \"points\": " << results[i].numPoints
+              << ", \"insert_sec\": " << results[i].insertTime
+              << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+
+  std::cout << "  ],\n  \"summary\": {"
+            << "\"num_scans\": " << results.size()
+            << ", \"total_points\": " << totalPoints
+            << ", \"total_insert_sec\": " << totalTime
+            << ", \"points_per_sec\": " << (totalTime > 0.0 ? totalPoints / totalTime : 0.0)
+            << ", \"scans_per_sec\": " << (totalTime > 0.0 ? results.size() / totalTime : 0.0)
+            << ", \"latency_mean_sec\": " << totalTime / results.size()
+            << ", \"latency_median_sec\": " << percentile(latencies, 0.5)
+            << ", \"latency_p95_sec\": " << percentile(latencies, 0.95)
+            << ", \"latency_max_sec\": " << percentile(latencies, 1.0)
+            << ", \"peak_rss_kb\": " << peakMemoryKB()
+            << ", \"num_nodes\": " << octree.size()
+            << ", \"num_leaf_nodes\": " << octree.getNumLeafNodes()
+            << ", \"tree_memory_bytes\": " << octree.memoryUsage();
+  if (mapper.blocks()){
+    std::cout << ", \"num_blocks\": " << mapper.blocks()->numBlocks()
+              << ", \"num_block_voxels\": " << mapper.blocks()->numVoxels()
+              << ", \"blocks_memory_bytes\": " << mapper.blocks()->memoryUsage();
+  }
+  if (cacheLookups > 0){
+    std::cout << ", \"node_cache_hit_rate\": " << double(cacheHits) / cacheLookups
+              << ", \"node_cache_mean_levels_skipped\": " << double(cacheLevelsSkipped) / cacheLookups;
+  }
+  std::cout << ", \"binary_msg_bytes\": " << binaryMsg.data.size()
+            << ", \"binary_convert_sec\": " << convertTime
+            << "}\n}" << std::endl;
+
+  return 0;
+}
@@ -43,14 +43,15 @@
 namespace octomap_server
 {
 
-class OctomapServerNodelet : public nodelet::Nodelet
+template <class ServerT>
+class OctomapServerNodeletT : public nodelet::Nodelet
 {
 public:
   virtual void onInit()
   {
     NODELET_DEBUG("Initializing octomap server nodelet ...");
     ros::NodeHandle& private_nh = this->getPrivateNodeHandle();
-    server_.reset(new OctomapServer(private_nh));
+    server_.reset(new ServerT(private_nh));
 
     std::string mapFilename("");
     if (private_nh.getParam("map_file", mapFilename)) {
@@ -60,9 +61,15 @@ public:
     }
   }
 private:
-  boost::shared_ptr<OctomapServer> server_;
+  boost::shared_ptr<ServerT> server_;
 };
 
+typedef OctomapServerNodeletT<OctomapServer> OctomapServerNodelet;
+typedef OctomapServerNodeletT<ColorOctomapServer> ColorOctomapServerNodelet;
+typedef OctomapServerNodeletT<StampedOctomapServer> StampedOctomapServerNodelet;
+
 } // namespace
 
 PLUGINLIB_EXPORT_CLASS(octomap_server::OctomapServerNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(octomap_server::ColorOctomapServerNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(octomap_server::StampedOctomapServerNodelet, nodelet::Nodelet)
@@ -30,10 +30,18 @@
 #include <ros/ros.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
+#include <octomap/ColorOcTree.h>
+#include <octomap/OcTreeStamped.h>
 #include <fstream>
 
 #include <octomap_msgs/GetOctomap.h>
+#include <octomap_server/MapTiles.h>
+#include <octomap_server/GetMapTile.h>
+#include <octomap_server/GetMapTileIndex.h>
 using octomap_msgs::GetOctomap;
+using octomap_server::MapTiles;
+using octomap_server::GetMapTile;
+using octomap_server::GetMapTileIndex;
 
 #define USAGE "\nUSAGE: octomap_server_static <mapfile.[bt|ot]>\n" \
 		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree)\n"
@@ -44,12 +52,19 @@ using namespace octomap;
 class OctomapServerStatic{
 public:
   OctomapServerStatic(const std::string& filename)
-    : m_octree(NULL), m_worldFrameId("/map")
+    : m_octree(NULL), m_tiles(NULL), m_worldFrameId("/map")
   {
 
     ros::NodeHandle private_nh("~");
     private_nh.param("frame_id", m_worldFrameId, m_worldFrameId);
 
+    bool tilesEnabled = false;
+    double tileSize = 10.0;
+    int tileLevels = 4;
+    private_nh.param("tiles/enable", tilesEnabled, tilesEnabled);
+    private_nh.param("tiles/size", tileSize, tileSize);
+    private_nh.param("tiles/levels", tileLevels, tileLevels);
+
 
     // open file:
     if (filename.length() <= 3){
@@ -90,11 +105,41 @@ public:
     m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerStatic::octomapBinarySrv, this);
     m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerStatic::octomapFullSrv, this);
 
+    if (tilesEnabled){
+      if (tileSize > 0.0 && tileLevels > 0)
+        buildTiles(unsigned(tileSize / m_octree->getResolution() + 0.5), tileLevels);
+      else
+        ROS_ERROR("tiles/size and tiles/levels must be positive, tiles will not be served");
+    }
+
   }
 
   ~OctomapServerStatic(){
+    delete m_tiles;
+  }
+
+  /// precomputes the tiles of all levels, for the tree types that can be read from files
+  void buildTiles(unsigned tileKeys, unsigned numLevels){
+    ros::WallTime startTime = ros::WallTime::now();
+    m_tiles = new MapTiles(m_octree->getResolution(), tileKeys, numLevels);
+    if (OcTree* octree = dynamic_cast<OcTree*>(m_octree))
+      m_tiles->build(*octree);
+    else if (ColorOcTree* colorTree = dynamic_cast<ColorOcTree*>(m_octree))
+      m_tiles->build(*colorTree);
+    else if (OcTreeStamped* stampedTree = dynamic_cast<OcTreeStamped*>(m_octree))
+      m_tiles->build(*stampedTree);
+    else{
+      ROS_ERROR("Tiles are not supported for octree type \"%s\"", m_octree->getTreeType().c_str());
+      delete m_tiles;
+      m_tiles = NULL;
+      return;
+    }
 
+    ROS_INFO("Built %zu tiles of %f m on %u levels (%zu bytes) in %f sec", m_tiles->numTiles(), m_tiles->getTileSize(0),
+             m_tiles->getNumLevels(), m_tiles->memoryUsage(), (ros::WallTime::now() - startTime).toSec());
 
+    m_tileService = m_nh.advertiseService("octomap_tile", &OctomapServerStatic::octomapTileSrv, this);
+    m_tileIndexService = m_nh.advertiseService("octomap_tile_index", &OctomapServerStatic::octomapTileIndexSrv, this);
   }
 
   bool octomapBinarySrv(GetOctomap::Request  &req,
@@ -123,11 +168,35 @@ public:
     return true;
   }
 
+  bool octomapTileSrv(GetMapTile::Request  &req,
+                      GetMapTile::Response &res)
+  {
+    ROS_DEBUG("Sending tile (%d, %d, %d) of level %u on service request", req.x, req.y, req.z, req.level);
+    res.found = m_tiles->getTile(req.x, req.y, req.z, req.level, res.map);
+    res.map.header.frame_id = m_worldFrameId;
+    res.map.header.stamp = ros::Time::now();
+    return true;
+  }
+
+  bool octomapTileIndexSrv(GetMapTileIndex::Request  &req,
+                           GetMapTileIndex::Response &res)
+  {
+    res.num_levels = m_tiles->getNumLevels();
+    if (req.level >= m_tiles->getNumLevels())
+      return false;
+
+    res.tile_size = m_tiles->getTileSize(req.level);
+    res.resolution = m_tiles->getResolution() * double(1 << req.level);
+    m_tiles->getTileIndices(req.level, res.x, res.y, res.z);
+    return true;
+  }
+
 private:
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService;
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_tileService, m_tileIndexService;
   ros::NodeHandle m_nh;
-  std::string m_worldFrameId;
   AbstractOccupancyOcTree* m_octree;
+  MapTiles* m_tiles; // NULL if tiles/enable is off
+  std::string m_worldFrameId;
 
 };
 
@@ -0,0 +1,31 @@
+/**
+* octomap_submap_server: octomap_server composing the map from keyframe submaps
+* License: BSD
+*/
+
+#include <ros/ros.h>
+#include <octomap_server/SubmapOctomapServer.h>
+
+#define USAGE "\nUSAGE: octomap_submap_server\n" \
+              "  maps cannot be loaded, the map is built from the keyframe submaps\n"
+
+using namespace octomap_server;
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "octomap_submap_server");
+
+  if (argc > 1){
+    ROS_ERROR("%s", USAGE);
+    exit(-1);
+  }
+
+  try{
+    SubmapOctomapServer server;
+    ros::spin();
+  }catch(std::runtime_error& e){
+    ROS_ERROR("octomap_server exception: %s", e.what());
+    return -1;
+  }
+
+  return 0;
+}
@@ -126,6 +126,17 @@ namespace subt
     /// \param[in] _req The datagram contained in the request.
     private: void OnMessage(const subt::msgs::Datagram &_req);
 
+    /// \brief Add a new member to the team and reassign the indices.
+    /// \param[in] _address Address (and name) of the new member.
+    /// \param[in] _model Model of the new member.
+    protected: void AddMember(const std::string &_address,
+                              gazebo::physics::ModelPtr _model);
+
+    /// \brief Assign the dense indices of the team members in address order
+    /// and rebuild the member table, after a member joined or left. The
+    /// neighbors and data rate usage by index are moved to the new indices.
+    private: void UpdateIndices();
+
     /// \brief Queue to store the incoming messages received from the clients.
     protected: std::deque<msgs::Datagram> incomingMsgs;
 
@@ -136,6 +147,13 @@ namespace subt
     /// \brief Information about the members of the team.
     protected: subt::TeamMembershipPtr team;
 
+    /// \brief Members of the team by their index.
+    protected: std::vector<subt::TeamMemberPtr> members;
+
+    /// \brief Data rate usage (bits) of each member of the team in the
+    /// current cycle, by index.
+    protected: std::vector<uint32_t> dataRateUsage;
+
     /// \brief An Ignition Transport node for communications.
     private: ignition::transport::Node node;
 
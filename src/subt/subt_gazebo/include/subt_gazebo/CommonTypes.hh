@@ -20,16 +20,13 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include <gazebo/common/Time.hh>
 #include <gazebo/physics/PhysicsTypes.hh>
 #include <ignition/math/graph/Graph.hh>
 
 namespace subt
 {
-  /// \def Neighbors_M
-  /// \brief Map of neighbors
-  using Neighbors_M = std::map<std::string, double>;
-
   /// \def VisibilityGraph
   /// \brief An undirected graph to represent communication visibility between
   /// different areas of the world.
@@ -48,17 +45,19 @@ namespace subt
     /// \brief Model pointer.
     public: gazebo::physics::ModelPtr model;
 
-    /// \brief List of neighbors and comms probabilities for this robot.
-    public: Neighbors_M neighbors;
+    /// \brief Dense index of this robot in the team (0 to team size - 1, in
+    /// address order). Reassigned by the broker when the membership changes.
+    public: unsigned int index = 0;
+
+    /// \brief Comms probabilities from this robot to each member of the team,
+    /// by index. Negative for members that are not neighbors.
+    public: std::vector<double> neighbors;
 
     /// \brief Is this robot on outage?
     public: bool onOutage;
 
     /// \brief When will the last outage finish?
     public: gazebo::common::Time onOutageUntil;
-
-    /// \brief Current data rate usage (bits).
-    public: uint32_t dataRateUsage;
   };
 
   /// \brief All the supported artifact types.
@@ -21,9 +21,6 @@
 #ifndef SUBT_GAZEBO_COMMSMODEL_HH_
 #define SUBT_GAZEBO_COMMSMODEL_HH_
 
-#include <map>
-#include <string>
-#include <utility>
 #include <vector>
 #include <gazebo/common/Time.hh>
 #include <gazebo/physics/PhysicsTypes.hh>
@@ -75,13 +72,9 @@ namespace subt
     /// \param[in] _sdf Pointer to the SDF element of the plugin.
     private: void LoadParameters(sdf::ElementPtr _sdf);
 
-    /// \brief ToDo.
-    private: void InitializeVisibility();
-
-    /// \brief Populate a vector with the pairs of addresses that will be
-    /// checked in UpdateVisibility() each iteration. Note that the vector will
-    /// contain all combinations of two different elements (not permutations).
-    private: void UpdateVisibilityPairs();
+    /// \brief Collect the members of the team by their index and resize the
+    /// visibility matrix, if the membership changed since the last update.
+    private: void UpdateMembers();
 
     /// \brief Decide if each member of the team enters into a comms outage.
     private: void UpdateOutages();
@@ -95,18 +88,20 @@ namespace subt
     /// \brief Update the neighbor list for a single robot and notifies the
     /// robot with the updated list.
     ///
-    /// \param[in] _address Address of the robot to be updated.
-    private: void UpdateNeighborList(const std::string &_address);
+    /// \param[in] _index Index of the robot to be updated.
+    private: void UpdateNeighborList(const unsigned int _index);
+
+    /// \brief Members of the team by their index.
+    private: std::vector<TeamMemberPtr> members;
 
-    /// \brief Visibility between vehicles. The key is a pair with the
-    /// addresses of the vehicles involved. The value is a vector of strings
-    /// that stores the entity names of the first and last obstacles between the
-    /// vehicles. If there is line of sight the value contains a vector of one
-    /// element (empty string).
-    private: std::map<std::pair<std::string, std::string>, bool> visibility;
+    /// \brief Visibility between vehicles, a symmetric matrix indexed by the
+    /// indices of the vehicles involved (row-major). Non-zero if they are
+    /// visible to each other.
+    private: std::vector<uint8_t> visibility;
 
-    /// \brief Pairs of addresses used to update the visibility.
-    private: std::vector<std::pair<std::string, std::string>> visibilityPairs;
+    /// \brief Position of each member of the team in the current update, by
+    /// index.
+    private: std::vector<ignition::math::Vector3d> positions;
 
     /// \brief Minimum free-space distance (m) between two nodes to be
     /// neighbors. Set to <0 for no limit.
@@ -159,9 +154,6 @@ namespace subt
     /// \brief Keep track of update sim-time.
     private: gazebo::common::Time lastUpdateTime;
 
-    /// Vector containing all the addresses of the team.
-    private: std::vector<std::string> addresses;
-
     /// When simple mode is enabled, all messages will be delivered to the
     /// destinations.
     private: bool simpleMode = false;
@@ -98,18 +98,20 @@ void Broker::NotifyNeighbors()
   subt::msgs::Neighbor_M neighbors;
 
   // Send neighbors updates to each member of the team.
-  for (auto const &robot : (*this->Team()))
+  for (auto const &teamMember : this->members)
   {
-    auto address = robot.first;
-    auto teamMember = (*this->Team())[address];
-
     // Populate the list of neighbors for this address.
     ignition::msgs::StringMsg_V v;
-    for (auto const &neighbor : teamMember->neighbors)
-      v.add_data(neighbor.first);
+    auto const numNeighbors =
+      std::min(teamMember->neighbors.size(), this->members.size());
+    for (size_t i = 0; i < numNeighbors; ++i)
+    {
+      if (teamMember->neighbors[i] >= 0.0)
+        v.add_data(this->members[i]->address);
+    }
 
     // Add the list of neighbors for each address.
-    (*neighbors.mutable_neighbors())[address] = v;
+    (*neighbors.mutable_neighbors())[teamMember->address] = v;
   }
 
   // Notify all clients the updated list of neighbors.
@@ -126,8 +128,7 @@ void Broker::DispatchMessages(const uint32_t _maxDataRatePerCycle,
       this->rndEngine);
 
   // Clear the data rate usage for each robot.
-  for (const auto &member : (*this->team))
-    member.second->dataRateUsage = 0;
+  this->dataRateUsage.assign(this->members.size(), 0);
 
   while (!this->incomingMsgs.empty())
   {
@@ -136,7 +137,8 @@ void Broker::DispatchMessages(const uint32_t _maxDataRatePerCycle,
     this->incomingMsgs.pop_front();
 
     // Sanity check: Make sure that the sender is a member of the team.
-    if (this->team->find(msg.src_address()) == this->team->end())
+    auto const sender = this->team->find(msg.src_address());
+    if (sender == this->team->end())
     {
       std::cerr << "Broker::DispatchMessages(): Discarding message. Robot ["
                 << msg.src_address() << "] is not registered as a member of the"
@@ -144,17 +146,20 @@ void Broker::DispatchMessages(const uint32_t _maxDataRatePerCycle,
       continue;
     }
 
-    // Get the list of neighbors of the sender.
-    const Neighbors_M &neighbors = (*this->team)[msg.src_address()]->neighbors;
+    // Get the comms probabilities from the sender to each member (by index).
+    const std::vector<double> &neighbors = sender->second->neighbors;
+    auto const numNeighbors =
+      std::min(neighbors.size(), this->dataRateUsage.size());
 
     // Update the data rate usage.
+    // We account the overhead caused by the UDP/IP/Ethernet headers + the
+    // payload. We convert the total amount of bytes to bits.
     auto dataSize = (msg.data().size() + _udpOverhead) * 8;
-    (*this->team)[msg.src_address()]->dataRateUsage += dataSize;
-    for (const auto &neighbor : neighbors)
+    this->dataRateUsage[sender->second->index] += dataSize;
+    for (size_t i = 0; i < numNeighbors; ++i)
     {
-      // We account the overhead caused by the UDP/IP/Ethernet headers + the
-      // payload. We convert the total amount of bytes to bits.
-      (*this->team)[neighbor.first]->dataRateUsage += dataSize;
+      if (neighbors[i] >= 0.0)
+        this->dataRateUsage[i] += dataSize;
     }
 
     std::string dstEndPoint =
@@ -168,11 +173,16 @@ void Broker::DispatchMessages(const uint32_t _maxDataRatePerCycle,
       for (const BrokerClientInfo &client : clientsV)
       {
         // Make sure that we're sending the message to a valid neighbor.
-        if (neighbors.find(client.address) == neighbors.end())
+        auto const dst = this->team->find(client.address);
+        if (dst == this->team->end())
+          continue;
+
+        auto const dstIndex = dst->second->index;
+        if (dstIndex >= numNeighbors || neighbors[dstIndex] < 0.0)
           continue;
 
         // Check if the maximum data rate has been reached in the destination.
-        if ((*team)[client.address]->dataRateUsage > _maxDataRatePerCycle)
+        if (this->dataRateUsage[dstIndex] > _maxDataRatePerCycle)
         {
           // Debug output
           // gzdbg << "Dropping message (max data rate) from "
@@ -184,7 +194,7 @@ void Broker::DispatchMessages(const uint32_t _maxDataRatePerCycle,
 
         // Decide whether this neighbor gets this message, according to the
         // probability of communication between them right now.
-        const double &neighborProb = neighbors.at(client.address);
+        const double &neighborProb = neighbors[dstIndex];
         if (ignition::math::Rand::DblUniform(0.0, 1.0) < neighborProb)
         {
           // Debug output
@@ -259,13 +269,7 @@ bool Broker::Register(const std::string &_id)
   if (!model)
     return false;
 
-  auto newMember = std::make_shared<TeamMember>();
-
-  // Name and address are the same in SubT.
-  newMember->address = _id;
-  newMember->name = _id;
-  newMember->model = model;
-  (*this->team)[_id] = newMember;
+  this->AddMember(_id, model);
 
   std::cout << "New client registered [" << _id << "]" <<  std::endl;
 
@@ -284,6 +288,7 @@ bool Broker::Unregister(const std::string &_id)
   }
 
   this->team->erase(_id);
+  this->UpdateIndices();
 
   // Unbind.
   for (auto &endpointKv : this->endpoints)
@@ -303,6 +308,64 @@ bool Broker::Unregister(const std::string &_id)
   return true;
 }
 
+//////////////////////////////////////////////////
+void Broker::AddMember(const std::string &_address,
+  gazebo::physics::ModelPtr _model)
+{
+  auto newMember = std::make_shared<TeamMember>();
+
+  // Name and address are the same in SubT.
+  newMember->address = _address;
+  newMember->name = _address;
+  newMember->model = _model;
+  (*this->team)[_address] = newMember;
+  this->UpdateIndices();
+}
+
+//////////////////////////////////////////////////
+void Broker::UpdateIndices()
+{
+  std::vector<subt::TeamMemberPtr> oldMembers;
+  oldMembers.swap(this->members);
+  std::vector<uint32_t> oldDataRateUsage;
+  oldDataRateUsage.swap(this->dataRateUsage);
+
+  for (auto const &robot : (*this->team))
+  {
+    robot.second->index = this->members.size();
+    this->members.push_back(robot.second);
+  }
+
+  // New index of each old index, -1 for the members that left.
+  std::vector<int> newIndices(oldMembers.size(), -1);
+  for (size_t i = 0; i < oldMembers.size(); ++i)
+  {
+    auto const member = this->team->find(oldMembers[i]->address);
+    if (member != this->team->end() && member->second == oldMembers[i])
+      newIndices[i] = member->second->index;
+  }
+
+  // Keep the data rate usage and neighbors attached to their addresses.
+  this->dataRateUsage.assign(this->members.size(), 0);
+  for (size_t i = 0; i < oldDataRateUsage.size() && i < newIndices.size(); ++i)
+  {
+    if (newIndices[i] >= 0)
+      this->dataRateUsage[newIndices[i]] = oldDataRateUsage[i];
+  }
+
+  for (auto const &member : this->members)
+  {
+    std::vector<double> neighbors(this->members.size(), -1.0);
+    for (size_t i = 0;
+         i < member->neighbors.size() && i < newIndices.size(); ++i)
+    {
+      if (newIndices[i] >= 0)
+        neighbors[newIndices[i]] = member->neighbors[i];
+    }
+    member->neighbors.swap(neighbors);
+  }
+}
+
 /////////////////////////////////////////////////
 bool Broker::OnAddrRegistration(const ignition::msgs::StringMsg &_req,
     ignition::msgs::Boolean &_rep)
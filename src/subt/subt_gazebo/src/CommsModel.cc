@@ -17,7 +17,6 @@
 
 #include <algorithm>
 #include <string>
-#include <utility>
 #include <gazebo/common/Assert.hh>
 #include <gazebo/common/Console.hh>
 #include <gazebo/common/Time.hh>
@@ -47,9 +46,8 @@ CommsModel::CommsModel(TeamMembershipPtr _team,
 //////////////////////////////////////////////////
 void CommsModel::Update()
 {
-  this->UpdateVisibilityPairs();
-
-  this->InitializeVisibility();
+  // Pick up the robots that joined or left the team.
+  this->UpdateMembers();
 
   // Decide if each member of the team enters into a comms outage.
   this->UpdateOutages();
@@ -164,10 +162,9 @@ void CommsModel::UpdateOutages()
   // Get elapsed time since the last update.
   auto dt = curTime - this->lastUpdateTime;
 
-  for (auto const &robot : (*this->team))
+  for (auto const &teamMember : this->members)
   {
-    auto address = robot.first;
-    auto teamMember = robot.second;
+    auto const &address = teamMember->address;
 
     // Check if I am currently on a temporary outage.
     if (teamMember->onOutage &&
@@ -221,47 +218,61 @@ void CommsModel::UpdateOutages()
 }
 
 //////////////////////////////////////////////////
-void CommsModel::InitializeVisibility()
+void CommsModel::UpdateMembers()
 {
-  // Initialize visibility.
-  for (auto const &robotA : (*this->team))
+  // The broker assigns the indices when a robot joins or leaves, so the team
+  // is unchanged as long as every member is still found at its index.
+  bool changed = this->members.size() != this->team->size();
+  for (auto it = this->team->begin(); !changed && it != this->team->end(); ++it)
   {
-    auto addressA = robotA.second->address;
-    for (auto const &robotB : (*this->team))
-    {
-      auto addressB = robotB.second->address;
-      this->visibility[std::make_pair(addressA, addressB)] = false;
-    }
+    auto const &member = it->second;
+    changed = member->index >= this->members.size() ||
+              this->members[member->index] != member;
+  }
+
+  if (!changed)
+    return;
+
+  const size_t numMembers = this->team->size();
+  this->members.assign(numMembers, nullptr);
+  for (auto const &robot : (*this->team))
+  {
+    GZ_ASSERT(robot.second->index < numMembers,
+              "team member index out of range");
+    this->members[robot.second->index] = robot.second;
   }
+
+  this->visibility.assign(numMembers * numMembers, 0);
+  this->positions.resize(numMembers);
 }
 
 //////////////////////////////////////////////////
 void CommsModel::UpdateVisibility()
 {
-  // All combinations between a pair of vehicles.
-  for (auto const &keyA : this->visibilityPairs)
+  const size_t numMembers = this->members.size();
+
+  // Query each pose once, instead of once per pair of vehicles.
+  for (size_t i = 0; i < numMembers; ++i)
   {
-    auto addressA = keyA.first;
-    auto addressB = keyA.second;
-    auto keyB = std::make_pair(addressB, addressA);
+    if (this->members[i]->model)
+      this->positions[i] = this->members[i]->model->WorldPose().Pos();
+  }
 
-    // Sanity check: The model pointers should exist.
-    if (!(*team)[addressA]->model || !(*team)[addressB]->model)
+  // All combinations between a pair of vehicles.
+  for (size_t a = 0; a < numMembers; ++a)
+  {
+    for (size_t b = a + 1; b < numMembers; ++b)
     {
-      this->visibility[keyA] = false;
-      this->visibility[keyB] = false;
-      continue;
+      // Sanity check: The model pointers should exist.
+      bool visible = this->members[a]->model && this->members[b]->model &&
+        (this->simpleMode ||
+         this->positions[a].Distance(this->positions[b]) <=
+           this->commsDistanceMax);
+
+      // Update both the pair and the symmetric case.
+      this->visibility[a * numMembers + b] = visible;
+      this->visibility[b * numMembers + a] = visible;
     }
-
-    auto poseA = (*team)[addressA]->model->WorldPose();
-    auto poseB = (*team)[addressB]->model->WorldPose();
-
-    this->visibility[keyA] =
-      this->simpleMode ||
-      poseA.Pos().Distance(poseB.Pos()) <= this->commsDistanceMax;
-
-    // Update the symmetric case.
-    this->visibility[keyB] = this->visibility[keyA];
   }
 }
 
@@ -269,27 +280,27 @@ void CommsModel::UpdateVisibility()
 void CommsModel::UpdateNeighbors()
 {
   // Update the list of neighbors for each robot.
-  for (const auto &addr : this->addresses)
-    this->UpdateNeighborList(addr);
+  for (unsigned int i = 0; i < this->members.size(); ++i)
+    this->UpdateNeighborList(i);
 }
 
 //////////////////////////////////////////////////
-void CommsModel::UpdateNeighborList(const std::string &_address)
+void CommsModel::UpdateNeighborList(const unsigned int _index)
 {
-  GZ_ASSERT(this->team->find(_address) != this->team->end(),
-            "_address not found in the team.");
+  GZ_ASSERT(_index < this->members.size(), "_index not found in the team.");
 
-  auto teamMember = (*this->team)[_address];
-  auto myPose = teamMember->model->WorldPose();
+  const size_t numMembers = this->members.size();
+  auto const &teamMember = this->members[_index];
+  auto const &myPos = this->positions[_index];
 
   // Initialize the neighbors list.
-  teamMember->neighbors.clear();
+  teamMember->neighbors.assign(numMembers, -1.0);
 
   // Decide whether this node goes into our neighbor list.
-  for (auto const &member : (*this->team))
+  for (size_t i = 0; i < numMembers; ++i)
   {
     // Where is the other node?
-    auto other = member.second;
+    auto const &other = this->members[i];
 
     // Both robots are in an outage.
     if (teamMember->onOutage || other->onOutage)
@@ -298,16 +309,12 @@ void CommsModel::UpdateNeighborList(const std::string &_address)
     }
 
     // Do not include myself in the list of neighbors.
-    if (other->address == _address)
+    if (i == _index)
       continue;
 
     // ToDo: Check if there's line of sight between the two vehicles.
 
-    auto key = std::make_pair(_address, other->address);
-    GZ_ASSERT(this->visibility.find(key) != this->visibility.end(),
-      "vehicle key not found in visibility");
-
-    bool visible = this->visibility[key];
+    bool visible = this->visibility[_index * numMembers + i];
     if (!visible)
     {
       continue;
@@ -315,12 +322,11 @@ void CommsModel::UpdateNeighborList(const std::string &_address)
 
     if (this->simpleMode)
     {
-      teamMember->neighbors[member.first] = 1.0;
+      teamMember->neighbors[i] = 1.0;
       continue;
     }
 
-    auto otherPose = other->model->WorldPose();
-    double dist = myPose.Pos().Distance(otherPose.Pos());
+    double dist = myPos.Distance(this->positions[i]);
 
     auto neighborDist = dist;
     auto commsDist = dist;
@@ -368,38 +374,6 @@ void CommsModel::UpdateNeighborList(const std::string &_address)
     // Also a message containing the neighbor list (not the probabilities)
     // will be sent out below, to allow robot controllers to query the
     // neighbor list.
-    teamMember->neighbors[member.first] = commsProb;
-  }
-}
-
-//////////////////////////////////////////////////
-void CommsModel::UpdateVisibilityPairs()
-{
-  this->addresses.clear();
-  this->visibilityPairs.clear();
-
-  for (auto const &robotA : (*this->team))
-  {
-    auto addressA = robotA.second->address;
-    this->addresses.push_back(addressA);
-    for (auto const &robotB : (*this->team))
-    {
-      auto addressB = robotB.second->address;
-      std::pair<std::string, std::string> aPair(addressA, addressB);
-      std::pair<std::string, std::string> aPairInverse(addressB, addressA);
-
-      // Do not include this case.
-      if (addressA == addressB)
-        continue;
-
-      // Check if we already have the symmetric pair stored.
-      if (std::find(this->visibilityPairs.begin(), this->visibilityPairs.end(),
-            aPairInverse) != this->visibilityPairs.end())
-      {
-        continue;
-      }
-
-      this->visibilityPairs.push_back(aPair);
-    }
+    teamMember->neighbors[i] = commsProb;
   }
 }
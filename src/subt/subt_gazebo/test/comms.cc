@@ -18,7 +18,10 @@
 #include <gtest/gtest.h>
 #include <ros/ros.h>
 #include <chrono>
+#include <set>
+#include <string>
 
+#include "subt_gazebo/Broker.hh"
 #include "subt_gazebo/CommonTypes.hh"
 #include "subt_gazebo/CommsClient.hh"
 #include "test/test_config.h"
@@ -166,6 +169,115 @@ TEST_F(CommsTest, Comms)
   EXPECT_FALSE(this->multicastCallbackExecuted);
 }
 
+/////////////////////////////////////////////////
+/// \brief A broker exposing its bookkeeping by address. Members are added
+/// without a Gazebo model, so no world is needed.
+class TestBroker : public Broker
+{
+  /// \brief Add a member to the team, as Register() does.
+  /// \param[in] _address Address of the new member.
+  public: void Add(const std::string &_address)
+  {
+    this->AddMember(_address, nullptr);
+  }
+
+  /// \brief Set the comms probability from one member to another.
+  /// \param[in] _src Address of the sender.
+  /// \param[in] _dst Address of the neighbor.
+  /// \param[in] _prob Comms probability.
+  public: void SetNeighbor(const std::string &_src, const std::string &_dst,
+                           const double _prob)
+  {
+    auto &neighbors = this->team->at(_src)->neighbors;
+    neighbors.resize(this->members.size(), -1.0);
+    neighbors[this->team->at(_dst)->index] = _prob;
+  }
+
+  /// \brief Addresses of the neighbors of a member.
+  /// \param[in] _address Address of the member.
+  /// \return The addresses of its neighbors.
+  public: std::set<std::string> Neighbors(const std::string &_address) const
+  {
+    std::set<std::string> result;
+    auto const &neighbors = this->team->at(_address)->neighbors;
+    for (size_t i = 0; i < neighbors.size(); ++i)
+    {
+      if (neighbors[i] >= 0.0)
+        result.insert(this->members.at(i)->address);
+    }
+    return result;
+  }
+
+  /// \brief Data rate usage of a member in the last cycle.
+  /// \param[in] _address Address of the member.
+  /// \return The data rate usage (bits).
+  public: uint32_t DataRateUsage(const std::string &_address) const
+  {
+    return this->dataRateUsage.at(this->team->at(_address)->index);
+  }
+
+  /// \brief Queue a message.
+  /// \param[in] _src Address of the sender.
+  /// \param[in] _dst Destination address.
+  /// \param[in] _data Payload.
+  public: void Queue(const std::string &_src, const std::string &_dst,
+                     const std::string &_data)
+  {
+    subt::msgs::Datagram msg;
+    msg.set_src_address(_src);
+    msg.set_dst_address(_dst);
+    msg.set_dst_port(kDefaultPort);
+    msg.set_data(_data);
+    this->incomingMsgs.push_back(msg);
+  }
+};
+
+/////////////////////////////////////////////////
+TEST(BrokerTest, IndicesReassigned)
+{
+  TestBroker broker;
+  broker.Add("a");
+  broker.Add("c");
+  broker.SetNeighbor("a", "c", 1.0);
+  broker.SetNeighbor("c", "a", 1.0);
+
+  // The sender and its neighbor account for the message (payload in bits).
+  broker.Queue("a", "c", "_data_");
+  broker.DispatchMessages(UINT32_MAX, 0u);
+  EXPECT_EQ(48u, broker.DataRateUsage("a"));
+  EXPECT_EQ(48u, broker.DataRateUsage("c"));
+
+  // "b" is inserted between "a" and "c", "c" moves to a new index.
+  broker.Add("b");
+  EXPECT_EQ(std::set<std::string>({"c"}), broker.Neighbors("a"));
+  EXPECT_EQ(std::set<std::string>({"a"}), broker.Neighbors("c"));
+  EXPECT_TRUE(broker.Neighbors("b").empty());
+  EXPECT_EQ(48u, broker.DataRateUsage("a"));
+  EXPECT_EQ(0u, broker.DataRateUsage("b"));
+  EXPECT_EQ(48u, broker.DataRateUsage("c"));
+
+  broker.SetNeighbor("b", "c", 1.0);
+  broker.SetNeighbor("c", "b", 1.0);
+
+  // "c" moves back, its neighbor "a" stays.
+  EXPECT_TRUE(broker.Unregister("b"));
+  EXPECT_EQ(std::set<std::string>({"c"}), broker.Neighbors("a"));
+  EXPECT_EQ(std::set<std::string>({"a"}), broker.Neighbors("c"));
+  EXPECT_EQ(48u, broker.DataRateUsage("a"));
+  EXPECT_EQ(48u, broker.DataRateUsage("c"));
+
+  // "c" moves to the first index, a re-registered "a" starts over.
+  EXPECT_TRUE(broker.Unregister("a"));
+  EXPECT_TRUE(broker.Neighbors("c").empty());
+  EXPECT_EQ(48u, broker.DataRateUsage("c"));
+
+  broker.Add("a");
+  EXPECT_TRUE(broker.Neighbors("a").empty());
+  EXPECT_TRUE(broker.Neighbors("c").empty());
+  EXPECT_EQ(0u, broker.DataRateUsage("a"));
+  EXPECT_EQ(48u, broker.DataRateUsage("c"));
+}
+
 /////////////////////////////////////////////////
 int main(int argc, char **argv)
 {